@@ -1,4 +1,6 @@
 #include "uncore_address_map.h"
+#include "pfn_index.h"
+#include <perf_counters.h>
 #include <string.h>
 #include <math.h>
 
@@ -8,11 +10,11 @@
 struct search_for_bit_n_args
 {
 	uint64_t thread_id;
-	uint64_t pid;
 	uint64_t seq_len;
 	//memory info. Buffer, physical address to 
 	//search for adjacent line at a certain bit.
 	uint8_t *mem;
+	pfn_index_t *pfn;
 	uint64_t offset;
 	//Search space
 	uint64_t start;
@@ -34,22 +36,19 @@ pthread_mutex_t adjacent_addr_struct_mutex = PTHREAD_MUTEX_INITIALIZER;
 void *search_for_adjacent_bit_n(void *targs)
 {
 	struct search_for_bit_n_args args = *(struct search_for_bit_n_args *)targs;
-	register uint8_t *ptr = args.mem;
-	register uint64_t pid = args.pid;
+	pfn_index_t *pfn = args.pfn;
 	register uint64_t seq_len = args.seq_len;
-	register uint64_t p_addr = vtop(pid, (uint64_t)&ptr[args.offset]);
+	register uint64_t p_addr = pfn_index_vtop(pfn, args.offset);
 	register uint64_t bit = 0;
 	register uint64_t end = args.end;
 	register uint64_t it = args.it;
 
-	//Required for vtop()
 	register uint64_t pa = 0LL;
 
 	//search from provided start point, incrementing by cache line
 	for (uint64_t i = args.start; i < end; i=i+it)
 	{
-		ptr[i] = pid;
-		pa = vtop(pid, (uint64_t)&ptr[i]);
+		pa = pfn_index_vtop(pfn, i);
 		bit = does_val_differ_by_one(p_addr, pa);
 		if(bit)
 		{
@@ -81,22 +80,19 @@ void *search_for_adjacent_bit_n(void *targs)
 void *search_for_adjacent_bit_n_intra_page(void *targs)
 {
 	struct search_for_bit_n_args args = *(struct search_for_bit_n_args *)targs;
-	register uint8_t *ptr = args.mem;
-	register uint64_t pid = args.pid;
+	pfn_index_t *pfn = args.pfn;
 	register uint64_t seq_len = args.seq_len;	
-	register uint64_t p_addr = vtop(pid, (uint64_t)&ptr[args.offset]);
+	register uint64_t p_addr = pfn_index_vtop(pfn, args.offset);
 	register uint64_t bit = 0;
 	register uint64_t end = args.end;
 	register uint64_t it = args.it;
 
-	//Required for vtop()
 	register uint64_t pa = 0LL;
 
 	//search from provided start point, incrementing by cache line
 	for (uint64_t i = args.start; i < end; i=i+it)
 	{
-		ptr[i] = pid;
-		pa = vtop(pid, (uint64_t)&ptr[i]);
+		pa = pfn_index_vtop(pfn, i);
 		bit = does_val_differ_by_one(p_addr, pa);
 		if(bit)
 		{
@@ -117,10 +113,9 @@ void *search_for_adjacent_bit_n_intra_page(void *targs)
 	}
 }
 
-void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64_t seq_len)
+//The buffer has already been faulted in and translated (pfn_index_prefault()), so candidates are array lookups
+void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, pfn_index_t *pfn, uint64_t seq_len)
 {
-	unsigned int pid = (unsigned int)getpid();
-
 	for (int i = 0; i < ADDR_BITS; ++i)
 	{
 		adj->count[i] = 0;
@@ -131,7 +126,7 @@ void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64
 	
 	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS;)
 	{
-		if(adj->count[b] == NUM_ADJ_ADDR)
+		if(adj->count[b] == NUM_ADJ_ADDR || !adj->measure[b])
 		{
 			//printf("Found enough adjacent addresses for bit %d (%d)\n", b, adj->count[b]);
 			b++;
@@ -152,8 +147,7 @@ void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64
 			else
 				it = PAGE_SIZE;
 
-			mem[i] = pid;
-			pa = vtop(pid, (uint64_t)&mem[i]);
+			pa = pfn_index_vtop(pfn, i);
 
 			//Checks if bit is not set, such that adj_addr_a hold the address with the bit not set
 			if(is_bit_k_set(pa, b))
@@ -163,9 +157,9 @@ void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64
 				{
 					struct search_for_bit_n_args *args = malloc(sizeof(struct search_for_bit_n_args));
 					args->thread_id = 0;
-					args->pid = pid;
 					args->seq_len = seq_len;
 					args->mem = mem;
+					args->pfn = pfn;
 					args->offset = i;
 					args->start = i - (i % PAGE_SIZE); //start searching from start of page
 					args->end = i + PAGE_SIZE;
@@ -187,9 +181,9 @@ void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64
 						CPU_SET(t, &mask);
 						struct search_for_bit_n_args *args = malloc(sizeof(struct search_for_bit_n_args));
 						args->thread_id = t;
-						args->pid = pid;
 						args->seq_len = seq_len;
 						args->mem = mem;
+						args->pfn = pfn;
 						args->offset = i;
 						args->start = (t * (len/NUM_THREADS));
 						args->end = (t * (len/NUM_THREADS)) + (len/NUM_THREADS);
@@ -212,17 +206,10 @@ void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64
 							search_for_bit_n_threads++;
 				   		pthread_mutex_unlock(&search_for_bit_n_mutex);
 					}
-					//Wait for threads to end
-					while(search_for_bit_n_threads > 0)
-					{
-						sleep(1);
-						if(adj->count[b] == NUM_ADJ_ADDR)
-						{
-							//Join the threads up to finish.
-							for (int t = 0; t < NUM_THREADS; ++t)
-								pthread_join(threads[t], NULL);
-						}
-					}
+					//Wait for threads to end. With PFNs looked up rather than read from pagemap a pass takes far less
+					//than the second this used to poll for.
+					for (int t = 0; t < NUM_THREADS; ++t)
+						pthread_join(threads[t], NULL);
 				}
 			}
 			if(adj->count[b] == NUM_ADJ_ADDR)
@@ -240,7 +227,7 @@ void find_xor_for_each_bit(adj_addr_t *adj, int xor_map[ADDR_BITS], uint64_t seq
 
 	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 	{
-		for (int a = 0; a < NUM_ADJ_ADDR; ++a)
+		for (int a = 0; a < NUM_ADJ_ADDR && adj->measure[b]; ++a)
 		{
 			if(adj->seq_a[b][a].xor_op != adj->seq_b[b][a].xor_op && adj->seq_a[b][a].xor_op != 0xBADBAD && adj->seq_b[b][a].xor_op != 0xBADBAD)
 			{
@@ -261,95 +248,109 @@ void find_xor_for_each_bit(adj_addr_t *adj, int xor_map[ADDR_BITS], uint64_t seq
 	putchar('\n');
 }
 
-void find_master_sequence(adj_addr_t *adj, uint8_t *mem, uint64_t len, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS])
+//Index into the master sequence of the line at paddr
+static inline uint64_t master_sequence_index(uint64_t paddr, uint64_t seq_len, int xor_map[ADDR_BITS])
 {
-	unsigned int pid = (unsigned int)getpid();
-	//Get an average of ID->Slice values, which will show a reduction on non power of two processors 
-	//from the larger ID space to the smaller number of possible slice values.
-	int16_t *id_to_slice_map = calloc(seq_len, sizeof(int16_t));
-	uint64_t *id_to_slice_map_count = calloc(seq_len, sizeof(uint64_t));
-
-	int incomplete = 0;
-
-	//Get a sample of addresses which start at the beginning of a sequence and their slice mappings
-	//This should be 1:1 and show the reduction used to go from n sequence IDs to m slices.
-	//Collect 10 samples for each ID. Select the slice mapping as the returned ID which occured the most.
-	for (int i = 0; i < seq_len*8; ++i)
-	{
-		uint64_t rnd = (uint64_t) rand() % len;
-		//Get random value which is at the start of a sequence
-		rnd -= (rnd % (seq_len*L3_CACHELINE));
+	return (((paddr / L3_CACHELINE) % seq_len) ^ calculate_xor_reduction(paddr, xor_map)) & (seq_len - 1);
+}
 
-		//Bring the address into memory
-		mem[rnd] = pid;
+//Adds one measured line as a vote for the master sequence entry it indexes
+static void master_sequence_vote(uint32_t *votes, uint64_t paddr, int16_t slice, int num_cbos, uint64_t seq_len, int xor_map[ADDR_BITS])
+{
+	if(paddr == (uint64_t)-1 || (paddr >> ADDR_BITS) > 0 || slice < 0 || slice >= num_cbos)
+		return;
+	votes[master_sequence_index(paddr, seq_len, xor_map) * num_cbos + slice]++;
+}
 
-		int id = calculate_xor_reduction(vtop(pid, (uint64_t)&mem[rnd]), xor_map);
-		int slice = get_slice_value(mem, len, rnd);
-		//Ignore -1 results, don't have enough bits to resolve these
-		if(id != -1)
+//An entry is settled once its most common slice has MASTER_SEQUENCE_VOTES votes and a majority
+static int master_sequence_settled(uint32_t *votes, int num_cbos, int16_t *slice)
+{
+	uint32_t top = 0, total = 0;
+	*slice = -1;
+	for (int c = 0; c < num_cbos; ++c)
+	{
+		total += votes[c];
+		if(votes[c] > top)
 		{
-			id_to_slice_map[id] += slice;
-			id_to_slice_map_count[id]++;
-			//Ignore if we have a -1 here, as this means we have had issues with this ID previous
-			if(id_to_slice_map[id] > 0)
-			{
-				if((id_to_slice_map[id] % id_to_slice_map_count[id]) != 0)
-				{
-					id_to_slice_map[id] = -1;				
-				}
-			}			
+			top = votes[c];
+			*slice = c;
 		}
 	}
-	//Get the master sequence. If there are any portions missing, we check it with all the 
-	//adjacent address sequences to find the one that matches the most.
-	for (int i = 0; i < seq_len; ++i)
+	return top >= MASTER_SEQUENCE_VOTES && top * 2 > total;
+}
+
+//Every measured line of a sequence is master_sequence[(line % seq_len) ^ ID], so any line can stand in for any
+//entry. The adjacent address sequences are already measured and vote first. Then for each entry which is not
+//settled, the PFN index gives a line which indexes it directly, and only that line is measured.
+void find_master_sequence(adj_addr_t *adj, uint8_t *mem, uint64_t len, pfn_index_t *pfn, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS])
+{
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	uint32_t *votes = calloc(seq_len * num_cbos, sizeof(uint32_t));
+	uint64_t block_size = seq_len * L3_CACHELINE;
+
+	uint64_t prior = 0;
+	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 	{
-		if(id_to_slice_map_count[i] > 0)
-		{
-			id_to_slice_map[i] /= id_to_slice_map_count[i];
-			master_sequence[i] = id_to_slice_map[i];
-		}
-		else
+		for (uint64_t a = 0; a < NUM_ADJ_ADDR; ++a)
 		{
-			id_to_slice_map[i] = -1;
-			incomplete = 1;
+			if(adj->count[b] <= a)
+				continue;
+			for (uint64_t i = 0; i < seq_len; ++i)
+			{
+				uint64_t offset_a = adj->bit_n_a[b][a] + i * L3_CACHELINE;
+				uint64_t offset_b = adj->bit_n_b[b][a] + i * L3_CACHELINE;
+				if(offset_a < len)
+					master_sequence_vote(votes, pfn_index_vtop(pfn, offset_a), adj->slice_map_a[b][a][i], num_cbos, seq_len, xor_map);
+				if(offset_b < len)
+					master_sequence_vote(votes, pfn_index_vtop(pfn, offset_b), adj->slice_map_b[b][a][i], num_cbos, seq_len, xor_map);
+				prior += 2;
+			}
 		}
 	}
-	//Master sequence may be incomplete, therefore look for a sequence in the adjacent addresses which is most similar
-	//The most similar will be the master sequence.
-	if(incomplete)
+
+	slice_session_t *session = slice_session_init(mem, len);
+	uint64_t unsettled = seq_len;
+	for (int round = 0; round < MASTER_SEQUENCE_ROUNDS && unsettled > 0; ++round)
 	{
-		int max_mem_cmp = -10000;
-		for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
+		unsettled = 0;
+		for (uint64_t v = 0; v < seq_len; ++v)
 		{
-			for (uint64_t a = 0; a < NUM_ADJ_ADDR; ++a)
+			if(master_sequence_settled(&votes[v * num_cbos], num_cbos, &master_sequence[v]))
+				continue;
+			unsettled++;
+			//Any block of seq_len lines holds the whole sequence, find the line in a random one which indexes v
+			for (int tries = 0; tries < 64; ++tries)
 			{
-				int cmp = memcmp(id_to_slice_map, adj->slice_map_a[b][a], seq_len*sizeof(int16_t));
-				if(cmp >= max_mem_cmp)
-				{
-					max_mem_cmp = cmp;
-					memcpy(master_sequence, adj->slice_map_a[b][a], seq_len*sizeof(int16_t));
-				}
-			}
-			for (uint64_t a = 0; a < NUM_ADJ_ADDR; ++a)
-			{
-				int cmp = memcmp(id_to_slice_map, adj->slice_map_b[b][a], seq_len*sizeof(int16_t));
-				if(cmp >= max_mem_cmp)
-				{
-					max_mem_cmp = cmp;
-					memcpy(master_sequence, adj->slice_map_b[b][a], seq_len*sizeof(int16_t));
-				}
+				uint64_t page = rand64() % pfn->n_pages;
+				uint64_t base = pfn->paddr[page];
+				if(base == (uint64_t)-1)
+					continue;
+				uint64_t block = (base + (rand64() % pfn->page_size)) & ~(block_size - 1);
+				uint64_t paddr = block + ((v ^ calculate_xor_reduction(block, xor_map)) & (seq_len - 1)) * L3_CACHELINE;
+				//Blocks can be larger than the page on 4KB pages
+				if(paddr < base || paddr >= base + pfn->page_size)
+					continue;
+				int16_t slice = slice_session_measure(session, (page << pfn->page_bits) + (paddr - base));
+				master_sequence_vote(votes, paddr, slice, num_cbos, seq_len, xor_map);
+				break;
 			}
 		}
 	}
-	free(id_to_slice_map);
-	free(id_to_slice_map_count);
+	printf("Master sequence: %lu lines from adjacent sequences, %lu measured, %lu entries unsettled\n\n", prior, slice_session_measured(session), unsettled);
+	slice_session_destroy(session);
+
+	//Whatever did not settle takes its most common slice, -1 if it was never seen
+	for (uint64_t v = 0; v < seq_len; ++v)
+		master_sequence_settled(&votes[v * num_cbos], num_cbos, &master_sequence[v]);
+
+	free(votes);
 }
 
 adj_addr_t *adjacent_address_init()
 {
 	adj_addr_t *temp = calloc(1, sizeof(adj_addr_t));
 	memset(temp, 0, sizeof(adj_addr_t));
+	memset(temp->measure, 1, sizeof(temp->measure));
 	return temp;
 }
 
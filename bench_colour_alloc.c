@@ -0,0 +1,286 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// LLC interference between a victim thread and aggressor threads streaming through buffers
+// larger than the LLC, with the buffers coloured by the colour allocator. Every buffer is
+// walked as pointer chains stored in its own lines, so the walks touch no uncoloured memory.
+// The victim follows one chain in a random order and times every access. An access slower than half way
+// between an LLC hit and a DRAM access counts as a miss. Run alone, sharing every colour
+// with the aggressors, and with the colours split by set group and by slice.
+// sudo ./bench_colour_alloc output/<result>.txt [threads] [victim KB] [aggressor MB] [pool MB] [hugetlbfs pool file]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include "colour_alloc.h"
+
+#define WARMUP_PASSES 4
+#define TIMED_PASSES 16
+#define DRAM_SAMPLES 4096
+//Independent chains an aggressor follows at once, so its misses overlap as a streaming access would
+#define AGGRESSOR_CHAINS 8
+//Victim access times are counted in one page of buckets, one per cycle, with slower ones in the last
+#define TIME_BUCKETS 1024
+
+enum
+{
+	SCENARIO_ALONE,
+	SCENARIO_SHARED,
+	SCENARIO_SETS,
+	SCENARIO_SLICES,
+	SCENARIOS
+};
+
+static const char *scenario_names[SCENARIOS] = {"alone", "shared", "split sets", "split slices"};
+
+struct aggressor
+{
+	pthread_t thread;
+	int cpu;
+	colour_buf_t *buf;
+	volatile int *stop;
+	uint64_t accesses;
+	double seconds;
+} typedef aggressor_t;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+	{
+		perror("bench_colour_alloc()");
+		exit(1);
+	}
+}
+
+static double seconds_since(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//Links the lines of b, in their shuffled order, into cycles of every chains'th line. Each line holds a pointer to the
+//next line of its cycle, the first line of each goes to heads. Returns the number of cycles, at most one per line.
+static int link_chains(colour_buf_t *b, int chains, uint8_t **heads)
+{
+	if((uint64_t)chains > b->n_lines)
+		chains = b->n_lines;
+	for (uint64_t i = 0; i < b->n_lines; ++i)
+		*(uint8_t **)b->lines[i] = b->lines[i + chains < b->n_lines ? i + chains : i % chains];
+	for (int c = 0; c < chains; ++c)
+		heads[c] = b->lines[c];
+	return chains;
+}
+
+static void *aggressor_thread(void *arg)
+{
+	aggressor_t *a = arg;
+	pin(a->cpu);
+	uint8_t *p[AGGRESSOR_CHAINS];
+	int chains = link_chains(a->buf, AGGRESSOR_CHAINS, p);
+	uint64_t steps = a->buf->n_lines / chains;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(!*a->stop)
+	{
+		for (uint64_t i = 0; i < steps; ++i)
+			for (int c = 0; c < chains; ++c)
+				p[c] = *(uint8_t * volatile *)p[c];
+		a->accesses += steps * chains;
+	}
+	a->seconds = seconds_since(&start);
+	return NULL;
+}
+
+//Access time at quantile q of a histogram of n times
+static uint32_t time_quantile(const uint64_t *buckets, uint64_t n, double q)
+{
+	uint64_t seen = 0;
+	for (uint32_t t = 0; t < TIME_BUCKETS; ++t)
+	{
+		seen += buckets[t];
+		if(seen > n * q)
+			return t;
+	}
+	return TIME_BUCKETS - 1;
+}
+
+//Histogram of the access times of the timed passes over b, returns the number of accesses
+static uint64_t measure_victim(colour_buf_t *b, uint64_t *buckets)
+{
+	uint8_t *head;
+	link_chains(b, 1, &head);
+	memset(buckets, 0, TIME_BUCKETS * sizeof(uint64_t));
+	uint8_t *p = head;
+	for (uint64_t i = 0; i < WARMUP_PASSES * b->n_lines; ++i)
+		p = *(uint8_t * volatile *)p;
+	for (uint64_t i = 0; i < TIMED_PASSES * b->n_lines; ++i)
+	{
+		uint32_t t = memaccesstime(p);
+		buckets[t < TIME_BUCKETS ? t : TIME_BUCKETS - 1]++;
+		p = *(uint8_t * volatile *)p;
+	}
+	return TIMED_PASSES * b->n_lines;
+}
+
+//Median time of a line flushed out to DRAM
+static uint32_t measure_dram(colour_buf_t *b)
+{
+	uint8_t *head;
+	link_chains(b, 1, &head);
+	uint64_t buckets[TIME_BUCKETS] = {0};
+	uint64_t n = b->n_lines < DRAM_SAMPLES ? b->n_lines : DRAM_SAMPLES;
+	uint8_t *p = head;
+	for (uint64_t i = 0; i < n; ++i)
+	{
+		uint8_t *next = *(uint8_t * volatile *)p;
+		clflush(p, NULL);
+		asm volatile("mfence");
+		uint32_t t = memaccesstime(p);
+		buckets[t < TIME_BUCKETS ? t : TIME_BUCKETS - 1]++;
+		p = next;
+	}
+	return time_quantile(buckets, n, 0.5);
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <result file> [threads] [victim KB] [aggressor MB] [pool MB] [hugetlbfs pool file]\n", argv[0]);
+		return 1;
+	}
+	slicehash_t *hash = slicehash_load(argv[1]);
+	if(hash == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if(llc <= 0)
+		llc = 8 << 20;
+	int threads = argc > 2 ? atoi(argv[2]) : 2;
+	if(threads < 1)
+		threads = 1;
+	//The victim fits in its half of the LLC, every aggressor streams through twice the whole LLC
+	uint64_t victim_size = argc > 3 ? strtoull(argv[3], NULL, 0) << 10 : (uint64_t)llc / 4;
+	uint64_t aggressor_size = argc > 4 ? strtoull(argv[4], NULL, 0) << 20 : (uint64_t)llc * 2;
+	uint64_t pool_len = (argc > 5 ? strtoull(argv[5], NULL, 0) : 256) << 20;
+	int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pin(0);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	colour_pool_t *pool = NULL;
+	if(argc > 6)
+	{
+		pool = colour_pool_init_file(hash, pool_len, 0, argv[6], NULL);
+	}
+	else
+	{
+		pool = colour_pool_init(hash, pool_len, 0);
+	}
+	if(pool == NULL)
+	{
+		printf("Could not create the colour pool, check hugepages are reserved and this is run as root\n");
+		slicehash_destroy(hash);
+		return 1;
+	}
+	printf("Pool of %lu MB set up in %.3f s%s\n", pool_len >> 20, seconds_since(&start),
+		pool->frame_pool != NULL && pool->frame_pool->reused ? " (reused)" : "");
+	printf("%d slices x %d set groups = %d colours | LLC %ld KB | %d CPUs\n", pool->num_slices, pool->set_groups, pool->num_colours, llc >> 10, cpus);
+	printf("Victim %lu KB on CPU 0 | %d aggressors of %lu MB\n\n", victim_size >> 10, threads - 1, aggressor_size >> 20);
+
+	uint64_t buckets[TIME_BUCKETS];
+	aggressor_t *aggressors = calloc(threads, sizeof(aggressor_t));
+	volatile int stop = 0;
+	uint32_t threshold = 0, hit = 0, dram = 0;
+
+	printf("Scenario     | Median | p99    | Miss rate | Aggressor Mlines/s\n");
+	for (int s = 0; s < SCENARIOS; ++s)
+	{
+		if(s != SCENARIO_ALONE && threads < 2)
+			break;
+		//The victim is tenant 0 of 2, the aggressors share tenant 1
+		colour_set_t victim_set, aggressor_set;
+		if(s == SCENARIO_ALONE || s == SCENARIO_SHARED)
+		{
+			colour_set_split(pool, COLOUR_SPLIT_SETS, 0, 1, &victim_set);
+			colour_set_split(pool, COLOUR_SPLIT_SETS, 0, 1, &aggressor_set);
+		}
+		else
+		{
+			int policy = s == SCENARIO_SETS ? COLOUR_SPLIT_SETS : COLOUR_SPLIT_SLICES;
+			colour_set_split(pool, policy, 0, 2, &victim_set);
+			colour_set_split(pool, policy, 1, 2, &aggressor_set);
+		}
+
+		colour_buf_t *victim = colour_alloc(pool, &victim_set, victim_size);
+		int ok = victim != NULL && victim->n_lines > 0;
+		for (int t = 1; t < threads && ok && s != SCENARIO_ALONE; ++t)
+		{
+			aggressors[t].buf = colour_alloc(pool, &aggressor_set, aggressor_size);
+			ok = aggressors[t].buf != NULL && aggressors[t].buf->n_lines > 0;
+			if(ok)
+				shuffle(aggressors[t].buf->lines, aggressors[t].buf->n_lines, sizeof(uint8_t *));
+		}
+		if(!ok)
+		{
+			printf("%-12s | not enough free lines, use a larger pool\n", scenario_names[s]);
+		}
+		else
+		{
+			shuffle(victim->lines, victim->n_lines, sizeof(uint8_t *));
+			stop = 0;
+			for (int t = 1; t < threads && s != SCENARIO_ALONE; ++t)
+			{
+				aggressors[t].cpu = t % cpus;
+				aggressors[t].stop = &stop;
+				aggressors[t].accesses = 0;
+				pthread_create(&aggressors[t].thread, NULL, aggressor_thread, &aggressors[t]);
+			}
+			uint64_t n = measure_victim(victim, buckets);
+			uint32_t median = time_quantile(buckets, n, 0.5), p99 = time_quantile(buckets, n, 0.99);
+			stop = 1;
+			double rate = 0;
+			for (int t = 1; t < threads && s != SCENARIO_ALONE; ++t)
+			{
+				pthread_join(aggressors[t].thread, NULL);
+				rate += aggressors[t].accesses / aggressors[t].seconds / 1e6;
+			}
+
+			//An LLC hit is the victim's median alone, the miss threshold half way from there to DRAM
+			if(s == SCENARIO_ALONE)
+			{
+				hit = median;
+				dram = measure_dram(victim);
+				threshold = (hit + dram) / 2;
+			}
+			uint64_t misses = 0;
+			for (uint32_t t = threshold + 1; t < TIME_BUCKETS; ++t)
+				misses += buckets[t];
+			printf("%-12s | %6u | %6u | %8.2f%% | ", scenario_names[s], median, p99, 100.0 * misses / n);
+			if(s == SCENARIO_ALONE)
+				printf("-\n");
+			else
+				printf("%.1f\n", rate);
+		}
+
+		for (int t = 1; t < threads; ++t)
+		{
+			colour_free(pool, aggressors[t].buf);
+			aggressors[t].buf = NULL;
+		}
+		colour_free(pool, victim);
+	}
+
+	if(threshold)
+		printf("\nLLC hit %u | DRAM %u | Miss above %u cycles\n", hit, dram, threshold);
+
+	free(aggressors);
+	colour_pool_destroy(pool);
+	slicehash_destroy(hash);
+	return 0;
+}
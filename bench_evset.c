@@ -0,0 +1,209 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Builds LLC eviction sets for random targets from the recovered hash, checks how often they
+// evict the target, and compares against a group testing reduction (Vila et al.) which only
+// uses timing.
+// sudo ./bench_evset output/<result>.txt [targets] [buffer MB]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+
+#include "evset.h"
+
+#ifndef MAP_HUGETLB
+	#define MAP_HUGETLB 0x40000 /* arch specific */
+#endif
+
+#define PAGE_SIZE_2MB (1ULL << 21)
+#define EVICTION_TRIALS 32
+#define TEST_REPEATS 5
+//Candidate pool for group testing, in multiples of associativity * slices
+#define POOL_FACTOR 3
+
+static uint32_t threshold;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+//Anything slower than halfway between a cache hit and a DRAM access is a miss
+static void calibrate(uint8_t *line)
+{
+	uint32_t hit[1000], miss[1000];
+	for (int i = 0; i < 1000; ++i)
+	{
+		memaccess(line);
+		hit[i] = memaccesstime(line);
+		clflush(line, 0);
+		miss[i] = memaccesstime(line);
+	}
+	qsort(hit, 1000, sizeof(uint32_t), compare_u32);
+	qsort(miss, 1000, sizeof(uint32_t), compare_u32);
+	threshold = (hit[500] + miss[500]) / 2;
+	printf("Hit: %u | Miss: %u | Threshold: %u cycles\n\n", hit[500], miss[500], threshold);
+}
+
+//Single trial, 1 if traversing the set pushed the target out of the LLC
+static int evicts_once(uint8_t *target, uint8_t **set, int n)
+{
+	memaccess(target);
+	for (int pass = 0; pass < 2; ++pass)
+		for (int i = 0; i < n; ++i)
+			memaccess(set[i]);
+	return memaccesstime(target) > threshold;
+}
+
+//Majority of TEST_REPEATS trials, used by group testing
+static int evicts(uint8_t *target, uint8_t **set, int n)
+{
+	int count = 0;
+	for (int r = 0; r < TEST_REPEATS; ++r)
+		count += evicts_once(target, set, n);
+	return count > TEST_REPEATS / 2;
+}
+
+//Group testing reduction: split the set into assoc+1 groups and drop any group the set still evicts without
+static int group_test_reduce(uint8_t *target, uint8_t **set, int n, int assoc)
+{
+	uint8_t **tmp = malloc(n * sizeof(uint8_t *));
+	while(n > assoc)
+	{
+		int groups = assoc + 1;
+		int reduced = 0;
+		for (int g = 0; g < groups && !reduced; ++g)
+		{
+			int lo = g * n / groups, hi = (g + 1) * n / groups;
+			int m = 0;
+			for (int i = 0; i < n; ++i)
+				if(i < lo || i >= hi)
+					tmp[m++] = set[i];
+			if(evicts(target, tmp, m))
+			{
+				memcpy(set, tmp, m * sizeof(uint8_t *));
+				n = m;
+				reduced = 1;
+			}
+		}
+		//No group could be removed, noise broke the reduction
+		if(!reduced)
+			break;
+	}
+	free(tmp);
+	return n;
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <result file> [targets] [buffer MB]\n", argv[0]);
+		return 1;
+	}
+	slicehash_t *hash = slicehash_load(argv[1]);
+	if(hash == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	int targets = argc > 2 ? atoi(argv[2]) : 16;
+	uint64_t len = (argc > 3 ? strtoull(argv[3], NULL, 0) : 1024) << 20;
+	uint8_t *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(mem == MAP_FAILED)
+	{
+		perror("bench_evset()");
+		slicehash_destroy(hash);
+		return 1;
+	}
+	//Without root every PFN is hidden, and sets built from them would be garbage
+	pfn_index_t *pfn = pfn_index_init(mem, len, PAGE_SIZE_2MB);
+	if(pfn == NULL || pfn_index_untranslated(pfn) != 0)
+	{
+		printf("pagemap gives no physical addresses, run as root\n");
+		pfn_index_destroy(pfn);
+		munmap(mem, len);
+		slicehash_destroy(hash);
+		return 1;
+	}
+	evset_builder_t *b = evset_builder_init(mem, len, pfn, hash, 0);
+	int assoc = slicehash_l3_associativity(hash) > 0 ? slicehash_l3_associativity(hash) : (int)sysconf(_SC_LEVEL3_CACHE_ASSOC);
+	int num_slices = slicehash_num_slices(hash);
+	int pool_len = assoc * num_slices * POOL_FACTOR;
+	uint8_t **set = malloc(pool_len * sizeof(uint8_t *));
+
+	printf("%s | %d slices | %d way | %d set bits\n", slicehash_model(hash), num_slices, assoc, b->set_bits);
+	calibrate(mem);
+
+	double hash_time = 0, group_time = 0;
+	double hash_rate = 0, group_rate = 0, group_correct = 0;
+	int group_done = 0;
+	printf("Target | Hash Set (us) | Evicted | Group Test (us) | Size | Evicted | Same Slice\n");
+	for (int t = 0; t < targets; ++t)
+	{
+		uint64_t offset = (rand64() % len) & ~(uint64_t)(slicehash_cacheline(hash) - 1);
+		uint8_t *target = &mem[offset];
+		int target_slice = slicehash_slice(hash, pfn_index_vtop(pfn, offset));
+
+		//Eviction set from the hash
+		double t0 = now();
+		int n = evset_build(b, offset, set, assoc);
+		double t_hash = now() - t0;
+		int evicted = 0;
+		for (int i = 0; i < EVICTION_TRIALS; ++i)
+			evicted += evicts_once(target, set, n);
+		hash_time += t_hash;
+		hash_rate += (double)evicted / EVICTION_TRIALS;
+		printf("%6d | %13.2f | %6.1f%% |", t, t_hash * 1e6, 100.0 * evicted / EVICTION_TRIALS);
+
+		//Group testing from a pool of lines which share the target's page offset bits, so only the slice is unknown
+		t0 = now();
+		uint64_t stride = 1ULL << (b->cacheline_bits + b->set_bits);
+		int m = 0;
+		while(m < pool_len)
+		{
+			uint64_t cand = (((rand64() % len) & ~(stride - 1)) | (offset & (stride - 1)));
+			if(cand != offset)
+				set[m++] = &mem[cand];
+		}
+		int reduced = -1;
+		if(evicts(target, set, m))
+			reduced = group_test_reduce(target, set, m, assoc);
+		double t_group = now() - t0;
+		if(reduced < 0)
+		{
+			printf(" %15.2f | pool did not evict\n", t_group * 1e6);
+			continue;
+		}
+		evicted = 0;
+		for (int i = 0; i < EVICTION_TRIALS; ++i)
+			evicted += evicts_once(target, set, reduced);
+		int same = 0;
+		for (int i = 0; i < reduced; ++i)
+			same += slicehash_slice(hash, pfn_index_vtop(pfn, set[i] - mem)) == target_slice;
+		group_time += t_group;
+		group_rate += (double)evicted / EVICTION_TRIALS;
+		group_correct += (double)same / reduced;
+		group_done++;
+		printf(" %15.2f | %4d | %6.1f%% | %d/%d\n", t_group * 1e6, reduced, 100.0 * evicted / EVICTION_TRIALS, same, reduced);
+	}
+
+	printf("\nHash:       %.2f us per set | %.1f%% eviction rate\n", hash_time / targets * 1e6, 100.0 * hash_rate / targets);
+	if(group_done > 0)
+		printf("Group test: %.2f us per set | %.1f%% eviction rate | %.1f%% lines in target slice | %d/%d reduced\n",
+			group_time / group_done * 1e6, 100.0 * group_rate / group_done, 100.0 * group_correct / group_done, group_done, targets);
+
+	free(set);
+	evset_builder_destroy(b);
+	pfn_index_destroy(pfn);
+	munmap(mem, len);
+	slicehash_destroy(hash);
+	return 0;
+}
@@ -0,0 +1,483 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Microbenchmarks for the tool's hot primitives, built against the simulated perfcounters
+// backend in sim/ so they run on hosts without MSR access (make bench). Each benchmark is
+// repeated and reported as ns/op with its spread. --save writes the results, --baseline
+// compares against a saved run and exits 1 if anything is slower than the noise allows.
+// ./bench_primitives [--reps n] [--save file] [--baseline file] [--tolerance fraction]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#include "uncore_address_map.h"
+#include "slicehash.h"
+#include <perf_counters.h>
+#include <string.h>
+
+#define BENCH_DEFAULT_REPS 15
+#define BENCH_MAX 32
+//Lines and pages each repetition works through
+#define BENCH_ADDRS 4096
+#define BENCH_PAGES 1024
+#define BENCH_MEASURE_LINES 256
+
+struct bench_result
+{
+	char name[48];
+	double mean;
+	double stddev;
+	double min;
+	int reps;
+} typedef bench_result_t;
+
+//Runs one repetition of n ops
+typedef void (*bench_fn_t)(void *ctx, uint64_t n);
+
+struct bench_ctx
+{
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t *vaddrs;
+	uint64_t *paddrs;
+	int16_t *slices;
+	int xor_map[ADDR_BITS];
+	uint64_t *mask;
+	int mask_bits;
+	int16_t *master_sequence;
+	uint64_t seq_len;
+	slicehash_t *hash;
+	//First line of the consecutive range the range benchmarks cover
+	uint64_t range_start;
+	slice_session_t *session;
+	//fill_seq_data inputs for the current seq_len
+	sequence_data_t *seq_data;
+	int16_t *slice_map;
+	uint64_t fill_seq_len;
+	adj_addr_t *adj;
+} typedef bench_ctx_t;
+
+static bench_result_t results[BENCH_MAX];
+static int n_results = 0;
+static int reps = BENCH_DEFAULT_REPS;
+static volatile uint64_t sink;
+static int saved_stdout = -1;
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//Some of the benchmarked functions print as they go
+static void mute()
+{
+	fflush(stdout);
+	saved_stdout = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+}
+
+static void unmute()
+{
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+}
+
+//One warm up repetition, then reps timed ones
+static void bench(const char *name, bench_fn_t fn, void *ctx, uint64_t n)
+{
+	double *ns = malloc(reps * sizeof(double));
+	fn(ctx, n);
+	for (int r = 0; r < reps; ++r)
+	{
+		double start = now_ns();
+		fn(ctx, n);
+		ns[r] = (now_ns() - start) / n;
+	}
+	bench_result_t *res = &results[n_results++];
+	snprintf(res->name, sizeof(res->name), "%s", name);
+	res->reps = reps;
+	res->mean = calculate_mean(ns, reps);
+	res->stddev = calculate_stddev(ns, reps, res->mean);
+	res->min = ns[0];
+	for (int r = 1; r < reps; ++r)
+		res->min = ns[r] < res->min ? ns[r] : res->min;
+	printf("%-32s %12.1f %10.1f %12.1f\n", res->name, res->mean, res->stddev, res->min);
+	free(ns);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
+static void bench_vtop(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	unsigned pid = (unsigned)getpid();
+	for (uint64_t i = 0; i < n; ++i)
+		c->paddrs[i] = vtop(pid, c->vaddrs[i]);
+}
+
+static void bench_vtop_batch(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	vtop_batch((unsigned)getpid(), c->vaddrs, c->paddrs, n);
+}
+
+static void bench_find_set_bit(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		acc += find_set_bit(c->paddrs[i]);
+	sink = acc;
+}
+
+static void bench_does_val_differ_by_one(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	//Every other pair differs on one bit
+	for (uint64_t i = 0; i < n; ++i)
+		acc += does_val_differ_by_one(c->paddrs[i], c->paddrs[i] ^ (i & 1 ? 1ULL << (i % ADDR_BITS) : 3ULL << (i % 32)));
+	sink = acc;
+}
+
+static void bench_xor_reduction(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		acc += calculate_xor_reduction(c->paddrs[i], c->xor_map);
+	sink = acc;
+}
+
+static void bench_xor_reduction_masks(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+	{
+		uint64_t id = 0;
+		for (int m = 0; m < c->mask_bits; ++m)
+			id |= (uint64_t)__builtin_parityll(c->paddrs[i] & c->mask[m]) << m;
+		acc += id;
+	}
+	sink = acc;
+}
+
+static void bench_address_slice(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		acc += calculate_address_slice(c->paddrs[i], c->master_sequence, c->seq_len, c->xor_map);
+	sink = acc;
+}
+
+static void bench_address_slice_masks(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		acc += slicehash_slice(c->hash, c->paddrs[i]);
+	sink = acc;
+}
+
+static void bench_address_slice_batch(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	slicehash_slice_batch(c->hash, c->paddrs, c->slices, n);
+	sink = c->slices[n - 1];
+}
+
+//Consecutive lines, one slicehash_slice() call each
+static void bench_address_slice_lines(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	for (uint64_t i = 0; i < n; ++i)
+		c->slices[i] = slicehash_slice(c->hash, c->range_start + i * L3_CACHELINE);
+	sink = c->slices[n - 1];
+}
+
+static void bench_address_slice_range(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	slicehash_slice_range(c->hash, c->range_start, n * L3_CACHELINE, c->slices);
+	sink = c->slices[n - 1];
+}
+
+static void bench_measure(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	uint64_t acc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		acc += slice_session_measure(c->session, (i * PAGE_SIZE + (i % 64) * L3_CACHELINE) % c->len);
+	sink = acc;
+}
+
+static void bench_fill_seq_data(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	for (uint64_t i = 0; i < n; ++i)
+		fill_seq_data(c->seq_data, c->mem, c->slice_map, c->fill_seq_len);
+	sink = c->seq_data[NUM_SEQUENCES - 1].xor_op;
+}
+
+static void bench_find_xor_for_each_bit(void *arg, uint64_t n)
+{
+	bench_ctx_t *c = arg;
+	int xor_map[ADDR_BITS];
+	mute();
+	for (uint64_t i = 0; i < n; ++i)
+		find_xor_for_each_bit(c->adj, xor_map, c->seq_len);
+	unmute();
+	sink = xor_map[ADDR_BITS - 1];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
+//NUM_SEQUENCES sequences of fill_seq_len lines, each the first one XORed by a random ID, as fill_seq_data expects
+static void fill_seq_setup(bench_ctx_t *c, uint64_t seq_len, int num_cbos)
+{
+	c->fill_seq_len = seq_len;
+	free(c->slice_map);
+	c->slice_map = malloc(NUM_SEQUENCES * seq_len * sizeof(int16_t));
+	for (uint64_t a = 0; a < seq_len; ++a)
+		c->slice_map[a] = rand() % num_cbos;
+	for (int s = 1; s < NUM_SEQUENCES; ++s)
+	{
+		uint64_t id = rand() % seq_len;
+		for (uint64_t a = 0; a < seq_len; ++a)
+			c->slice_map[s * seq_len + a] = c->slice_map[a ^ id];
+	}
+}
+
+//Adjacent pairs whose sequence IDs differ by the model's xor_map entry for their bit
+static void find_xor_setup(bench_ctx_t *c)
+{
+	c->adj = adjacent_address_init();
+	for (int b = 0; b < ADDR_BITS; ++b)
+	{
+		for (int a = 0; a < NUM_ADJ_ADDR; ++a)
+		{
+			uint64_t id = rand() % c->seq_len;
+			c->adj->seq_a[b][a].xor_op = id;
+			c->adj->seq_b[b][a].xor_op = id ^ c->xor_map[b];
+		}
+	}
+}
+
+static int save_results(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if(f == NULL)
+	{
+		perror("bench_primitives");
+		return -1;
+	}
+	fprintf(f, "#name mean_ns stddev_ns min_ns reps\n");
+	for (int i = 0; i < n_results; ++i)
+		fprintf(f, "%s %.3f %.3f %.3f %d\n", results[i].name, results[i].mean, results[i].stddev, results[i].min, results[i].reps);
+	fclose(f);
+	return 0;
+}
+
+//A benchmark regressed when it is slower than the baseline by more than tolerance, and by more than three
+//times the larger of the two spreads, so a noisy build host does not fail on jitter alone
+static int compare_baseline(const char *path, double tolerance)
+{
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+	{
+		perror("bench_primitives");
+		return -1;
+	}
+	int regressions = 0;
+	char line[256];
+	printf("\nAgainst %s (tolerance %.0f%%):\n", path, tolerance * 100);
+	while(fgets(line, sizeof(line), f))
+	{
+		char name[48];
+		double mean, stddev;
+		if(line[0] == '#' || sscanf(line, "%47s %lf %lf", name, &mean, &stddev) != 3)
+			continue;
+		for (int i = 0; i < n_results; ++i)
+		{
+			if(strcmp(results[i].name, name) != 0)
+				continue;
+			double spread = results[i].stddev > stddev ? results[i].stddev : stddev;
+			int regressed = results[i].mean > mean * (1 + tolerance) && results[i].mean - mean > 3 * spread;
+			regressions += regressed;
+			printf("%-32s %12.1f -> %10.1f (%+6.1f%%)%s\n", name, mean, results[i].mean, (results[i].mean / mean - 1) * 100,
+				regressed ? " | REGRESSION" : "");
+		}
+	}
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char const *argv[])
+{
+	const char *save_path = NULL;
+	const char *baseline_path = NULL;
+	double tolerance = 0.10;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--reps") == 0)
+			reps = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--save") == 0)
+			save_path = argv[i + 1];
+		else if(strcmp(argv[i], "--baseline") == 0)
+			baseline_path = argv[i + 1];
+		else if(strcmp(argv[i], "--tolerance") == 0)
+			tolerance = atof(argv[i + 1]);
+		else
+		{
+			printf("Usage: %s [--reps n] [--save file] [--baseline file] [--tolerance fraction]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(reps < 2)
+		reps = 2;
+	srand(1);
+
+	bench_ctx_t c = {0};
+	c.len = (uint64_t)BENCH_PAGES * PAGE_SIZE;
+	c.mem = mmap(NULL, c.len, PROT_READ | PROT_WRITE, MMAP_FLAGS, -1, 0);
+	if(c.mem == MAP_FAILED)
+	{
+		perror("bench_primitives");
+		return 1;
+	}
+	memset(c.mem, 1, c.len);
+	c.vaddrs = malloc(BENCH_ADDRS * sizeof(uint64_t));
+	c.paddrs = malloc(BENCH_ADDRS * sizeof(uint64_t));
+	c.slices = malloc(BENCH_ADDRS * sizeof(int16_t));
+
+	//The simulated machine's hash, in the forms the tool and libslicehash use
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	const char *result_path = getenv("SLICE_SIM_RESULT") ? getenv("SLICE_SIM_RESULT") : "output/i7-9850H_1634726880.txt";
+	c.hash = slicehash_load(result_path);
+	c.seq_len = slicehash_seq_len(c.hash);
+	//xor_map as get_slice_mapping printed it. Lines in the first sequence have no XOR reduction, so their
+	//slices are the master sequence.
+	FILE *rf = fopen(result_path, "r");
+	char line[8192];
+	while(rf && fgets(line, sizeof(line), rf))
+	{
+		char *p = strchr(line, '{');
+		if(strncmp(line, "int xor_map[", 12) != 0 || p == NULL)
+			continue;
+		for (int b = 0; b < ADDR_BITS && p; ++b)
+		{
+			c.xor_map[b] = strtol(p + 1, &p, 0);
+			p = strchr(p, ',');
+		}
+		break;
+	}
+	if(rf)
+		fclose(rf);
+	c.master_sequence = calloc(c.seq_len, sizeof(int16_t));
+	for (uint64_t v = 0; v < c.seq_len; ++v)
+		c.master_sequence[v] = slicehash_slice(c.hash, v * L3_CACHELINE);
+	int max_reduction = 0;
+	for (int b = 0; b < ADDR_BITS; ++b)
+		max_reduction |= c.xor_map[b];
+	c.mask_bits = find_set_bit(max_reduction) + 1;
+	c.mask = calloc(c.mask_bits, sizeof(uint64_t));
+	for (int i = 0; i < c.mask_bits; ++i)
+	{
+		for (int b = 0; b < ADDR_BITS; ++b)
+		{
+			if(is_bit_k_set(c.xor_map[b], i))
+				c.mask[i] |= 1ULL << b;
+		}
+	}
+
+	printf("Simulated %s | %d slices | Sequence length %lu | %d repetitions\n", slicehash_model(c.hash), num_cbos, c.seq_len, reps);
+	//The first session runs the CBo event self-test, which reports its choice. Opened here so that report comes
+	//before the table rather than in the middle of it.
+	c.session = slice_session_init(c.mem, c.len);
+	printf("%-32s %12s %10s %12s\n", "Benchmark", "ns/op", "stddev", "min");
+
+	//Translation, one line per page so every lookup is a different pagemap entry
+	for (uint64_t i = 0; i < BENCH_PAGES; ++i)
+		c.vaddrs[i] = (uint64_t)&c.mem[i * PAGE_SIZE];
+	bench("vtop", bench_vtop, &c, BENCH_PAGES);
+	bench("vtop_batch", bench_vtop_batch, &c, BENCH_PAGES);
+
+	//Pure computation over random physical addresses
+	for (uint64_t i = 0; i < BENCH_ADDRS; ++i)
+		c.paddrs[i] = rand64() & ((1ULL << ADDR_BITS) - 1) & ~(uint64_t)(L3_CACHELINE - 1);
+	bench("find_set_bit", bench_find_set_bit, &c, BENCH_ADDRS);
+	bench("does_val_differ_by_one", bench_does_val_differ_by_one, &c, BENCH_ADDRS);
+	bench("calculate_xor_reduction", bench_xor_reduction, &c, BENCH_ADDRS);
+	bench("xor_reduction_masks", bench_xor_reduction_masks, &c, BENCH_ADDRS);
+	bench("calculate_address_slice", bench_address_slice, &c, BENCH_ADDRS);
+	bench("address_slice_masks", bench_address_slice_masks, &c, BENCH_ADDRS);
+	bench("address_slice_batch", bench_address_slice_batch, &c, BENCH_ADDRS);
+
+	//The same over a run of consecutive lines, per line and updated line to line
+	c.range_start = (rand64() & ((1ULL << ADDR_BITS) - 1) & ~(uint64_t)(L3_CACHELINE - 1)) % ((1ULL << ADDR_BITS) - BENCH_ADDRS * L3_CACHELINE);
+	int16_t *expected = malloc(BENCH_ADDRS * sizeof(int16_t));
+	bench_address_slice_lines(&c, BENCH_ADDRS);
+	memcpy(expected, c.slices, BENCH_ADDRS * sizeof(int16_t));
+	bench_address_slice_range(&c, BENCH_ADDRS);
+	if(memcmp(expected, c.slices, BENCH_ADDRS * sizeof(int16_t)) != 0)
+	{
+		printf("slicehash_slice_range() disagrees with slicehash_slice() from 0x%lx\n", c.range_start);
+		return 1;
+	}
+	free(expected);
+	bench("address_slice_lines", bench_address_slice_lines, &c, BENCH_ADDRS);
+	bench("address_slice_range", bench_address_slice_range, &c, BENCH_ADDRS);
+
+	//Measurement through the simulated CBo counters, retries and z-scores included
+	bench("slice_session_measure", bench_measure, &c, BENCH_MEASURE_LINES);
+	slice_session_destroy(c.session);
+
+	//Sequence matching, which grows with the sequence length
+	c.seq_data = calloc(NUM_SEQUENCES, sizeof(sequence_data_t));
+	uint64_t fill_lens[] = {64, 256, 1024};
+	for (int i = 0; i < sizeof(fill_lens) / sizeof(fill_lens[0]); ++i)
+	{
+		char name[48];
+		if(NUM_SEQUENCES * fill_lens[i] * L3_CACHELINE > c.len)
+			continue;
+		fill_seq_setup(&c, fill_lens[i], num_cbos);
+		snprintf(name, sizeof(name), "fill_seq_data_%lu", fill_lens[i]);
+		bench(name, bench_fill_seq_data, &c, 4);
+	}
+
+	find_xor_setup(&c);
+	bench("find_xor_for_each_bit", bench_find_xor_for_each_bit, &c, 16);
+
+	int ret = 0;
+	if(save_path && save_results(save_path) < 0)
+		ret = 1;
+	if(baseline_path)
+	{
+		int regressions = compare_baseline(baseline_path, tolerance);
+		if(regressions < 0)
+		{
+			printf("No baseline to compare against in %s, save one with make bench-baseline\n", baseline_path);
+			ret = 1;
+		}
+		else if(regressions > 0)
+		{
+			printf("%d regression(s)\n", regressions);
+			ret = 1;
+		}
+	}
+
+	adjacent_address_destroy(c.adj);
+	free(c.seq_data);
+	free(c.slice_map);
+	free(c.mask);
+	free(c.master_sequence);
+	free(c.vaddrs);
+	free(c.paddrs);
+	free(c.slices);
+	slicehash_destroy(c.hash);
+	munmap(c.mem, c.len);
+	return ret;
+}
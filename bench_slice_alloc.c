@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Latency from a pinned core to buffers allocated in each LLC slice by the slice pool.
+// The buffer is larger than L2 and is walked in a random order, so after the warm up passes
+// every timed access is served by the LLC slice the buffer lives in.
+// sudo ./bench_slice_alloc output/<result>.txt [cpu] [buffer KB] [pool MB]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include "slice_alloc.h"
+#include "topology.h"
+
+#define WARMUP_PASSES 4
+#define TIMED_PASSES 16
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+//Median access time over the timed passes
+static uint32_t measure_buffer(slice_buf_t *b, uint32_t *times)
+{
+	uint64_t n = 0;
+	for (int pass = 0; pass < WARMUP_PASSES; ++pass)
+		for (uint64_t i = 0; i < b->n_lines; ++i)
+			memaccess(b->lines[i]);
+	for (int pass = 0; pass < TIMED_PASSES; ++pass)
+		for (uint64_t i = 0; i < b->n_lines; ++i)
+			times[n++] = memaccesstime(b->lines[i]);
+	qsort(times, n, sizeof(uint32_t), compare_u32);
+	return times[n / 2];
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <result file> [cpu] [buffer KB] [pool MB] [hugetlbfs pool file]\n", argv[0]);
+		return 1;
+	}
+	slicehash_t *hash = slicehash_load(argv[1]);
+	if(hash == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	int cpu = argc > 2 ? atoi(argv[2]) : 0;
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	uint64_t size = argc > 3 ? strtoull(argv[3], NULL, 0) << 10 : (uint64_t)(l2 > 0 ? l2 * 2 : 512 << 10);
+	uint64_t pool_len = (argc > 4 ? strtoull(argv[4], NULL, 0) : 256) << 20;
+
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+	{
+		perror("bench_slice_alloc()");
+		exit(1);
+	}
+	//Slice n sits next to physical core n
+	int local = topology_get()->cpu_core[cpu];
+
+	//A pool file on hugetlbfs is kept between runs, after the first its pages need no translating
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	slice_pool_t *pool = NULL;
+	if(argc > 5)
+	{
+		pool = slice_pool_init_file(hash, pool_len, argv[5], NULL);
+	}
+	else
+	{
+		pool = slice_pool_init(hash, pool_len);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(pool == NULL)
+	{
+		printf("Could not create the slice pool, check hugepages are reserved and this is run as root\n");
+		slicehash_destroy(hash);
+		return 1;
+	}
+
+	uint32_t *times = malloc((size / pool->cacheline) * TIMED_PASSES * sizeof(uint32_t));
+	double remote_sum = 0;
+	int remote_count = 0;
+	uint32_t local_time = 0;
+	printf("Pool of %lu MB set up in %.3f s%s\n", pool_len >> 20, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+		pool->frame_pool != NULL && pool->frame_pool->reused ? " (reused)" : "");
+	printf("CPU %d (core %d) | Buffer %lu KB\n", cpu, local, size >> 10);
+	printf("Slice | Median Access (cycles)\n");
+	for (int s = 0; s < pool->num_slices; ++s)
+	{
+		slice_buf_t *b = slice_alloc(pool, s, size);
+		if(b == NULL)
+		{
+			printf("%5d | not enough free lines\n", s);
+			continue;
+		}
+		shuffle(b->lines, b->n_lines, sizeof(uint8_t *));
+		uint32_t t = measure_buffer(b, times);
+		printf("%5d | %u%s\n", s, t, s == local ? " (local)" : "");
+		if(s == local)
+			local_time = t;
+		else
+		{
+			remote_sum += t;
+			remote_count++;
+		}
+		slice_free(pool, b);
+	}
+	if(remote_count > 0)
+		printf("\nLocal: %u | Remote mean: %.1f | Difference: %.1f cycles\n", local_time, remote_sum / remote_count, remote_sum / remote_count - local_time);
+
+	free(times);
+	slice_pool_destroy(pool);
+	slicehash_destroy(hash);
+	return 0;
+}
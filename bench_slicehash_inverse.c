@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Compares the solved inverse query (slicehash_iter_*) against hashing every line in a
+// physical range and keeping the matches. Checks both return the same lines, also over a
+// range whose ends are not line aligned.
+// ./bench_slicehash_inverse output/i7-9850H_1634726880.txt [range MB] [start MB]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#include "slicehash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <result file> [range MB] [start MB]\n", argv[0]);
+		return 1;
+	}
+	slicehash_t *h = slicehash_load(argv[1]);
+	if(h == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	uint64_t range = (argc > 2 ? strtoull(argv[2], NULL, 0) : 256) << 20;
+	uint64_t start = (argc > 3 ? strtoull(argv[3], NULL, 0) : 4096) << 20;
+	uint64_t cacheline = (uint64_t)slicehash_cacheline(h);
+	uint64_t max_lines = range / cacheline;
+
+	uint64_t *scan = malloc(max_lines * sizeof(uint64_t));
+	uint64_t *solved = malloc(max_lines * sizeof(uint64_t));
+	int ret = 0;
+
+	printf("%s | %d slices | Range 0x%lx-0x%lx\n", slicehash_model(h), slicehash_num_slices(h), start, start + range);
+	printf("Slice | Lines | Scan (ms) | Solved (ms) | Speedup | Match\n");
+	for (int slice = 0; slice < slicehash_num_slices(h); ++slice)
+	{
+		//Scan and filter baseline
+		double t0 = now();
+		uint64_t n_scan = 0;
+		for (uint64_t pa = start; pa < start + range; pa += cacheline)
+		{
+			if(slicehash_slice(h, pa) == slice)
+				scan[n_scan++] = pa;
+		}
+		double t_scan = now() - t0;
+
+		t0 = now();
+		uint64_t n_solved = 0;
+		slicehash_iter_t *it = slicehash_iter_begin(h, start, start + range, slice);
+		while(n_solved < max_lines && slicehash_iter_next(it, &solved[n_solved]))
+			n_solved++;
+		slicehash_iter_end(it);
+		double t_solved = now() - t0;
+
+		qsort(solved, n_solved, sizeof(uint64_t), compare_u64);
+		int match = n_scan == n_solved && memcmp(scan, solved, n_scan * sizeof(uint64_t)) == 0;
+		if(!match)
+			ret = 1;
+		printf("%5d | %lu | %9.2f | %11.2f | %6.1fx | %s\n", slice, n_solved, t_scan * 1e3, t_solved * 1e3, t_scan / t_solved, match ? "yes" : "NO");
+	}
+
+	//A range whose ends are not line aligned holds every line starting in it, the last one included
+	uint64_t u_start = start + cacheline / 2 + 1, u_end = start + (max_lines < 1024 ? max_lines : 1024) * cacheline - cacheline / 2;
+	int u_match = 1;
+	for (int slice = 0; slice < slicehash_num_slices(h); ++slice)
+	{
+		uint64_t n_scan = 0;
+		for (uint64_t pa = (u_start + cacheline - 1) & ~(cacheline - 1); pa < u_end; pa += cacheline)
+		{
+			if(slicehash_slice(h, pa) == slice)
+				scan[n_scan++] = pa;
+		}
+		uint64_t n_solved = slicehash_find(h, u_start, u_end, slice, solved, max_lines);
+		qsort(solved, n_solved, sizeof(uint64_t), compare_u64);
+		u_match &= n_scan == n_solved && memcmp(scan, solved, n_scan * sizeof(uint64_t)) == 0;
+	}
+	if(!u_match)
+		ret = 1;
+	printf("\nUnaligned range 0x%lx-0x%lx | Match %s\n", u_start, u_end, u_match ? "yes" : "NO");
+
+	free(scan);
+	free(solved);
+	slicehash_destroy(h);
+	return ret;
+}
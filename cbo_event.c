@@ -0,0 +1,62 @@
+#include "cbo_event.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//UNC_CBO_CACHE_LOOKUP umask: bits 0-3 the line states counted (M, E, S, I), bits 4-7 the requests (read, write,
+//external snoop, any). A flushed line is always looked up in I.
+const cbo_event_t cbo_event_candidates[CBO_EVENT_CANDIDATES] =
+{
+	{0x34, 0x8F, 0, "UNC_CBO_CACHE_LOOKUP.ANY_MESI"},
+	{0x34, 0x88, 0, "UNC_CBO_CACHE_LOOKUP.ANY_I"},
+	{0x34, 0x1F, 0, "UNC_CBO_CACHE_LOOKUP.READ_MESI"},
+	{0x34, 0x18, 0, "UNC_CBO_CACHE_LOOKUP.READ_I"},
+	{0x34, 0x2F, 0, "UNC_CBO_CACHE_LOOKUP.WRITE_MESI"},
+};
+
+int cbo_event_parse(const char *arg, cbo_event_t *e)
+{
+	if(arg == NULL)
+		return -1;
+	for (int i = 0; i < CBO_EVENT_CANDIDATES; ++i)
+	{
+		const char *name = cbo_event_candidates[i].name;
+		const char *suffix = strrchr(name, '.') + 1;
+		if(strcmp(arg, name) == 0 || strcmp(arg, suffix) == 0)
+		{
+			*e = cbo_event_candidates[i];
+			return 0;
+		}
+	}
+	char *end;
+	uint32_t event = strtoul(arg, &end, 0);
+	if(end == arg || *end != ':')
+		return -1;
+	const char *umask_arg = end + 1;
+	uint32_t umask = strtoul(umask_arg, &end, 0);
+	if(end == umask_arg || (*end != ':' && *end != '\0'))
+		return -1;
+	uint32_t filter = 0;
+	if(*end == ':')
+	{
+		const char *filter_arg = end + 1;
+		filter = strtoul(filter_arg, &end, 0);
+		if(end == filter_arg || *end != '\0')
+			return -1;
+	}
+	e->event = event;
+	e->umask = umask;
+	e->filter = filter;
+	e->name = "UNC_CBO_RAW";
+	for (int i = 0; i < CBO_EVENT_CANDIDATES; ++i)
+	{
+		if(cbo_event_candidates[i].event == event && cbo_event_candidates[i].umask == umask)
+			e->name = cbo_event_candidates[i].name;
+	}
+	return 0;
+}
+
+void cbo_event_print(FILE *f, const cbo_event_t *e)
+{
+	fprintf(f, "%s (event 0x%02x umask 0x%02x filter 0x%x)", e->name, e->event, e->umask, e->filter);
+}
@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef CBO_EVENT_H
+#define CBO_EVENT_H
+
+//CBo event counted while a line is flushed. The slice owning the line sees one lookup per flush whatever the event,
+//everything else on the socket only adds to the events it matches. Narrower umasks, or a box filter on parts with
+//one (the CBo filter register of server uncores, 0 leaves it open), leave less background for the classifier.
+
+struct cbo_event
+{
+	uint32_t event;
+	uint32_t umask;
+	uint32_t filter;
+	const char *name;
+} typedef cbo_event_t;
+
+//Candidates for the self-test, the first is the tool's original event
+#define CBO_EVENT_CANDIDATES 5
+extern const cbo_event_t cbo_event_candidates[CBO_EVENT_CANDIDATES];
+
+//A candidate's name (with or without the UNC_CBO_CACHE_LOOKUP. prefix), or <event>:<umask>[:<filter>] in any base
+//strtoul takes. -1 if arg is neither.
+int cbo_event_parse(const char *arg, cbo_event_t *e);
+void cbo_event_print(FILE *f, const cbo_event_t *e);
+
+#endif //CBO_EVENT_H
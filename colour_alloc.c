@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include "colour_alloc.h"
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGETLB
+	#define MAP_HUGETLB 0x40000 /* arch specific */
+#endif
+
+#define COLOUR_PAGE_SIZE (1ULL << 21)
+
+int colour_sets_per_slice(const slicehash_t *hash)
+{
+	long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	long ways = slicehash_l3_associativity(hash);
+	if(ways <= 0)
+		ways = sysconf(_SC_LEVEL3_CACHE_ASSOC);
+	if(size <= 0 || ways <= 0)
+		return COLOUR_DEFAULT_SETS;
+	long sets = size / (ways * slicehash_cacheline(hash) * slicehash_num_slices(hash));
+	if(sets <= 0)
+		return COLOUR_DEFAULT_SETS;
+	int pow2 = 1;
+	while(pow2 * 2 <= sets)
+		pow2 *= 2;
+	return pow2;
+}
+
+//Adds lines of granule to colour, merged into the run on top when it is from the same granule
+static void colour_push(colour_pool_t *p, int colour, uint64_t granule, uint64_t lines)
+{
+	uint64_t n = p->n_free_runs[colour];
+	p->free_lines[colour] += __builtin_popcountll(lines);
+	if(n > 0 && p->free_runs[colour][n - 1].granule == granule)
+	{
+		p->free_runs[colour][n - 1].lines |= lines;
+		return;
+	}
+	//Stacks grow by doubling, they start empty
+	if((n & (n - 1)) == 0)
+		p->free_runs[colour] = realloc(p->free_runs[colour], (n ? n * 2 : 64) * sizeof(slice_run_t));
+	p->free_runs[colour][n].granule = granule;
+	p->free_runs[colour][n].lines = lines;
+	p->n_free_runs[colour]++;
+}
+
+static uint64_t colour_paddr(colour_pool_t *p, uint64_t offset)
+{
+	return pfn_index_vtop(p->pfn, offset);
+}
+
+static int colour_group(colour_pool_t *p, uint64_t paddr)
+{
+	return (paddr / COLOUR_GRANULE) & (p->set_groups - 1);
+}
+
+//Splits a granule of group by slice onto the colours of that group
+static void colour_split_granule(colour_pool_t *p, uint64_t granule, int group)
+{
+	int16_t slices[COLOUR_GRANULE / 64];
+	uint64_t lines[p->num_slices];
+	memset(lines, 0, sizeof(lines));
+	slicehash_slice_range(p->hash, colour_paddr(p, granule), COLOUR_GRANULE, slices);
+	for (int l = 0; l < COLOUR_GRANULE / p->cacheline; ++l)
+	{
+		if(slices[l] >= 0 && slices[l] < p->num_slices)
+			lines[slices[l]] |= 1ULL << l;
+	}
+	for (int s = 0; s < p->num_slices; ++s)
+	{
+		if(lines[s])
+			colour_push(p, colour_of(p, s, group), granule, lines[s]);
+	}
+}
+
+//One free line of colour, splitting whole granules of its group until there is one. NULL if the group is used up.
+static uint8_t *colour_take_line(colour_pool_t *p, int colour)
+{
+	int group = colour % p->set_groups;
+	while(p->n_free_runs[colour] == 0)
+	{
+		if(p->n_whole[group] == 0)
+			return NULL;
+		colour_split_granule(p, p->whole[group][--p->n_whole[group]], group);
+	}
+	slice_run_t *run = &p->free_runs[colour][p->n_free_runs[colour] - 1];
+	int l = __builtin_ctzll(run->lines);
+	run->lines &= run->lines - 1;
+	if(run->lines == 0)
+		p->n_free_runs[colour]--;
+	p->free_lines[colour]--;
+	return &p->mem[run->granule + l * p->cacheline];
+}
+
+static colour_pool_t *colour_pool_alloc(const slicehash_t *hash, uint64_t len, int sets_per_slice)
+{
+	if(COLOUR_GRANULE / slicehash_cacheline(hash) > 64)
+		return NULL;
+	if(sets_per_slice <= 0)
+		sets_per_slice = colour_sets_per_slice(hash);
+	int set_groups = (int)((uint64_t)sets_per_slice * slicehash_cacheline(hash) / COLOUR_GRANULE);
+	if(set_groups < 1)
+		set_groups = 1;
+	if(set_groups * slicehash_num_slices(hash) > COLOUR_MAX)
+		return NULL;
+
+	colour_pool_t *p = calloc(1, sizeof(colour_pool_t));
+	p->hash = hash;
+	p->page_size = COLOUR_PAGE_SIZE;
+	p->len = (len + p->page_size - 1) & ~(p->page_size - 1);
+	p->cacheline = slicehash_cacheline(hash);
+	p->num_slices = slicehash_num_slices(hash);
+	p->set_groups = set_groups;
+	p->num_colours = set_groups * p->num_slices;
+	return p;
+}
+
+//Sorts every translated granule of the pool into its set group
+static colour_pool_t *colour_pool_partition(colour_pool_t *p)
+{
+	p->whole = calloc(p->set_groups, sizeof(uint64_t *));
+	p->n_whole = calloc(p->set_groups, sizeof(uint64_t));
+	p->free_runs = calloc(p->num_colours, sizeof(slice_run_t *));
+	p->n_free_runs = calloc(p->num_colours, sizeof(uint64_t));
+	p->free_lines = calloc(p->num_colours, sizeof(uint64_t));
+	pthread_mutex_init(&p->lock, NULL);
+
+	uint64_t granules = p->len / COLOUR_GRANULE;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (uint64_t g = 0; g < granules; ++g)
+		{
+			uint64_t pa = colour_paddr(p, g * COLOUR_GRANULE);
+			if(pa == (uint64_t)-1)
+				continue;
+			int group = colour_group(p, pa);
+			if(pass == 1)
+				p->whole[group][p->n_whole[group]] = g * COLOUR_GRANULE;
+			p->n_whole[group]++;
+		}
+		//Counted on the first pass, filled on the second. Pages only ever return to the group they came from.
+		for (int group = 0; group < p->set_groups && pass == 0; ++group)
+		{
+			p->whole[group] = malloc((p->n_whole[group] ? p->n_whole[group] : 1) * sizeof(uint64_t));
+			p->n_whole[group] = 0;
+		}
+	}
+	return p;
+}
+
+colour_pool_t *colour_pool_init(const slicehash_t *hash, uint64_t len, int sets_per_slice)
+{
+	colour_pool_t *p = colour_pool_alloc(hash, len, sets_per_slice);
+	if(p == NULL)
+		return NULL;
+	p->mem = mmap(NULL, p->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p->mem == MAP_FAILED)
+	{
+		perror("colour_pool_init()");
+		free(p);
+		return NULL;
+	}
+	//Translate once. Every later lookup goes through the index.
+	p->pfn = pfn_index_init(p->mem, p->len, p->page_size);
+	if(p->pfn == NULL)
+	{
+		munmap(p->mem, p->len);
+		free(p);
+		return NULL;
+	}
+	//Partitioning by the slice of untranslated pages would put every line in one slice
+	if(pfn_index_untranslated(p->pfn) != 0)
+	{
+		fprintf(stderr, "colour_pool_init(): pagemap gives no physical addresses, run as root\n");
+		pfn_index_destroy(p->pfn);
+		munmap(p->mem, p->len);
+		free(p);
+		return NULL;
+	}
+	return colour_pool_partition(p);
+}
+
+colour_pool_t *colour_pool_init_file(const slicehash_t *hash, uint64_t len, int sets_per_slice, const char *path, const char *index_path)
+{
+	colour_pool_t *p = colour_pool_alloc(hash, len, sets_per_slice);
+	if(p == NULL)
+		return NULL;
+	p->frame_pool = frame_pool_open(path, index_path, p->len, p->page_size, 0);
+	if(p->frame_pool == NULL)
+	{
+		perror("colour_pool_init_file()");
+		free(p);
+		return NULL;
+	}
+	p->mem = p->frame_pool->mem;
+	p->pfn = p->frame_pool->pfn;
+	return colour_pool_partition(p);
+}
+
+void colour_pool_destroy(colour_pool_t *p)
+{
+	if(p == NULL)
+		return;
+	for (int g = 0; g < p->set_groups; ++g)
+		free(p->whole[g]);
+	for (int c = 0; c < p->num_colours; ++c)
+		free(p->free_runs[c]);
+	free(p->whole);
+	free(p->n_whole);
+	free(p->free_runs);
+	free(p->n_free_runs);
+	free(p->free_lines);
+	if(p->frame_pool != NULL)
+	{
+		frame_pool_close(p->frame_pool);
+	}
+	else
+	{
+		pfn_index_destroy(p->pfn);
+		munmap(p->mem, p->len);
+	}
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+void colour_set_clear(colour_set_t *set)
+{
+	memset(set, 0, sizeof(colour_set_t));
+}
+
+void colour_set_add(colour_set_t *set, int colour)
+{
+	if(colour >= 0 && colour < COLOUR_MAX)
+		set->bits[colour / 64] |= 1ULL << (colour % 64);
+}
+
+int colour_set_has(const colour_set_t *set, int colour)
+{
+	if(colour < 0 || colour >= COLOUR_MAX)
+		return 0;
+	return (set->bits[colour / 64] >> (colour % 64)) & 1;
+}
+
+void colour_set_split(const colour_pool_t *p, int policy, int t, int n, colour_set_t *set)
+{
+	colour_set_clear(set);
+	int parts = policy == COLOUR_SPLIT_SLICES ? p->num_slices : p->set_groups;
+	int first = parts * t / n, last = parts * (t + 1) / n;
+	for (int s = 0; s < p->num_slices; ++s)
+	{
+		for (int g = 0; g < p->set_groups; ++g)
+		{
+			int part = policy == COLOUR_SPLIT_SLICES ? s : g;
+			if(part >= first && part < last)
+				colour_set_add(set, colour_of(p, s, g));
+		}
+	}
+}
+
+//Lines go back to the colour they came from, pages to their set group
+static void colour_release(colour_pool_t *p, colour_buf_t *b)
+{
+	for (uint64_t i = 0; i < b->n_lines; ++i)
+	{
+		uint64_t offset = b->lines[i] - p->mem;
+		uint64_t granule = offset & ~((uint64_t)COLOUR_GRANULE - 1);
+		uint64_t pa = colour_paddr(p, offset);
+		int colour = colour_of(p, slicehash_slice(p->hash, pa), colour_group(p, pa));
+		colour_push(p, colour, granule, 1ULL << ((offset - granule) / p->cacheline));
+	}
+	for (uint64_t i = 0; i < b->n_pages; ++i)
+	{
+		uint64_t offset = b->pages[i] - p->mem;
+		int group = colour_group(p, colour_paddr(p, offset));
+		p->whole[group][p->n_whole[group]++] = offset;
+	}
+}
+
+colour_buf_t *colour_alloc(colour_pool_t *p, const colour_set_t *set, size_t size)
+{
+	uint64_t n = (size + p->cacheline - 1) / p->cacheline;
+	int colours[p->num_colours];
+	int n_colours = 0;
+	for (int c = 0; c < p->num_colours; ++c)
+	{
+		if(colour_set_has(set, c))
+			colours[n_colours++] = c;
+	}
+	if(n_colours == 0)
+		return NULL;
+
+	colour_buf_t *b = calloc(1, sizeof(colour_buf_t));
+	b->lines = malloc(n * sizeof(uint8_t *));
+	pthread_mutex_lock(&p->lock);
+	//One line from each colour in turn, a used up colour drops out
+	while(b->n_lines < n && n_colours > 0)
+	{
+		for (int i = 0; i < n_colours && b->n_lines < n; ++i)
+		{
+			uint8_t *line = colour_take_line(p, colours[i]);
+			if(line == NULL)
+			{
+				colours[i--] = colours[--n_colours];
+				continue;
+			}
+			b->lines[b->n_lines++] = line;
+		}
+	}
+	if(b->n_lines < n)
+	{
+		colour_release(p, b);
+		pthread_mutex_unlock(&p->lock);
+		free(b->lines);
+		free(b);
+		return NULL;
+	}
+	pthread_mutex_unlock(&p->lock);
+	return b;
+}
+
+colour_buf_t *colour_alloc_pages(colour_pool_t *p, const colour_set_t *set, uint64_t n)
+{
+	int groups[p->set_groups];
+	int n_groups = 0;
+	for (int g = 0; g < p->set_groups; ++g)
+	{
+		int owned = 1;
+		for (int s = 0; s < p->num_slices && owned; ++s)
+			owned = colour_set_has(set, colour_of(p, s, g));
+		if(owned)
+			groups[n_groups++] = g;
+	}
+
+	colour_buf_t *b = calloc(1, sizeof(colour_buf_t));
+	b->pages = malloc((n ? n : 1) * sizeof(uint8_t *));
+	pthread_mutex_lock(&p->lock);
+	while(b->n_pages < n && n_groups > 0)
+	{
+		for (int i = 0; i < n_groups && b->n_pages < n; ++i)
+		{
+			int g = groups[i];
+			if(p->n_whole[g] == 0)
+			{
+				groups[i--] = groups[--n_groups];
+				continue;
+			}
+			b->pages[b->n_pages++] = &p->mem[p->whole[g][--p->n_whole[g]]];
+		}
+	}
+	if(b->n_pages < n)
+	{
+		colour_release(p, b);
+		pthread_mutex_unlock(&p->lock);
+		free(b->pages);
+		free(b);
+		return NULL;
+	}
+	pthread_mutex_unlock(&p->lock);
+	return b;
+}
+
+void colour_free(colour_pool_t *p, colour_buf_t *b)
+{
+	if(b == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	colour_release(p, b);
+	pthread_mutex_unlock(&p->lock);
+	free(b->lines);
+	free(b->pages);
+	free(b);
+}
+
+uint64_t colour_free_lines(colour_pool_t *p, int colour)
+{
+	if(colour < 0 || colour >= p->num_colours)
+		return 0;
+	pthread_mutex_lock(&p->lock);
+	uint64_t lines = p->free_lines[colour] + p->n_whole[colour % p->set_groups] * (COLOUR_GRANULE / p->cacheline) / p->num_slices;
+	pthread_mutex_unlock(&p->lock);
+	return lines;
+}
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include "helpers.h"
+#include "pfn_index.h"
+#include "frame_pool.h"
+#include "slice_alloc.h"
+#include "slicehash.h"
+
+#ifndef COLOUR_ALLOC_H
+#define COLOUR_ALLOC_H
+
+//LLC colouring. A line's colour is its slice, from the recovered hash, and its set group: the bits of the L3 set
+//index above the 4KB page offset. Lines of different colours never share an LLC set, so tenants given disjoint
+//colours cannot evict each other's lines, which partitions the LLC in software on parts without usable CAT.
+//Every line of a 4KB page is in the same set group, so a tenant owning a set group in every slice can be given
+//whole pages. Owning only some slices of a group, it gets single lines.
+
+#define COLOUR_GRANULE 4096
+#define COLOUR_MAX 4096
+//Sets per slice when the L3 size is not known, as on every Intel client part so far
+#define COLOUR_DEFAULT_SETS 2048
+
+struct colour_set
+{
+	uint64_t bits[COLOUR_MAX / 64];
+} typedef colour_set_t;
+
+enum
+{
+	COLOUR_SPLIT_SETS,		//Every tenant gets a share of the set groups in every slice
+	COLOUR_SPLIT_SLICES		//Every tenant gets a share of the slices, with all of their set groups
+};
+
+struct colour_pool
+{
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t page_size;
+	int cacheline;
+	pfn_index_t *pfn;
+	//Set when the pages come from a frame pool, which keeps them for the next process
+	frame_pool_t *frame_pool;
+	const slicehash_t *hash;
+	int num_slices;
+	int set_groups;
+	int num_colours;
+	//Per set group stack of 4KB granules not yet split into lines
+	uint64_t **whole;
+	uint64_t *n_whole;
+	//Per colour (slice * set_groups + group) stack of free runs, lines of one granule
+	slice_run_t **free_runs;
+	uint64_t *n_free_runs;
+	uint64_t *free_lines;
+	pthread_mutex_t lock;
+} typedef colour_pool_t;
+
+//Whole 4KB pages from colour_alloc_pages(), or single lines from colour_alloc()
+struct colour_buf
+{
+	uint64_t n_pages;
+	uint8_t **pages;
+	uint64_t n_lines;
+	uint8_t **lines;
+} typedef colour_buf_t;
+
+//L3 sets per slice on this machine: the L3 size from sysconf over the result's associativity (or sysconf's), line
+//size and slices, rounded down to a power of two. COLOUR_DEFAULT_SETS if either is unknown.
+int colour_sets_per_slice(const slicehash_t *hash);
+
+//Reserves len bytes of hugepages and translates them once, as slice_pool_init() does. sets_per_slice 0 uses
+//colour_sets_per_slice().
+colour_pool_t *colour_pool_init(const slicehash_t *hash, uint64_t len, int sets_per_slice);
+//colour_pool_init() over a frame pool at path (see frame_pool.h)
+colour_pool_t *colour_pool_init_file(const slicehash_t *hash, uint64_t len, int sets_per_slice, const char *path, const char *index_path);
+void colour_pool_destroy(colour_pool_t *p);
+
+static inline int colour_of(const colour_pool_t *p, int slice, int group)
+{
+	return slice * p->set_groups + group;
+}
+
+void colour_set_clear(colour_set_t *set);
+void colour_set_add(colour_set_t *set, int colour);
+int colour_set_has(const colour_set_t *set, int colour);
+//Colours of tenant t of n tenants under policy (COLOUR_SPLIT_SETS or COLOUR_SPLIT_SLICES). Shares differ by at most
+//one set group or slice. Every colour when n is 1.
+void colour_set_split(const colour_pool_t *p, int policy, int t, int n, colour_set_t *set);
+
+//At least size bytes of lines in the colours of set, taken from each colour in turn so they spread over its sets.
+//NULL if the colours do not have enough free lines.
+colour_buf_t *colour_alloc(colour_pool_t *p, const colour_set_t *set, size_t size);
+//n whole 4KB pages from the set groups set owns in every slice. NULL if there are not enough.
+colour_buf_t *colour_alloc_pages(colour_pool_t *p, const colour_set_t *set, uint64_t n);
+void colour_free(colour_pool_t *p, colour_buf_t *b);
+//Free lines of colour, counting granules not yet split as their share of each slice
+uint64_t colour_free_lines(colour_pool_t *p, int colour);
+
+#endif //COLOUR_ALLOC_H
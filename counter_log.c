@@ -0,0 +1,163 @@
+#include "counter_log.h"
+#include "helpers.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Records are buffered, a recording run is dominated by the measurements rather than its writes
+#define COUNTER_LOG_BUFFER (1 << 20)
+
+counter_log_t *counter_log_create(const char *path, int num_cbos)
+{
+	FILE *f = fopen(path, "a+b");
+	if(f == NULL)
+		return NULL;
+	counter_log_header_t header = {0};
+	fseek(f, 0, SEEK_END);
+	if(ftell(f) == 0)
+	{
+		header.magic = COUNTER_LOG_MAGIC;
+		header.num_cbos = num_cbos;
+		fwrite(&header, sizeof(header), 1, f);
+	}
+	else
+	{
+		rewind(f);
+		if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != COUNTER_LOG_MAGIC || header.num_cbos != (uint32_t)num_cbos)
+		{
+			fclose(f);
+			errno = EINVAL;
+			return NULL;
+		}
+		fseek(f, 0, SEEK_END);
+	}
+	counter_log_t *l = calloc(1, sizeof(counter_log_t));
+	l->f = f;
+	l->num_cbos = num_cbos;
+	setvbuf(f, NULL, _IOFBF, COUNTER_LOG_BUFFER);
+	return l;
+}
+
+void counter_log_append(counter_log_t *l, uint64_t paddr, int kind, uint32_t samples, const uint64_t *totals)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	counter_log_record_t rec = {paddr, (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec, samples, (uint16_t)kind, (uint16_t)l->num_cbos};
+	uint32_t packed[l->num_cbos];
+	for (int s = 0; s < l->num_cbos; ++s)
+		packed[s] = totals[s] > UINT32_MAX ? UINT32_MAX : (uint32_t)totals[s];
+	fwrite(&rec, sizeof(rec), 1, l->f);
+	fwrite(packed, sizeof(uint32_t), l->num_cbos, l->f);
+	l->records++;
+}
+
+void counter_log_close(counter_log_t *l)
+{
+	if(l == NULL)
+		return;
+	fclose(l->f);
+	free(l);
+}
+
+counter_log_reader_t *counter_log_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(counter_log_header_t))
+	{
+		close(fd);
+		return NULL;
+	}
+	uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+	counter_log_header_t *header = (counter_log_header_t *)map;
+	if(header->magic != COUNTER_LOG_MAGIC || header->num_cbos == 0)
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	counter_log_reader_t *r = calloc(1, sizeof(counter_log_reader_t));
+	r->map = map;
+	r->len = st.st_size;
+	r->num_cbos = header->num_cbos;
+	r->pos = sizeof(counter_log_header_t);
+	return r;
+}
+
+int counter_log_next(counter_log_reader_t *r, counter_log_record_t *rec, uint32_t *totals)
+{
+	uint64_t size = sizeof(counter_log_record_t) + r->num_cbos * sizeof(uint32_t);
+	if(r->pos + size > r->len)
+		return 0;
+	memcpy(rec, r->map + r->pos, sizeof(counter_log_record_t));
+	memcpy(totals, r->map + r->pos + sizeof(counter_log_record_t), r->num_cbos * sizeof(uint32_t));
+	r->pos += size;
+	return 1;
+}
+
+void counter_log_rewind(counter_log_reader_t *r)
+{
+	r->pos = sizeof(counter_log_header_t);
+}
+
+void counter_log_reader_close(counter_log_reader_t *r)
+{
+	if(r == NULL)
+		return;
+	munmap(r->map, r->len);
+	free(r);
+}
+
+int counter_classify(double *data, int num_cbos, int16_t *slice)
+{
+	int index_slice = -1, index_zscore = -1;
+	int found_slice_count = 0, all_zeroes = 0;
+	for (int s = 0; s < num_cbos; ++s)
+	{
+		//None of these values help us
+		if(data[s] >= 2.0 || data[s] <= 0.0)
+			continue;
+		//These are the values we want.
+		if(data[s] >= 1.0)
+		{
+			index_slice = s;
+			found_slice_count++;
+		}
+		else
+		{
+			all_zeroes++;
+		}
+	}
+	//No CBos experienced the CLFLUSHes
+	if(all_zeroes == num_cbos)
+		return COUNTER_ALL_ZERO;
+	if(found_slice_count != 1)
+		return COUNTER_NOISY;
+
+	// use z-scores on from the sample to check the values again. If there are more than one Z score either greater than 0 or less than -1,
+	// then the range of values found is too large, and should be remeasured to get a more accurate result.
+	// Expected is only 1 value is positively greater than 1 stddev away from the mean, and the rest should be within -1 stddevs away from the mean.
+	double mean = calculate_mean(data, num_cbos);
+	double stddev = calculate_stddev(data, num_cbos, mean);
+	int valid_zscore = 0;
+	for (int s = 0; s < num_cbos; ++s)
+	{
+		double zscore = calculate_zscore(data[s], mean, stddev);
+		if(zscore > 0.0 || zscore < -1.0)
+		{
+			index_zscore = s;
+			valid_zscore++;
+		}
+	}
+	if(valid_zscore == 1 && index_zscore == index_slice)
+	{
+		*slice = index_slice;
+		return COUNTER_SLICE;
+	}
+	return COUNTER_ZSCORE;
+}
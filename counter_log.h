@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef COUNTER_LOG_H
+#define COUNTER_LOG_H
+
+//Raw per-CBo counter vectors as measure_slice_accesses() reads them, appended to a binary log so the classification
+//and everything after it can be replayed offline (replay_counters, get_slice_mapping_replay) on real noise.
+//The file is a header followed by records, each a fixed part and num_cbos 32-bit totals. A record cut short by a
+//crash is ignored on reading.
+
+#define COUNTER_LOG_MAGIC 0x31474f4c4f424355ULL //"UCBOLOG1"
+
+enum
+{
+	COUNTER_LOG_PROBE,		//A line flushed UNCORE_PERFMON_SAMPLES times
+	COUNTER_LOG_BASELINE	//Nothing flushed, the noise monitor's baseline (paddr is -1)
+};
+
+struct counter_log_header
+{
+	uint64_t magic;
+	uint32_t num_cbos;
+	uint32_t reserved;
+} typedef counter_log_header_t;
+
+struct counter_log_record
+{
+	uint64_t paddr;
+	//CLOCK_MONOTONIC
+	uint64_t time_ns;
+	uint32_t samples;
+	uint16_t kind;
+	uint16_t num_cbos;
+} typedef counter_log_record_t;
+
+struct counter_log
+{
+	FILE *f;
+	int num_cbos;
+	uint64_t records;
+} typedef counter_log_t;
+
+struct counter_log_reader
+{
+	uint8_t *map;
+	uint64_t len;
+	uint64_t pos;
+	int num_cbos;
+} typedef counter_log_reader_t;
+
+//Appends to path, which is created if needed. NULL if it cannot be opened or was recorded with another CBo count.
+counter_log_t *counter_log_create(const char *path, int num_cbos);
+void counter_log_append(counter_log_t *l, uint64_t paddr, int kind, uint32_t samples, const uint64_t *totals);
+void counter_log_close(counter_log_t *l);
+
+counter_log_reader_t *counter_log_open(const char *path);
+//Next record and its totals (num_cbos of them), 0 at the end of the log
+int counter_log_next(counter_log_reader_t *r, counter_log_record_t *rec, uint32_t *totals);
+void counter_log_rewind(counter_log_reader_t *r);
+void counter_log_reader_close(counter_log_reader_t *r);
+
+//Classification of one vector of lookups per flush, as measure_slice_accesses() makes it
+enum
+{
+	COUNTER_SLICE,		//One CBo stands out, *slice is set
+	COUNTER_NOISY,		//No CBo, or more than one, saw each flush
+	COUNTER_ZSCORE,		//One CBo saw each flush but did not stand out from the others
+	COUNTER_ALL_ZERO	//No CBo saw the flushes, the timing fallback is needed
+};
+int counter_classify(double *data, int num_cbos, int16_t *slice);
+
+#endif //COUNTER_LOG_H
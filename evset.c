@@ -0,0 +1,78 @@
+#include "evset.h"
+
+int evset_default_set_bits(const slicehash_t *hash)
+{
+	long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	long assoc = sysconf(_SC_LEVEL3_CACHE_ASSOC);
+	if(assoc <= 0)
+		assoc = slicehash_l3_associativity(hash);
+	if(l3 <= 0 || assoc <= 0)
+		return 11; //2048 sets per slice, true of most client parts
+	return find_set_bit((uint64_t)l3 / slicehash_num_slices(hash) / assoc / slicehash_cacheline(hash));
+}
+
+evset_builder_t *evset_builder_init(uint8_t *mem, uint64_t len, pfn_index_t *pfn, const slicehash_t *hash, int set_bits)
+{
+	evset_builder_t *b = calloc(1, sizeof(evset_builder_t));
+	b->mem = mem;
+	b->len = len;
+	b->pfn = pfn;
+	b->hash = hash;
+	b->set_bits = set_bits > 0 ? set_bits : evset_default_set_bits(hash);
+	b->cacheline_bits = find_set_bit(slicehash_cacheline(hash));
+	b->set_mask = ((1ULL << b->set_bits) - 1) << b->cacheline_bits;
+	return b;
+}
+
+void evset_builder_destroy(evset_builder_t *b)
+{
+	free(b);
+}
+
+//Walks pages from the one after skip_page, and within each page only visits lines whose in-page bits already
+//match the set index. Pages whose physical base does not match the set bits above the page are skipped whole.
+static int evset_collect(evset_builder_t *b, uint64_t set_pa, int slice, uint64_t skip_page, uint8_t **out, int n)
+{
+	pfn_index_t *pfn = b->pfn;
+	int low_bits = b->cacheline_bits + b->set_bits;
+	if(low_bits > pfn->page_bits)
+		low_bits = pfn->page_bits;
+	uint64_t stride = 1ULL << low_bits;
+	uint64_t in_page = set_pa & b->set_mask & (stride - 1);
+	uint64_t high_set_mask = b->set_mask & ~(pfn->page_size - 1);
+	int found = 0;
+
+	for (uint64_t i = 1; i <= pfn->n_pages && found < n; ++i)
+	{
+		uint64_t page = (skip_page + i) % pfn->n_pages;
+		uint64_t base = pfn->paddr[page];
+		if(base == (uint64_t)-1 || ((base ^ set_pa) & high_set_mask) != 0)
+			continue;
+		for (uint64_t off = in_page; off < pfn->page_size && found < n; off += stride)
+		{
+			if(page == skip_page && (base | off) == (set_pa & ~(uint64_t)(slicehash_cacheline(b->hash) - 1)))
+				continue;
+			if(slicehash_slice(b->hash, base | off) == slice)
+				out[found++] = &b->mem[(page << pfn->page_bits) + off];
+		}
+	}
+	return found;
+}
+
+int evset_build(evset_builder_t *b, uint64_t target_offset, uint8_t **out, int n)
+{
+	uint64_t pa = pfn_index_vtop(b->pfn, target_offset);
+	if(pa == (uint64_t)-1)
+		return 0;
+	int slice = slicehash_slice(b->hash, pa);
+	if(slice < 0)
+		return 0;
+	//Starting at the target's own page means it is visited last, after every other page
+	return evset_collect(b, pa, slice, target_offset >> b->pfn->page_bits, out, n);
+}
+
+int evset_build_for(evset_builder_t *b, uint64_t set, int slice, uint8_t **out, int n)
+{
+	uint64_t set_pa = (set << b->cacheline_bits) & b->set_mask;
+	return evset_collect(b, set_pa, slice, (uint64_t)-1, out, n);
+}
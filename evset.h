@@ -0,0 +1,35 @@
+#include <stdint.h>
+
+#include "helpers.h"
+#include "pfn_index.h"
+#include "slicehash.h"
+
+#ifndef EVSET_H
+#define EVSET_H
+
+//Builds LLC eviction sets straight from the recovered hash. Lines are congruent with a target when they share
+//its L3 set index bits and calculate to the same slice, so no timing based search is needed.
+struct evset_builder
+{
+	uint8_t *mem;
+	uint64_t len;
+	pfn_index_t *pfn;
+	const slicehash_t *hash;
+	//L3 set index bits within a slice, starting at the cacheline bits
+	int set_bits;
+	int cacheline_bits;
+	uint64_t set_mask;
+} typedef evset_builder_t;
+
+//set_bits of 0 uses evset_default_set_bits()
+evset_builder_t *evset_builder_init(uint8_t *mem, uint64_t len, pfn_index_t *pfn, const slicehash_t *hash, int set_bits);
+void evset_builder_destroy(evset_builder_t *b);
+//Set index bits per slice from the L3 size, associativity and slice count of this machine
+int evset_default_set_bits(const slicehash_t *hash);
+
+//Fills out with up to n lines of the buffer congruent with mem[target_offset], not including the target. Returns the count found.
+int evset_build(evset_builder_t *b, uint64_t target_offset, uint8_t **out, int n);
+//As above, for an L3 set and slice rather than a target line
+int evset_build_for(evset_builder_t *b, uint64_t set, int slice, uint8_t **out, int n);
+
+#endif //EVSET_H
@@ -0,0 +1,219 @@
+#include "frame_pool.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#ifndef HUGETLBFS_MAGIC
+	#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+#ifndef MAP_POPULATE
+	#define MAP_POPULATE 0x08000
+#endif
+
+struct frame_pool_index_header
+{
+	uint64_t magic;
+	char boot_id[40];
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t len;
+	uint64_t page_size;
+	uint64_t n_pages;
+};
+
+//Pages of a hugetlbfs file only keep their physical addresses until a reboot
+static void frame_pool_boot_id(char boot_id[40])
+{
+	memset(boot_id, 0, 40);
+	FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if(f == NULL)
+		return;
+	if(fgets(boot_id, 40, f) == NULL)
+		boot_id[0] = '\0';
+	fclose(f);
+}
+
+static void frame_pool_index_header(frame_pool_t *p, struct stat *st, struct frame_pool_index_header *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->magic = FRAME_POOL_MAGIC;
+	frame_pool_boot_id(h->boot_id);
+	h->dev = st->st_dev;
+	h->ino = st->st_ino;
+	h->len = p->len;
+	h->page_size = p->page_size;
+	h->n_pages = p->len / p->page_size;
+}
+
+//FRAME_POOL_INDEX_DIR/<name of path>.pfn, making the directory if needed. -1 if it is not a directory only this user
+//can write to.
+static int frame_pool_default_index(const char *path, char *index_path, size_t size)
+{
+	struct stat st;
+	if(mkdir(FRAME_POOL_INDEX_DIR, 0700) != 0 && errno != EEXIST)
+		return -1;
+	if(lstat(FRAME_POOL_INDEX_DIR, &st) != 0)
+		return -1;
+	if(!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+	{
+		errno = EPERM;
+		return -1;
+	}
+	const char *name = strrchr(path, '/');
+	snprintf(index_path, size, "%s/%s.pfn", FRAME_POOL_INDEX_DIR, name ? name + 1 : path);
+	return 0;
+}
+
+//Saved index of the pool if it was written for this file, size and boot, NULL otherwise. A symlink, or a file another
+//user owns or can write to, is ignored as it could have been planted.
+static pfn_index_t *frame_pool_load_index(frame_pool_t *p, struct stat *st, const char *index_path)
+{
+	int fd = open(index_path, O_RDONLY | O_NOFOLLOW);
+	if(fd < 0)
+		return NULL;
+	struct stat index_st;
+	if(fstat(fd, &index_st) != 0 || !S_ISREG(index_st.st_mode) || index_st.st_uid != geteuid() ||
+		(index_st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+	{
+		fprintf(stderr, "frame_pool_load_index(): ignoring %s, it is not a regular file only this user can write\n", index_path);
+		close(fd);
+		return NULL;
+	}
+	FILE *f = fdopen(fd, "rb");
+	if(f == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	struct frame_pool_index_header expect, h;
+	frame_pool_index_header(p, st, &expect);
+	pfn_index_t *idx = NULL;
+	if(fread(&h, sizeof(h), 1, f) == 1 && memcmp(&h, &expect, sizeof(h)) == 0)
+	{
+		uint64_t *paddr = malloc(h.n_pages * sizeof(uint64_t));
+		if(fread(paddr, sizeof(uint64_t), h.n_pages, f) == h.n_pages)
+			idx = pfn_index_from(p->mem, p->len, p->page_size, paddr);
+		free(paddr);
+	}
+	fclose(f);
+	return idx;
+}
+
+static void frame_pool_save_index(frame_pool_t *p, struct stat *st, const char *index_path)
+{
+	struct frame_pool_index_header h;
+	frame_pool_index_header(p, st, &h);
+	//A new file every time, so a symlink or a file put in its place is never written through
+	if(unlink(index_path) != 0 && errno != ENOENT)
+	{
+		perror("frame_pool_save_index()");
+		return;
+	}
+	int fd = open(index_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+	if(f == NULL)
+	{
+		perror("frame_pool_save_index()");
+		if(fd >= 0)
+			close(fd);
+		return;
+	}
+	if(fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(p->pfn->paddr, sizeof(uint64_t), h.n_pages, f) != h.n_pages)
+		perror("frame_pool_save_index()");
+	fclose(f);
+}
+
+frame_pool_t *frame_pool_open(const char *path, const char *index_path, uint64_t len, uint64_t page_size, int threads)
+{
+	char default_index[4096];
+	if(index_path == NULL)
+	{
+		if(frame_pool_default_index(path, default_index, sizeof(default_index)) != 0)
+			return NULL;
+		index_path = default_index;
+	}
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	if(fd < 0)
+		return NULL;
+	struct statfs fs;
+	struct stat st;
+	if(fstatfs(fd, &fs) != 0 || (uint64_t)fs.f_type != HUGETLBFS_MAGIC || (uint64_t)fs.f_bsize != page_size)
+	{
+		//Not left behind when it was only created by the attempt
+		if(fstat(fd, &st) == 0 && st.st_size == 0)
+			unlink(path);
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	fstat(fd, &st);
+	//A pool of another size is released rather than reused, its saved index no longer matches anyway
+	if((uint64_t)st.st_size != len && (ftruncate(fd, 0) != 0 || ftruncate(fd, len) != 0))
+	{
+		close(fd);
+		return NULL;
+	}
+	int existing = (uint64_t)st.st_size == len;
+
+	frame_pool_t *p = calloc(1, sizeof(frame_pool_t));
+	p->fd = fd;
+	p->len = len;
+	p->page_size = page_size;
+	//The pages of an existing pool are only mapped, which MAP_POPULATE does in one go. A fresh pool is left to
+	//pfn_index_prefault() so the kernel zeroes its pages on every core.
+	p->mem = mmap(NULL, len, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_SHARED | (existing ? MAP_POPULATE : 0), fd, 0);
+	if(p->mem == MAP_FAILED)
+	{
+		close(fd);
+		free(p);
+		return NULL;
+	}
+
+	if(existing)
+	{
+		p->pfn = frame_pool_load_index(p, &st, index_path);
+		if(p->pfn != NULL)
+		{
+			p->checked = FRAME_POOL_CHECK_PAGES;
+			int64_t stale = pfn_index_check(p->pfn, p->checked, (unsigned)getpid());
+			p->stale = stale < 0 ? p->checked : (uint64_t)stale;
+			if(p->stale == 0)
+			{
+				p->reused = 1;
+				return p;
+			}
+			pfn_index_destroy(p->pfn);
+			p->pfn = NULL;
+		}
+	}
+
+	p->pfn = pfn_index_prefault(p->mem, len, page_size, threads);
+	//An index of untranslated pages is not saved, nothing could use it
+	if(p->pfn == NULL || pfn_index_untranslated(p->pfn) != 0)
+	{
+		if(p->pfn != NULL)
+		{
+			pfn_index_destroy(p->pfn);
+			errno = EPERM;
+		}
+		munmap(p->mem, len);
+		close(fd);
+		free(p);
+		return NULL;
+	}
+	fstat(fd, &st);
+	frame_pool_save_index(p, &st, index_path);
+	return p;
+}
+
+void frame_pool_close(frame_pool_t *p)
+{
+	if(p == NULL)
+		return;
+	pfn_index_destroy(p->pfn);
+	munmap(p->mem, p->len);
+	close(p->fd);
+	free(p);
+}
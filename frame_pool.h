@@ -0,0 +1,45 @@
+#include <stdint.h>
+
+#include "pfn_index.h"
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+//A buffer backed by a file on hugetlbfs, so its huge pages stay reserved and at the same physical addresses between
+//runs. Its PFN index is saved in a sidecar file on a regular filesystem (hugetlbfs files can only be mapped), tagged
+//with the boot and the pool file's inode. A later run maps the file again and checks a sample of pages against the
+//saved index, instead of reserving, faulting in and translating the whole buffer. Deleting the pool file returns the
+//pages to the kernel.
+
+#define FRAME_POOL_MAGIC 0x31584449504e4650ULL //"PFNPIDX1"
+//Pages translated to revalidate a saved index
+#define FRAME_POOL_CHECK_PAGES 256
+//Default directory of the saved indexes. Only root can create files in /run, and it is emptied at boot, when the
+//indexes go stale anyway.
+#define FRAME_POOL_INDEX_DIR "/run/slice_mapping"
+
+struct frame_pool
+{
+	int fd;
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t page_size;
+	pfn_index_t *pfn;
+	//1 if the saved index still held and the buffer was not faulted in and translated again
+	int reused;
+	//Pages checked and how many differed from the saved index, 0 and 0 if there was none
+	uint64_t checked;
+	uint64_t stale;
+} typedef frame_pool_t;
+
+//Maps len bytes of path, which is created or resized as needed and must be on a hugetlbfs mount with page_size pages.
+//A fresh or stale buffer is faulted in and translated by threads (0 for one per online CPU) and its index saved to
+//index_path, or FRAME_POOL_INDEX_DIR/<name of path>.pfn if NULL. The index is written as a new 0600 file and only
+//loaded from a regular file owned by this user that others cannot write. NULL if the file cannot be opened, is not on
+//hugetlbfs, the default index directory cannot be made private, there are not enough huge pages, or pagemap gives no
+//physical addresses (not root).
+frame_pool_t *frame_pool_open(const char *path, const char *index_path, uint64_t len, uint64_t page_size, int threads);
+//Unmaps the buffer, the file and its pages are kept
+void frame_pool_close(frame_pool_t *p);
+
+#endif //FRAME_POOL_H
@@ -1,38 +1,282 @@
 #include "uncore_address_map.h"
+#include "prior_search.h"
+#include "master_anf.h"
+#include "shard.h"
+#include "frame_pool.h"
 #include <perf_counters.h>
 #include <string.h>
+#include <time.h>
+
+//Frees the search buffer, a frame pool keeps its pages for the next run
+static void release_buffer(frame_pool_t *pool, uint8_t *mem, size_t len, pfn_index_t *pfn)
+{
+	if(pool != NULL)
+	{
+		frame_pool_close(pool);
+		return;
+	}
+	pfn_index_destroy(pfn);
+	munmap(mem, len * sizeof(uint8_t));
+}
+
+//Writes this shard's pair IDs and the sequences behind them to path for merge_shards, replacing any earlier partial
+static void write_shard_partial(const char *path, shard_t *shard, const char *model, adj_addr_t *adj, pfn_index_t *pfn, int num_cbos, uint64_t seq_len)
+{
+	FILE *f = fopen(path, "w");
+	if(f == NULL)
+	{
+		perror("write_shard_partial()");
+		exit(1);
+	}
+	shard_write_header(f, shard, model, num_cbos, ADDR_BITS, seq_len, L3_CACHELINE);
+	uint64_t *paddrs = malloc(seq_len * sizeof(uint64_t));
+	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
+	{
+		for (int a = 0; a < adj->count[b] && adj->measure[b]; ++a)
+		{
+			shard_write_pair(f, b, a, shard_pair_encode(adj->seq_a[b][a].xor_op, adj->seq_b[b][a].xor_op,
+				adj->slice_map_a[b][a], adj->slice_map_b[b][a], seq_len, num_cbos));
+			for (uint64_t i = 0; i < seq_len; ++i)
+				paddrs[i] = pfn_index_vtop(pfn, adj->bit_n_a[b][a] + i * L3_CACHELINE);
+			shard_write_sequence(f, paddrs, adj->slice_map_a[b][a], seq_len, L3_CACHELINE);
+			for (uint64_t i = 0; i < seq_len; ++i)
+				paddrs[i] = pfn_index_vtop(pfn, adj->bit_n_b[b][a] + i * L3_CACHELINE);
+			shard_write_sequence(f, paddrs, adj->slice_map_b[b][a], seq_len, L3_CACHELINE);
+		}
+	}
+	free(paddrs);
+	fclose(f);
+}
 
 int main(int argc, char const *argv[])
 {
 	int ret = 0;
-	unsigned int pid = (unsigned int)getpid();
-	int num_cbos = uncore_get_num_cbo(AFFINITY);
-	size_t len = (size_t)RAM;
-	uint8_t *mem = mmap(NULL, sizeof(uint8_t) * len, PROT_READ | PROT_WRITE | PROT_EXEC, MMAP_FLAGS, -1, 0);
-	if((size_t)mem == -1)
+	//Verification options: --verify-samples <n> --verify-target <agreement> --json <file>
+	//Phase timings and counters: --metrics <file>
+	//Try the hashes of known machines before the full search: --prior <result directory>
+	//Measure one share of the address bits and write a partial result: --shard <i/n> --shard-out <file> [--shard-overlap <k>] [--model <name>]
+	//Append every raw perfmon read to a counter log for offline replay: --record <file>
+	//Keep the buffer in a hugetlbfs file between runs, its PFN index in a sidecar: --pool <file> [--pool-index <file>]
+	//Counted CBo event and flushes per read, self-tested unless given: --cbo-event <name | event:umask[:filter] | auto> --cbo-samples <n>
+	uint64_t verify_samples = VERIFY_SAMPLES;
+	double verify_target = VERIFY_TARGET;
+	const char *json_path = NULL;
+	const char *metrics_path = NULL;
+	const char *prior_dir = NULL;
+	shard_t shard = {0};
+	const char *shard_arg = NULL;
+	const char *shard_out = NULL;
+	const char *model = NULL;
+	const char *record_path = NULL;
+	const char *cbo_event_arg = NULL;
+	int cbo_samples = 0;
+	const char *pool_path = NULL;
+	const char *pool_index = NULL;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--verify-samples") == 0)
+			verify_samples = strtoull(argv[i + 1], NULL, 0);
+		else if(strcmp(argv[i], "--verify-target") == 0)
+			verify_target = atof(argv[i + 1]);
+		else if(strcmp(argv[i], "--json") == 0)
+			json_path = argv[i + 1];
+		else if(strcmp(argv[i], "--metrics") == 0)
+			metrics_path = argv[i + 1];
+		else if(strcmp(argv[i], "--prior") == 0)
+			prior_dir = argv[i + 1];
+		else if(strcmp(argv[i], "--shard") == 0)
+			shard_arg = argv[i + 1];
+		else if(strcmp(argv[i], "--shard-out") == 0)
+			shard_out = argv[i + 1];
+		else if(strcmp(argv[i], "--shard-overlap") == 0)
+			shard.overlap = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--model") == 0)
+			model = argv[i + 1];
+		else if(strcmp(argv[i], "--record") == 0)
+			record_path = argv[i + 1];
+		else if(strcmp(argv[i], "--cbo-event") == 0)
+			cbo_event_arg = argv[i + 1];
+		else if(strcmp(argv[i], "--cbo-samples") == 0)
+			cbo_samples = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--pool") == 0)
+			pool_path = argv[i + 1];
+		else if(strcmp(argv[i], "--pool-index") == 0)
+			pool_index = argv[i + 1];
+		else
+		{
+			printf("Usage: %s [--verify-samples <n>] [--verify-target <agreement>] [--json <file>] [--metrics <file>] [--prior <dir>] [--shard <i/n> --shard-out <file> [--shard-overlap <k>] [--model <name>]] [--record <file>] [--cbo-event <name | event:umask[:filter] | auto>] [--cbo-samples <n>] [--pool <file> [--pool-index <file>]]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(shard_arg != NULL && (shard_parse(shard_arg, &shard) != 0 || shard_out == NULL || prior_dir != NULL))
 	{
-		perror("get_slice_mapping()");
+		printf("--shard takes i/n with 0 <= i < n, needs --shard-out and cannot be combined with --prior\n");
 		exit(1);
 	}
+	cbo_event_t cbo_event;
+	if(cbo_event_arg != NULL && strcmp(cbo_event_arg, "auto") != 0)
+	{
+		if(cbo_event_parse(cbo_event_arg, &cbo_event) != 0)
+		{
+			printf("--cbo-event takes one of:");
+			for (int i = 0; i < CBO_EVENT_CANDIDATES; ++i)
+				printf(" %s", cbo_event_candidates[i].name);
+			printf(", <event>:<umask>[:<filter>] or auto\n");
+			exit(1);
+		}
+		measure_set_cbo_event(&cbo_event, cbo_samples);
+	}
+	else if(cbo_event_arg != NULL || cbo_samples > 0)
+	{
+		//auto, or only the samples given: the event stays as the build chose it
+		measure_set_cbo_event(cbo_event_arg != NULL || CBO_EVENT_AUTO ? NULL : measure_cbo_event(NULL), cbo_samples);
+	}
+	if(record_path != NULL && measure_record(record_path) != 0)
+	{
+		perror("get_slice_mapping(): --record");
+		exit(1);
+	}
+	metrics_init(metrics_path);
+	metrics_phase_begin(METRIC_PHASE_MAP);
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	topology_print(stdout);
+	size_t len = (size_t)RAM;
+	//Fault in and translate the whole buffer up front on every CPU, the searches after this only look up PFNs. A frame
+	//pool kept from an earlier run only has a sample of its saved index checked.
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	struct timespec setup_start, setup_end;
+	clock_gettime(CLOCK_MONOTONIC, &setup_start);
+	frame_pool_t *pool = NULL;
+	uint8_t *mem;
+	pfn_index_t *pfn;
+	if(pool_path != NULL)
+	{
+		pool = frame_pool_open(pool_path, pool_index, len, PAGE_SIZE, threads);
+		if(pool == NULL)
+		{
+			perror("get_slice_mapping(): --pool");
+			exit(1);
+		}
+		mem = pool->mem;
+		pfn = pool->pfn;
+	}
+	else
+	{
+		mem = mmap(NULL, sizeof(uint8_t) * len, PROT_READ | PROT_WRITE | PROT_EXEC, MMAP_FLAGS, -1, 0);
+		if((size_t)mem == -1)
+		{
+			perror("get_slice_mapping()");
+			exit(1);
+		}
+		pfn = pfn_index_prefault(mem, len, PAGE_SIZE, threads);
+		if(pfn == NULL)
+			exit(1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &setup_end);
+	double setup_time = (setup_end.tv_sec - setup_start.tv_sec) + (setup_end.tv_nsec - setup_start.tv_nsec) / 1e9;
+	if(pool != NULL && pool->reused)
+		printf("Reused frame pool %s: %.2f GB, %lu sampled pages unchanged, in %.2f s\n", pool_path, len / 1e9, pool->checked, setup_time);
+	else
+		printf("Prefaulted and translated %.2f GB on %d threads in %.2f s (%.2f GB/s)\n", len / 1e9, threads, setup_time, len / 1e9 / setup_time);
+	if(pool != NULL && pool->stale > 0)
+		printf("Frame pool %s had moved (%lu of %lu sampled pages), its index was rebuilt\n", pool_path, pool->stale, pool->checked);
 	adj_addr_t *adj = adjacent_address_init();
 	int xor_map[ADDR_BITS] = {0};
-	int16_t *master_sequence = calloc(SEQ_LEN, sizeof(int16_t));
+	metrics_phase_end();
 
-	printf("Sequence length is %d cache lines\n", SEQ_LEN);
+	//A known hash which predicts this machine replaces the whole search
+	prior_result_t prior = {0};
+	int prior_found = 0;
+	if(prior_dir != NULL)
+	{
+		metrics_phase_begin(METRIC_PHASE_PRIOR_SEARCH);
+		prior_found = prior_search(mem, len, pfn, prior_dir, &prior);
+		metrics_phase_end();
+		prior_result_print(stdout, &prior);
+		putchar('\n');
+	}
 
-	adjacent_address_search(adj, mem, len, SEQ_LEN);
-	putchar('\n');
+	uint64_t seq_len;
+	if(prior_found)
+	{
+		seq_len = prior.seq_len;
+	}
+	else
+	{
+	//SEQ_LEN can still be given at compile time, otherwise it is measured here
+#ifdef SEQ_LEN
+		seq_len = SEQ_LEN;
+#else
+		metrics_phase_begin(METRIC_PHASE_SEQUENCE_LENGTH);
+		period_result_t period;
+		seq_len = find_sequence_length(mem, len, &period);
+		period_result_print(stdout, &period);
+		if(seq_len == 0)
+		{
+			printf("No sequence length up to %d found\n", MAX_ID);
+			exit(1);
+		}
+#endif
+	}
+	int16_t *master_sequence = calloc(seq_len, sizeof(int16_t));
 
-	//Get slice values from the perf counter library
-	ret = get_slice_values_adj(adj, mem, len, SEQ_LEN);
+	printf("Sequence length is %lu cache lines\n", seq_len);
 
-	//Fill the sequence data with info from the slice mapping
-	fill_seq_data_adj(adj, mem, SEQ_LEN);
+	if(prior_found)
+	{
+		memcpy(xor_map, prior.xor_map, sizeof(xor_map));
+		if(prior.master_sequence != NULL)
+			memcpy(master_sequence, prior.master_sequence, seq_len * sizeof(int16_t));
+	}
+	else
+	{
+		//A shard measures its own bits, and always the first one, whose pair sequences are the reference the others
+		//are matched against
+		if(shard_arg != NULL)
+		{
+			printf("Shard %d/%d measures bits", shard.index, shard.count);
+			for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
+			{
+				adj->measure[b] = b == START_BIT(seq_len) || shard_has_bit(&shard, b, START_BIT(seq_len));
+				if(adj->measure[b])
+					printf(" %lu", b);
+			}
+			printf("\n\n");
+		}
+
+		metrics_phase_begin(METRIC_PHASE_ADJACENT_SEARCH);
+		adjacent_address_search(adj, mem, len, pfn, seq_len);
+		putchar('\n');
 
-	//Print each sequence
-	print_slice_values_adj(adj, mem, SEQ_LEN);
+		//Get slice values from the perf counter library
+		metrics_phase_begin(METRIC_PHASE_SLICE_VALUES);
+		ret = get_slice_values_adj(adj, mem, len, seq_len);
 
-	find_xor_for_each_bit(adj, xor_map, SEQ_LEN);
+		//Fill the sequence data with info from the slice mapping
+		metrics_phase_begin(METRIC_PHASE_FILL_SEQ_DATA);
+		fill_seq_data_adj(adj, mem, seq_len);
+		metrics_phase_end();
+
+		//Print each sequence
+		print_slice_values_adj(adj, mem, seq_len);
+
+		metrics_phase_begin(METRIC_PHASE_XOR_MAP);
+		find_xor_for_each_bit(adj, xor_map, seq_len);
+		metrics_phase_end();
+
+		//The rest needs every bit, merge_shards puts the partials together
+		if(shard_arg != NULL)
+		{
+			write_shard_partial(shard_out, &shard, model, adj, pfn, num_cbos, seq_len);
+			printf("Wrote the partial result of shard %d/%d to %s\n\n", shard.index, shard.count, shard_out);
+			printf("Run time by phase:\n");
+			metrics_print(stdout);
+			release_buffer(pool, mem, len, pfn);
+			adjacent_address_destroy(adj);
+			free(master_sequence);
+			return ret;
+		}
+	}
 
 	//print out an integer map for XORing each bit
 	int max_reduction_bit = 0;
@@ -76,7 +320,7 @@ int main(int argc, char const *argv[])
 	{
 		int start = 1;
 		printf("ID%d = ", i);
-		for(uint64_t b = START_BIT(SEQ_LEN); b < ADDR_BITS; ++b)
+		for(uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 		{
 			if(xor_map[b] != -1)
 			{				
@@ -116,10 +360,15 @@ int main(int argc, char const *argv[])
 	//If power of two, then we don't need to find the master sequence, as the XOR reduction is the only step required to get the mapping correctly.
 	if(!is_power_of_two(num_cbos))
 	{
-		find_master_sequence(adj,mem, len, master_sequence, SEQ_LEN, xor_map);
+		if(!prior_found)
+		{
+			metrics_phase_begin(METRIC_PHASE_MASTER_SEQUENCE);
+			find_master_sequence(adj,mem, len, pfn, master_sequence, seq_len, xor_map);
+			metrics_phase_end();
+		}
 		//print the master sequence
 		printf("Master Sequence: \n");
-		for(int i = 0; i < SEQ_LEN; ++i)
+		for(uint64_t i = 0; i < seq_len; ++i)
 		{
 			printf("%d", master_sequence[i]);
 			if((i % 4) == 3)
@@ -130,7 +379,7 @@ int main(int argc, char const *argv[])
 
 		//print the master sequence
 		printf("Master Sequence: \n");
-		for(int i = 0; i < SEQ_LEN; ++i)
+		for(uint64_t i = 0; i < seq_len; ++i)
 		{
 			printf("%d", master_sequence[i]);
 			if((i % 4) == 3)
@@ -139,10 +388,10 @@ int main(int argc, char const *argv[])
 		putchar('\n');
 		putchar('\n');
 
-		printf("int master_sequence[%d] = {", SEQ_LEN);
-		for(int i = 0; i < SEQ_LEN; i++)
+		printf("int master_sequence[%lu] = {", seq_len);
+		for(uint64_t i = 0; i < seq_len; i++)
 		{
-			if(i < SEQ_LEN-1)
+			if(i < seq_len-1)
 				printf("%d, ", master_sequence[i]);
 			else
 				printf("%d};\n\n", master_sequence[i]);
@@ -152,7 +401,7 @@ int main(int argc, char const *argv[])
 		for (int i = 0; i <= find_set_bit(CORES-1); ++i)
 		{
 			printf("M%d = |", i);
-			for(int s = 0; s < SEQ_LEN; ++s)
+			for(uint64_t s = 0; s < seq_len; ++s)
 			{
 				if(is_bit_k_set(master_sequence[s], i))
 					printf("▄");
@@ -164,6 +413,22 @@ int main(int argc, char const *argv[])
 			else
 				printf("|\n\n");
 		}
+
+		//The same bits as Boolean functions of v (the index into the master sequence), checked against every entry
+		master_anf_t *anf = master_anf_create(master_sequence, seq_len);
+		if(anf != NULL)
+		{
+			uint64_t mismatches = master_anf_verify(anf, master_sequence, seq_len);
+			printf("Master sequence in algebraic normal form, v = sequence offset ^ XOR reduction\n");
+			master_anf_print(stdout, anf);
+			printf("Checked against all %lu entries: %lu mismatches\n\n", seq_len, mismatches);
+			if(mismatches == 0)
+			{
+				master_anf_print_c(stdout, anf, "master_sequence_anf");
+				putchar('\n');
+			}
+			master_anf_destroy(anf);
+		}
 	}
 	else
 	{		
@@ -177,11 +442,11 @@ int main(int argc, char const *argv[])
 		int calc_slice = -1;
 		if(is_power_of_two(num_cbos))
 		{
-			calc_slice = calculate_address_slice(0x0+(i*L3_CACHELINE), NULL, SEQ_LEN, xor_map);
+			calc_slice = calculate_address_slice(0x0+(i*L3_CACHELINE), NULL, seq_len, xor_map);
 		}
 		else
 		{
-			calc_slice = calculate_address_slice(0x0+(i*L3_CACHELINE), master_sequence, SEQ_LEN, xor_map);
+			calc_slice = calculate_address_slice(0x0+(i*L3_CACHELINE), master_sequence, seq_len, xor_map);
 		}
 		printf("%d", calc_slice);
 		if(i%4==3)
@@ -190,31 +455,42 @@ int main(int argc, char const *argv[])
 	putchar('\n');
 	putchar('\n');
 
-	//Now, get a random address (of any offset, bit 6 can be set etc.) and get its offset into the sequence of its corresponding ID. This is now its slice number.
-	printf("Testing found slice mapping function with some random values:\n");
-	for(int i = 0; i < 32; ++i)
-	{			
-		//Get random offset into mem
-		size_t rnd = (size_t) rand() % len;
-		int calc_slice = -1;
-		if(is_power_of_two(num_cbos))
+	//Check the function against measured slices of lines across every address bit and sequence ID
+	printf("Verifying found slice mapping function:\n");
+	verify_result_t verify;
+	metrics_phase_begin(METRIC_PHASE_VERIFY);
+	verify_mapping(mem, len, pfn, is_power_of_two(num_cbos) ? NULL : master_sequence, seq_len, xor_map, verify_samples, verify_target, &verify);
+	metrics_phase_end();
+	verify_result_print(stdout, &verify);
+	if(json_path != NULL)
+	{
+		FILE *json = fopen(json_path, "w");
+		if(json == NULL)
 		{
-			calc_slice = calculate_address_slice(vtop(pid, (uint64_t)&mem[rnd]), NULL, SEQ_LEN, xor_map);
+			perror("get_slice_mapping()");
 		}
 		else
 		{
-			calc_slice = calculate_address_slice(vtop(pid, (uint64_t)&mem[rnd]), master_sequence, SEQ_LEN, xor_map);
+			verify_result_json(json, &verify);
+			fclose(json);
 		}
-
-		printf("Phys Addr: 0x%09lx | Calc Slice: %d | Real Slice: %d\n", vtop(pid, (uint64_t)&mem[rnd]), calc_slice, get_slice_value(mem, len, rnd));
 	}
+	verify_result_destroy(&verify);
 	putchar('\n');
+
+	//Save the timing calibration with the results if the timing fallback was used
+	if(access_get_calibration() != NULL)
+		timing_calibration_print(stdout, access_get_calibration());
+
+	printf("Run time by phase:\n");
+	metrics_print(stdout);
 	putchar('\n');
 
 	//Release (the dragon)
-	munmap(mem, len * sizeof(uint8_t));
+	release_buffer(pool, mem, len, pfn);
 	adjacent_address_destroy(adj);
 	free(mask);
 	free(master_sequence);
+	prior_result_destroy(&prior);
 	return ret;
 }
@@ -63,6 +63,11 @@ void shuffle(void *array, size_t n, size_t size)
     }
 }
 
+uint64_t rand64()
+{
+	return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
 double calculate_mean(double data[], uint32_t len)
 {	
 	double sum = 0.0;
@@ -105,6 +110,7 @@ uint64_t vtop(unsigned pid, uint64_t vaddr)
 {	
 	//Bring the beginning of the sequence and the requested address into memory
 	memaccess((void *)vaddr);
+	metrics_count(METRIC_VTOP);
 	
 	char path[1024];
 	sprintf (path, "/proc/%u/pagemap", pid);
@@ -125,6 +131,59 @@ uint64_t vtop(unsigned pid, uint64_t vaddr)
 	return (paddr << 12) | (vaddr & (4096-1));
 }
 
+int pagemap_open(unsigned pid)
+{
+	char path[1024];
+	sprintf (path, "/proc/%u/pagemap", pid);
+	return open (path, O_RDONLY);
+}
+
+//Translates n addresses of the process whose pagemap is open on fd, without touching them. Entries for
+//consecutive 4KB pages are read with one pread. paddrs[i] is -1 if vaddrs[i] is not resident, or if its PFN is
+//hidden: readers without CAP_SYS_ADMIN get every PFN as 0.
+void pagemap_translate(int fd, const uint64_t *vaddrs, uint64_t *paddrs, uint64_t n)
+{
+	uint64_t entries[VTOP_BATCH_RUN];
+	uint64_t i = 0;
+	while (i < n)
+	{
+		//Collect the run of addresses on consecutive pages starting at i
+		uint64_t first_page = vaddrs[i] / 4096;
+		uint64_t run = 1;
+		while (i + run < n && run < VTOP_BATCH_RUN && vaddrs[i + run] / 4096 == first_page + run)
+			run++;
+
+		ssize_t got = pread (fd, entries, run * sizeof(uint64_t), first_page * sizeof(uint64_t));
+		for (uint64_t r = 0; r < run; ++r)
+		{
+			if (got < (ssize_t)((r + 1) * sizeof(uint64_t)) || !(entries[r] & PAGEMAP_PRESENT))
+			{
+				paddrs[i + r] = -1;
+				continue;
+			}
+			uint64_t pfn = entries[r] & 0x7fffffffffffff;
+			paddrs[i + r] = pfn == 0 ? (uint64_t)-1 : (pfn << 12) | (vaddrs[i + r] & (4096-1));
+		}
+		i += run;
+	}
+}
+
+//vtop() for many addresses with a single pagemap open. Addresses are brought into memory first, as vtop() does.
+//Returns 0 on success, -1 if pagemap could not be opened.
+int vtop_batch(unsigned pid, const uint64_t *vaddrs, uint64_t *paddrs, uint64_t n)
+{
+	int fd = pagemap_open(pid);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	for (uint64_t i = 0; i < n; ++i)
+		memaccess((void *)vaddrs[i]);
+	pagemap_translate(fd, vaddrs, paddrs, n);
+	close (fd);
+	return 0;
+}
+
 uint64_t ptos(uint64_t paddr, uint64_t bits)
 {
 	uint64_t ret = 0;
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "metrics.h"
+
 #ifndef HELPERS_H
 #define HELPERS_H
 
@@ -16,6 +18,8 @@ int does_val_differ_by_one(uint64_t a, uint64_t b);
 int is_bit_k_set(uint64_t num, int k);
 int is_power_of_two(uint64_t x);
 void shuffle(void *array, size_t n, size_t size);
+//64 random bits from rand(), which only gives 31 at a time
+uint64_t rand64();
 
 double calculate_mean(double data[], uint32_t len);
 double calculate_stddev(double data[], uint32_t len, double mean);
@@ -46,6 +50,11 @@ static inline uint32_t memaccesstime(void *v) {
 // https://github.com/cgvwzq/evsets/blob/master/browser/virt_to_phys.c
 // Thank you cgvwzq for this
 uint64_t vtop(unsigned pid, uint64_t vaddr);
+#define VTOP_BATCH_RUN 512
+#define PAGEMAP_PRESENT (1ULL << 63)
+int vtop_batch(unsigned pid, const uint64_t *vaddrs, uint64_t *paddrs, uint64_t n);
+int pagemap_open(unsigned pid);
+void pagemap_translate(int fd, const uint64_t *vaddrs, uint64_t *paddrs, uint64_t n);
 uint64_t ptos(uint64_t paddr, uint64_t bits);
 
 #endif //HELPERS_H
\ No newline at end of file
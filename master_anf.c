@@ -0,0 +1,134 @@
+#include "master_anf.h"
+
+#include <stdlib.h>
+
+master_anf_t *master_anf_create(const int16_t *master_sequence, uint64_t seq_len)
+{
+	if(master_sequence == NULL || seq_len < 2 || (seq_len & (seq_len - 1)) != 0 || seq_len > (1ULL << MASTER_ANF_MAX_IN))
+		return NULL;
+	int max = 0;
+	for (uint64_t v = 0; v < seq_len; ++v)
+	{
+		if(master_sequence[v] < 0)
+			return NULL;
+		max |= master_sequence[v];
+	}
+	master_anf_t *a = calloc(1, sizeof(master_anf_t));
+	a->in_bits = __builtin_ctzll(seq_len);
+	while(max >> a->out_bits)
+		a->out_bits++;
+	if(a->out_bits > MASTER_ANF_MAX_OUT)
+	{
+		free(a);
+		return NULL;
+	}
+
+	//Moebius transform of each output bit's truth table, coefficient m is set when term m is in the ANF
+	uint8_t *coeff = malloc(seq_len);
+	for (int j = 0; j < a->out_bits; ++j)
+	{
+		for (uint64_t v = 0; v < seq_len; ++v)
+			coeff[v] = (master_sequence[v] >> j) & 1;
+		for (int b = 0; b < a->in_bits; ++b)
+		{
+			for (uint64_t v = 0; v < seq_len; ++v)
+			{
+				if(v & (1ULL << b))
+					coeff[v] ^= coeff[v ^ (1ULL << b)];
+			}
+		}
+		a->terms[j] = malloc(seq_len * sizeof(uint32_t));
+		for (uint64_t m = 0; m < seq_len; ++m)
+		{
+			if(!coeff[m])
+				continue;
+			a->terms[j][a->n_terms[j]++] = (uint32_t)m;
+			a->support[j] |= (uint32_t)m;
+			if(__builtin_popcount(m) > a->degree[j])
+				a->degree[j] = __builtin_popcount(m);
+		}
+	}
+	free(coeff);
+	return a;
+}
+
+void master_anf_destroy(master_anf_t *a)
+{
+	if(a == NULL)
+		return;
+	for (int j = 0; j < a->out_bits; ++j)
+		free(a->terms[j]);
+	free(a);
+}
+
+int master_anf_eval(const master_anf_t *a, uint64_t v)
+{
+	int slice = 0;
+	for (int j = 0; j < a->out_bits; ++j)
+	{
+		int bit = 0;
+		for (int t = 0; t < a->n_terms[j]; ++t)
+			bit ^= (v & a->terms[j][t]) == a->terms[j][t];
+		slice |= bit << j;
+	}
+	return slice;
+}
+
+uint64_t master_anf_verify(const master_anf_t *a, const int16_t *master_sequence, uint64_t seq_len)
+{
+	uint64_t mismatches = 0;
+	for (uint64_t v = 0; v < seq_len; ++v)
+		mismatches += master_anf_eval(a, v) != master_sequence[v];
+	return mismatches;
+}
+
+void master_anf_print(FILE *f, const master_anf_t *a)
+{
+	for (int j = 0; j < a->out_bits; ++j)
+	{
+		fprintf(f, "M%d | degree %d | %d terms | v bits", j, a->degree[j], a->n_terms[j]);
+		for (int b = 0; b < a->in_bits; ++b)
+		{
+			if(a->support[j] & (1U << b))
+				fprintf(f, " %d", b);
+		}
+		fprintf(f, "\nM%d = ", j);
+		if(a->n_terms[j] == 0)
+			fprintf(f, "0");
+		for (int t = 0; t < a->n_terms[j]; ++t)
+		{
+			uint32_t m = a->terms[j][t];
+			if(t > 0)
+				fprintf(f, " ^ ");
+			if(m == 0)
+				fprintf(f, "1");
+			for (int b = 0; b < a->in_bits; ++b)
+			{
+				if(m & (1U << b))
+					fprintf(f, "v%d", b);
+			}
+		}
+		fprintf(f, "\n");
+	}
+}
+
+//Each term is a mask compare, so the whole function is straight line code
+void master_anf_print_c(FILE *f, const master_anf_t *a, const char *name)
+{
+	fprintf(f, "static inline int %s(uint64_t v)\n{\n", name);
+	for (int j = 0; j < a->out_bits; ++j)
+	{
+		fprintf(f, "\tint m%d = ", j);
+		if(a->n_terms[j] == 0)
+			fprintf(f, "0");
+		for (int t = 0; t < a->n_terms[j]; ++t)
+			fprintf(f, "%s((v & 0x%x) == 0x%x)", t == 0 ? "" : "\n\t\t^ ", a->terms[j][t], a->terms[j][t]);
+		fprintf(f, ";\n");
+	}
+	fprintf(f, "\treturn ");
+	if(a->out_bits == 0)
+		fprintf(f, "0");
+	for (int j = 0; j < a->out_bits; ++j)
+		fprintf(f, "%s(m%d << %d)", j ? " | " : "", j, j);
+	fprintf(f, ";\n}\n");
+}
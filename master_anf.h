@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef MASTER_ANF_H
+#define MASTER_ANF_H
+
+//Master sequence as a Boolean function. Bit j of the slice is written in algebraic normal form (an XOR of ANDs
+//of the bits of v, the sequence offset XORed with the XOR reduction). The ANF of a function is unique, so it is
+//also the smallest XOR of AND terms there is. Its degree and the bits it uses show how the reduction works,
+//and the terms give a branch-free evaluator in place of the table.
+
+//Slice bits and v bits covered, enough for 12 slices and 2^16 entry sequences
+#define MASTER_ANF_MAX_OUT 8
+#define MASTER_ANF_MAX_IN 16
+
+struct master_anf
+{
+	int in_bits;
+	int out_bits;
+	//Term t of output j is the AND of the v bits set in terms[j][t], 0 being the constant 1
+	uint32_t *terms[MASTER_ANF_MAX_OUT];
+	int n_terms[MASTER_ANF_MAX_OUT];
+	int degree[MASTER_ANF_MAX_OUT];
+	//v bits output j depends on
+	uint32_t support[MASTER_ANF_MAX_OUT];
+} typedef master_anf_t;
+
+//Returns NULL unless seq_len is a power of two within the limits above
+master_anf_t *master_anf_create(const int16_t *master_sequence, uint64_t seq_len);
+void master_anf_destroy(master_anf_t *a);
+int master_anf_eval(const master_anf_t *a, uint64_t v);
+//Evaluates every v against the table, returns the number of entries which disagree
+uint64_t master_anf_verify(const master_anf_t *a, const int16_t *master_sequence, uint64_t seq_len);
+void master_anf_print(FILE *f, const master_anf_t *a);
+//Writes a C function name(v) computing the slice from the terms
+void master_anf_print_c(FILE *f, const master_anf_t *a, const char *name);
+
+#endif //MASTER_ANF_H
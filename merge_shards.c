@@ -0,0 +1,354 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Combines the partial results of a sharded recovery (get_slice_mapping --shard) into one
+// result, printed like a saved run so slicehash_load() and --prior read it. Bits measured by
+// more than one shard are cross-checked, the report goes to stderr.
+// ./merge_shards <partial>... > output/<model>_<time>.txt
+// --simulate writes the partials n hosts would produce for a known hash, to try the merge
+// without them: ./merge_shards --simulate <result | model> <n> <dir> [--overlap k] [--noise p]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#include "shard.h"
+#include "helpers.h"
+#include "slicehash.h"
+#include "setup_info.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int merge_log2(uint64_t v)
+{
+	int b = 0;
+	while((1ULL << b) < v)
+		b++;
+	return b;
+}
+
+//Most common non-negative ID of n, -1 if there is none
+static int64_t merge_majority(const int64_t *ids, int n, int *votes)
+{
+	int64_t best = -1;
+	*votes = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		if(ids[i] < 0)
+			continue;
+		int count = 0;
+		for (int j = 0; j < n; ++j)
+			count += ids[j] == ids[i];
+		if(count > *votes)
+		{
+			*votes = count;
+			best = ids[i];
+		}
+	}
+	return best;
+}
+
+static uint64_t merge_index(uint64_t paddr, const int *xor_map, int addr_bits, uint64_t seq_len, int cacheline)
+{
+	uint64_t id = 0;
+	for (int b = 0; b < addr_bits; ++b)
+	{
+		if((paddr >> b) & 1)
+			id ^= xor_map[b];
+	}
+	return (((paddr / cacheline) % seq_len) ^ id) & (seq_len - 1);
+}
+
+static int merge(shard_partial_t **parts, int n_parts, const char **paths)
+{
+	shard_partial_t *p0 = parts[0];
+	for (int i = 1; i < n_parts; ++i)
+	{
+		if(parts[i]->num_cbos != p0->num_cbos || parts[i]->addr_bits != p0->addr_bits || parts[i]->seq_len != p0->seq_len ||
+			parts[i]->cacheline != p0->cacheline)
+		{
+			fprintf(stderr, "%s is from a different machine than %s (CBos, address bits, sequence length or line size)\n", paths[i], paths[0]);
+			return 1;
+		}
+	}
+	int addr_bits = p0->addr_bits;
+	uint64_t seq_len = p0->seq_len;
+	int first_bit = merge_log2(seq_len * p0->cacheline);
+	if(addr_bits > SHARD_MAX_BITS)
+	{
+		fprintf(stderr, "%d address bits, at most %d are supported\n", addr_bits, SHARD_MAX_BITS);
+		return 1;
+	}
+
+	//Each bit takes the ID most of its pairs agree on, over every shard which measured it
+	int xor_map[SHARD_MAX_BITS] = {0};
+	int missing = 0, conflicts = 0;
+	int64_t *ids = malloc(n_parts * SHARD_MAX_PAIRS * sizeof(int64_t));
+	int64_t *shard_id = malloc(n_parts * sizeof(int64_t));
+	for (int b = first_bit; b < addr_bits; ++b)
+	{
+		int n_ids = 0, shards = 0, votes = 0;
+		for (int i = 0; i < n_parts; ++i)
+		{
+			shard_id[i] = merge_majority(parts[i]->pair_id[b], parts[i]->n_pairs[b], &votes);
+			shards += parts[i]->n_pairs[b] > 0;
+			for (int a = 0; a < parts[i]->n_pairs[b]; ++a)
+				ids[n_ids++] = parts[i]->pair_id[b][a];
+		}
+		int64_t id = merge_majority(ids, n_ids, &votes);
+		if(id < 0)
+		{
+			fprintf(stderr, "Bit %02d | not measured by any shard\n", b);
+			missing++;
+			continue;
+		}
+		xor_map[b] = (int)id;
+		fprintf(stderr, "Bit %02d | %d shards | %d/%d pairs agree | ID 0x%lx\n", b, shards, votes, n_ids, id);
+		for (int i = 0; i < n_parts; ++i)
+		{
+			if(shard_id[i] >= 0 && shard_id[i] != id)
+			{
+				fprintf(stderr, "Bit %02d | %s (shard %d/%d) measured 0x%lx\n", b, paths[i], parts[i]->shard.index, parts[i]->shard.count, shard_id[i]);
+				conflicts++;
+			}
+		}
+	}
+	free(ids);
+	free(shard_id);
+	if(missing > 0)
+	{
+		fprintf(stderr, "%d bits were not measured, run the shards which measure them again\n", missing);
+		return 1;
+	}
+
+	//With the xor_map known, every measured line votes for the master sequence entry it indexes
+	int num_cbos = p0->num_cbos;
+	int16_t *master_sequence = NULL;
+	uint64_t unsettled = 0, contested = 0;
+	if((num_cbos & (num_cbos - 1)) != 0)
+	{
+		uint32_t *votes = calloc(seq_len * num_cbos, sizeof(uint32_t));
+		for (int i = 0; i < n_parts; ++i)
+		{
+			for (uint64_t s = 0; s < parts[i]->n_seqs; ++s)
+			{
+				shard_sequence_t *seq = &parts[i]->seqs[s];
+				for (uint64_t l = 0; l < seq->n; ++l)
+				{
+					uint64_t paddr = seq->paddr + l * p0->cacheline;
+					if(seq->slices[l] < 0 || seq->slices[l] >= num_cbos || (paddr >> addr_bits) > 0)
+						continue;
+					votes[merge_index(paddr, xor_map, addr_bits, seq_len, p0->cacheline) * num_cbos + seq->slices[l]]++;
+				}
+			}
+		}
+		//Settled the same way as find_master_sequence()
+		master_sequence = malloc(seq_len * sizeof(int16_t));
+		for (uint64_t v = 0; v < seq_len; ++v)
+		{
+			uint32_t top = 0, total = 0;
+			master_sequence[v] = -1;
+			for (int c = 0; c < num_cbos; ++c)
+			{
+				total += votes[v * num_cbos + c];
+				if(votes[v * num_cbos + c] > top)
+				{
+					top = votes[v * num_cbos + c];
+					master_sequence[v] = c;
+				}
+			}
+			unsettled += !(top >= MASTER_SEQUENCE_VOTES && top * 2 > total);
+			contested += top < total;
+		}
+		free(votes);
+		fprintf(stderr, "Master sequence: %lu entries, %lu with disagreeing votes, %lu unsettled\n", seq_len, contested, unsettled);
+	}
+	fprintf(stderr, "%d shards merged, %d shard measurements disagree with the merged xor_map\n", n_parts, conflicts);
+	if(unsettled > 0)
+	{
+		fprintf(stderr, "Not enough lines for the master sequence, merge more shards\n");
+		free(master_sequence);
+		return 1;
+	}
+
+	if(p0->model[0] != '\0')
+		printf("Model: %s\n", p0->model);
+	printf("Merged from %d shards\n", n_parts);
+	printf("Physical Address Bits: %d\n", addr_bits);
+	printf("L3 Cacheline: %d\n", p0->cacheline);
+	printf("------------------------------------------------\n");
+	printf("Sequence length is %lu cache lines\n\n", seq_len);
+	printf("The following XOR reduction map can be used to get the sequence ID of an address\n");
+	printf("int xor_map[%d] = {%d", addr_bits, xor_map[0]);
+	int max_reduction_bit = 0;
+	for (int b = 1; b < addr_bits; ++b)
+	{
+		printf(", %d", xor_map[b]);
+		if(xor_map[b] > max_reduction_bit)
+			max_reduction_bit = xor_map[b];
+	}
+	printf("};\n\n");
+	int mask_bits = max_reduction_bit > 0 ? merge_log2(max_reduction_bit + 1) : 1;
+	printf("The following mask can be used to get the sequence ID of an address\n");
+	printf("uint64_t mask[%d] = {", mask_bits);
+	for (int i = 0; i < mask_bits; ++i)
+	{
+		uint64_t mask = 0;
+		for (int b = 0; b < addr_bits; ++b)
+		{
+			if(xor_map[b] & (1 << i))
+				mask |= 1ULL << b;
+		}
+		printf("0x%010lxULL%s", mask, i < mask_bits - 1 ? ", " : "};\n\n");
+	}
+	if(master_sequence != NULL)
+	{
+		printf("int master_sequence[%lu] = {", seq_len);
+		for (uint64_t i = 0; i < seq_len; ++i)
+			printf("%d%s", master_sequence[i], i < seq_len - 1 ? ", " : "};\n\n");
+	}
+	else
+	{
+		printf("No master sequence, number of processor cores is a power of 2.\n\n");
+	}
+	free(master_sequence);
+	return 0;
+}
+
+//ID fill_seq_data_adj() gives sequence s: the first i for which every line measured is ref[line ^ i], SHARD_BAD_ID if
+//a misread leaves none
+static uint64_t simulate_sequence_id(const int16_t *s, const int16_t *ref, uint64_t seq_len, int num_cbos)
+{
+	for (uint64_t i = 0; i < seq_len; ++i)
+	{
+		uint64_t line = 0;
+		while(line < seq_len && (s[line] < 0 || s[line] >= num_cbos || ref[line ^ i] < 0 || s[line] == ref[line ^ i]))
+			line++;
+		if(line == seq_len)
+			return i;
+	}
+	return SHARD_BAD_ID;
+}
+
+//The partials get_slice_mapping --shard would write on n hosts of the machine h describes, with a fraction noise of
+//the lines measured as the wrong slice
+static int simulate(slicehash_t *h, int n, const char *dir, int overlap, double noise)
+{
+	int addr_bits = slicehash_addr_bits(h);
+	int cacheline = slicehash_cacheline(h);
+	int num_cbos = slicehash_num_slices(h);
+	uint64_t seq_len = slicehash_seq_len(h);
+	int first_bit = merge_log2(seq_len * cacheline);
+	uint64_t block = seq_len * cacheline;
+	int16_t *a = malloc(seq_len * sizeof(int16_t));
+	int16_t *b = malloc(seq_len * sizeof(int16_t));
+	int16_t *ref = malloc(seq_len * sizeof(int16_t));
+	uint64_t *paddrs = malloc(seq_len * sizeof(uint64_t));
+	srand(1);
+	for (int s = 0; s < n; ++s)
+	{
+		shard_t shard = {s, n, overlap};
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/shard_%d_of_%d.txt", dir, s, n);
+		FILE *f = fopen(path, "w");
+		if(f == NULL)
+		{
+			perror("simulate()");
+			return 1;
+		}
+		shard_write_header(f, &shard, slicehash_model(h), num_cbos, addr_bits, seq_len, cacheline);
+		for (int bit = first_bit; bit < addr_bits; ++bit)
+		{
+			if(bit != first_bit && !shard_has_bit(&shard, bit, first_bit))
+				continue;
+			for (int pair = 0; pair < NUM_ADJ_ADDR; ++pair)
+			{
+				uint64_t base = rand64() & ((1ULL << addr_bits) - 1) & ~(block - 1) & ~(1ULL << bit);
+				for (int side = 0; side < 2; ++side)
+				{
+					int16_t *slices = side ? b : a;
+					for (uint64_t l = 0; l < seq_len; ++l)
+					{
+						paddrs[l] = (base | ((uint64_t)side << bit)) + l * cacheline;
+						slices[l] = slicehash_slice(h, paddrs[l]);
+						if(num_cbos > 1 && rand() < noise * RAND_MAX)
+							slices[l] = (slices[l] + 1 + rand() % (num_cbos - 1)) % num_cbos;
+					}
+					if(side == 0)
+						shard_write_sequence(f, paddrs, slices, seq_len, cacheline);
+				}
+				//IDs as the search gives them: relative to the first sequence the host measured, or on 2^n slice
+				//machines the XOR of the first line, all of it held by a
+				uint64_t xor_a = 0, xor_b = 0;
+				if(bit == first_bit && pair == 0)
+					memcpy(ref, a, seq_len * sizeof(int16_t));
+				if((num_cbos & (num_cbos - 1)) == 0)
+				{
+					xor_a = a[0] ^ b[0];
+				}
+				else
+				{
+					xor_a = simulate_sequence_id(a, ref, seq_len, num_cbos);
+					xor_b = simulate_sequence_id(b, ref, seq_len, num_cbos);
+				}
+				shard_write_pair(f, bit, pair, shard_pair_encode(xor_a, xor_b, a, b, seq_len, num_cbos));
+				shard_write_sequence(f, paddrs, b, seq_len, cacheline);
+			}
+		}
+		fclose(f);
+		printf("%s\n", path);
+	}
+	free(a);
+	free(b);
+	free(ref);
+	free(paddrs);
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc >= 5 && strcmp(argv[1], "--simulate") == 0)
+	{
+		int overlap = 1;
+		double noise = 0.0;
+		for (int i = 5; i + 1 < argc; i += 2)
+		{
+			if(strcmp(argv[i], "--overlap") == 0)
+				overlap = atoi(argv[i + 1]);
+			else if(strcmp(argv[i], "--noise") == 0)
+				noise = atof(argv[i + 1]);
+		}
+		slicehash_t *h = slicehash_load(argv[2]);
+		if(h == NULL)
+			h = slicehash_load_db("output", argv[2]);
+		if(h == NULL || atoi(argv[3]) < 1)
+		{
+			printf("Could not load a slice hash from %s, or no shards\n", argv[2]);
+			return 1;
+		}
+		int ret = simulate(h, atoi(argv[3]), argv[4], overlap < 1 ? 1 : overlap, noise);
+		slicehash_destroy(h);
+		return ret;
+	}
+	if(argc < 2 || argv[1][0] == '-')
+	{
+		printf("Usage: %s <partial>... > <result>\n", argv[0]);
+		printf("       %s --simulate <result | model> <shards> <dir> [--overlap <k>] [--noise <p>]\n", argv[0]);
+		return 1;
+	}
+
+	int n_parts = argc - 1;
+	shard_partial_t **parts = calloc(n_parts, sizeof(shard_partial_t *));
+	int ret = 0;
+	for (int i = 0; i < n_parts && ret == 0; ++i)
+	{
+		parts[i] = shard_partial_load(argv[i + 1]);
+		if(parts[i] == NULL)
+		{
+			fprintf(stderr, "Could not read a partial result from %s\n", argv[i + 1]);
+			ret = 1;
+		}
+	}
+	if(ret == 0)
+		ret = merge(parts, n_parts, argv + 1);
+	for (int i = 0; i < n_parts; ++i)
+		shard_partial_destroy(parts[i]);
+	free(parts);
+	return ret;
+}
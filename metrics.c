@@ -0,0 +1,217 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t metrics_counters[METRIC_COUNTERS];
+
+static const char *metrics_phase_names[METRIC_PHASES] = {
+	"map_buffer",
+	"prior_search",
+	"sequence_length",
+	"adjacent_address_search",
+	"get_slice_values_adj",
+	"fill_seq_data_adj",
+	"find_xor_for_each_bit",
+	"find_master_sequence",
+	"verify_mapping",
+};
+
+static const char *metrics_counter_names[METRIC_COUNTERS] = {
+	"vtop",
+	"perfmon_monitor",
+	"retries",
+	"zscore_rejects",
+	"all_zero_fallbacks",
+	"badbad_sequences",
+	"noise_baselines",
+	"noise_episodes",
+	"noise_pauses",
+};
+
+static metrics_phase_t metrics_phases[METRIC_PHASES];
+static const char *metrics_json_path = NULL;
+static double metrics_start_wall;
+static double metrics_start_cpu;
+//Current phase and when it was entered, -1 when between phases
+static volatile int metrics_current = -1;
+static double metrics_current_wall;
+static double metrics_current_cpu;
+//Last phase entered, so a run which exits early shows where it stopped
+static int metrics_last = -1;
+
+static pthread_t metrics_progress_thread;
+static pthread_mutex_t metrics_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metrics_progress_cond = PTHREAD_COND_INITIALIZER;
+static int metrics_progress_running = 0;
+static int metrics_progress_stop = 0;
+
+static double metrics_clock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char *metrics_phase_name(int phase)
+{
+	return phase >= 0 && phase < METRIC_PHASES ? metrics_phase_names[phase] : "none";
+}
+
+static void metrics_progress_line(FILE *f)
+{
+	double now = metrics_clock(CLOCK_MONOTONIC);
+	int phase = metrics_current;
+	fprintf(f, "[metrics] %.1f s | phase %s", now - metrics_start_wall, metrics_phase_name(phase));
+	if(phase >= 0)
+		fprintf(f, " (%.1f s)", now - metrics_current_wall);
+	for (int c = 0; c < METRIC_COUNTERS; ++c)
+		fprintf(f, " | %s %lu", metrics_counter_names[c], __atomic_load_n(&metrics_counters[c], __ATOMIC_RELAXED));
+	fputc('\n', f);
+}
+
+static void *metrics_progress(void *arg)
+{
+	pthread_mutex_lock(&metrics_progress_lock);
+	while(!metrics_progress_stop)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += METRICS_PROGRESS_INTERVAL;
+		if(pthread_cond_timedwait(&metrics_progress_cond, &metrics_progress_lock, &deadline) != 0 && !metrics_progress_stop)
+			metrics_progress_line(stderr);
+	}
+	pthread_mutex_unlock(&metrics_progress_lock);
+	return NULL;
+}
+
+static void metrics_exit()
+{
+	metrics_phase_end();
+	if(metrics_progress_running)
+	{
+		pthread_mutex_lock(&metrics_progress_lock);
+		metrics_progress_stop = 1;
+		pthread_cond_signal(&metrics_progress_cond);
+		pthread_mutex_unlock(&metrics_progress_lock);
+		pthread_join(metrics_progress_thread, NULL);
+		metrics_progress_running = 0;
+	}
+	if(metrics_json_path == NULL)
+		return;
+	FILE *f = fopen(metrics_json_path, "w");
+	if(f == NULL)
+	{
+		perror("metrics_exit()");
+		return;
+	}
+	metrics_json(f);
+	fclose(f);
+}
+
+void metrics_init(const char *json_path)
+{
+	metrics_json_path = json_path;
+	metrics_start_wall = metrics_clock(CLOCK_MONOTONIC);
+	metrics_start_cpu = metrics_clock(CLOCK_PROCESS_CPUTIME_ID);
+	atexit(metrics_exit);
+	if(METRICS_PROGRESS_INTERVAL > 0 && pthread_create(&metrics_progress_thread, NULL, metrics_progress, NULL) == 0)
+		metrics_progress_running = 1;
+}
+
+void metrics_phase_begin(int phase)
+{
+	metrics_phase_end();
+	metrics_current_wall = metrics_clock(CLOCK_MONOTONIC);
+	metrics_current_cpu = metrics_clock(CLOCK_PROCESS_CPUTIME_ID);
+	metrics_phases[phase].entries++;
+	metrics_current = phase;
+	metrics_last = phase;
+}
+
+void metrics_phase_end()
+{
+	int phase = metrics_current;
+	if(phase < 0)
+		return;
+	metrics_phases[phase].wall += metrics_clock(CLOCK_MONOTONIC) - metrics_current_wall;
+	metrics_phases[phase].cpu += metrics_clock(CLOCK_PROCESS_CPUTIME_ID) - metrics_current_cpu;
+	metrics_current = -1;
+}
+
+//Totals for a phase, including the time so far if it is the current one
+static metrics_phase_t metrics_phase_total(int phase)
+{
+	metrics_phase_t t = metrics_phases[phase];
+	if(phase == metrics_current)
+	{
+		t.wall += metrics_clock(CLOCK_MONOTONIC) - metrics_current_wall;
+		t.cpu += metrics_clock(CLOCK_PROCESS_CPUTIME_ID) - metrics_current_cpu;
+	}
+	return t;
+}
+
+void metrics_print(FILE *f)
+{
+	fprintf(f, "Phase                        Wall (s)    CPU (s)\n");
+	for (int p = 0; p < METRIC_PHASES; ++p)
+	{
+		metrics_phase_t t = metrics_phase_total(p);
+		if(t.entries)
+			fprintf(f, "%-28s %8.2f %10.2f\n", metrics_phase_names[p], t.wall, t.cpu);
+	}
+	fprintf(f, "%-28s %8.2f %10.2f\n", "total", metrics_clock(CLOCK_MONOTONIC) - metrics_start_wall,
+		metrics_clock(CLOCK_PROCESS_CPUTIME_ID) - metrics_start_cpu);
+	for (int c = 0; c < METRIC_COUNTERS; ++c)
+		fprintf(f, "%s: %lu%s", metrics_counter_names[c], metrics_counters[c], c < METRIC_COUNTERS - 1 ? " | " : "\n");
+}
+
+//"model name" from /proc/cpuinfo, so results from different machines can be told apart
+static void metrics_cpu_model(char *model, size_t len)
+{
+	snprintf(model, len, "unknown");
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if(f == NULL)
+		return;
+	char line[256];
+	while(fgets(line, sizeof(line), f))
+	{
+		char *colon = strchr(line, ':');
+		if(strncmp(line, "model name", 10) != 0 || colon == NULL)
+			continue;
+		colon += 1 + (colon[1] == ' ');
+		colon[strcspn(colon, "\n")] = '\0';
+		snprintf(model, len, "%s", colon);
+		break;
+	}
+	fclose(f);
+	//Keep the JSON string valid
+	for (char *c = model; *c; ++c)
+	{
+		if(*c == '"' || *c == '\\')
+			*c = ' ';
+	}
+}
+
+void metrics_json(FILE *f)
+{
+	char model[128];
+	metrics_cpu_model(model, sizeof(model));
+	fprintf(f, "{\"cpu_model\": \"%s\", \"last_phase\": \"%s\", \"wall\": %.6f, \"cpu\": %.6f, \"phases\": {", model, metrics_phase_name(metrics_last),
+		metrics_clock(CLOCK_MONOTONIC) - metrics_start_wall, metrics_clock(CLOCK_PROCESS_CPUTIME_ID) - metrics_start_cpu);
+	int first = 1;
+	for (int p = 0; p < METRIC_PHASES; ++p)
+	{
+		metrics_phase_t t = metrics_phase_total(p);
+		if(t.entries == 0)
+			continue;
+		fprintf(f, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", first ? "" : ", ", metrics_phase_names[p], t.wall, t.cpu);
+		first = 0;
+	}
+	fprintf(f, "}, \"counters\": {");
+	for (int c = 0; c < METRIC_COUNTERS; ++c)
+		fprintf(f, "%s\"%s\": %lu", c ? ", " : "", metrics_counter_names[c], metrics_counters[c]);
+	fprintf(f, "}}\n");
+}
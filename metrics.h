@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef METRICS_H
+#define METRICS_H
+
+//Where a run's time goes. Phases are timed (wall and process CPU time, which includes every thread) from the
+//main thread, counters can be bumped from any thread. One set per process, reported as JSON at exit and as a
+//progress line while running.
+
+enum
+{
+	METRIC_PHASE_MAP,
+	METRIC_PHASE_PRIOR_SEARCH,
+	METRIC_PHASE_SEQUENCE_LENGTH,
+	METRIC_PHASE_ADJACENT_SEARCH,
+	METRIC_PHASE_SLICE_VALUES,
+	METRIC_PHASE_FILL_SEQ_DATA,
+	METRIC_PHASE_XOR_MAP,
+	METRIC_PHASE_MASTER_SEQUENCE,
+	METRIC_PHASE_VERIFY,
+	METRIC_PHASES
+};
+
+enum
+{
+	METRIC_VTOP,				//vtop() calls, each one opens and reads pagemap
+	METRIC_PERFMON_MONITOR,		//uncore_perfmon_monitor() calls
+	METRIC_RETRIES,				//Lines measured again because a reading was unusable
+	METRIC_ZSCORE_REJECTS,		//Readings with one slice above 1 but a z-score spread that did not single it out
+	METRIC_ALL_ZERO_FALLBACKS,	//Readings where no CBo saw the flushes, resolved with access_get_slice()
+	METRIC_BADBAD,				//Sequences which matched no XOR of the reference sequence (0xBADBAD)
+	METRIC_NOISE_BASELINES,		//Perfmon reads taken with no probe running, to see how busy the socket is
+	METRIC_NOISE_EPISODES,		//Stretches where the background was high enough to need more samples or a pause
+	METRIC_NOISE_PAUSES,		//Backoff sleeps waiting for a burst to pass
+	METRIC_COUNTERS
+};
+
+struct metrics_phase
+{
+	double wall;
+	double cpu;
+	//Times the phase was entered
+	uint64_t entries;
+} typedef metrics_phase_t;
+
+//Seconds between progress lines on stderr, 0 for none
+#ifndef METRICS_PROGRESS_INTERVAL
+	#define METRICS_PROGRESS_INTERVAL 10
+#endif
+
+extern uint64_t metrics_counters[METRIC_COUNTERS];
+
+static inline void metrics_count(int counter)
+{
+	__atomic_fetch_add(&metrics_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+//Starts the run clock and the progress line. json_path (may be NULL) is written when the process exits,
+//including through exit(1), so a failed run still shows how far it got.
+void metrics_init(const char *json_path);
+//Phases do not nest, beginning one ends the current one
+void metrics_phase_begin(int phase);
+void metrics_phase_end();
+const char *metrics_phase_name(int phase);
+void metrics_print(FILE *f);
+void metrics_json(FILE *f);
+
+#endif //METRICS_H
@@ -0,0 +1,295 @@
+#include "period_detect.h"
+#include "helpers.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PERIOD_UNMEASURED -2
+
+struct period_state
+{
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t page_lines;
+	uint64_t n_pages;
+	int cacheline;
+	int num_slices;
+	period_measure_t measure;
+	void *ctx;
+	//Every line of the first page, block 0 is always its start
+	int16_t *first;
+	//Lines of the block being compared when it is outside the first page
+	int16_t *block;
+	uint64_t block_base;
+	//Whether each line of the first page and of the block has been read to a majority
+	uint8_t *first_settled;
+	uint8_t *block_settled;
+	//Mismatches of each offset d against the block being compared
+	uint32_t *mismatches;
+	//Positions of the block compared so far
+	uint64_t *probes;
+	period_result_t *r;
+} typedef period_state_t;
+
+//Measures a line once, later calls return the cached value. -1 if the line could not be measured.
+static int16_t period_line(period_state_t *st, uint64_t line)
+{
+	int16_t *slot = line < st->page_lines ? &st->first[line] : &st->block[line - st->block_base];
+	if(*slot == PERIOD_UNMEASURED)
+	{
+		int16_t slice = st->measure(st->ctx, line * st->cacheline);
+		*slot = (slice >= 0 && slice < st->num_slices) ? slice : -1;
+		st->r->measured++;
+	}
+	return *slot;
+}
+
+//Reads a line again until one slice leads every other by two reads, the cached read included, and keeps that
+//slice, or -1 if none does within PERIOD_MAX_READS. A line is only settled once. Returns 1 if it was read again.
+static int period_settle(period_state_t *st, uint64_t line)
+{
+	int first = line < st->page_lines;
+	uint8_t *settled = first ? &st->first_settled[line] : &st->block_settled[line - st->block_base];
+	int16_t *slot = first ? &st->first[line] : &st->block[line - st->block_base];
+	if(*settled)
+		return 0;
+	*settled = 1;
+	int votes[st->num_slices];
+	memset(votes, 0, sizeof(votes));
+	if(*slot >= 0)
+		votes[*slot]++;
+	int16_t best = *slot;
+	for (int reads = 1; reads < PERIOD_MAX_READS; ++reads)
+	{
+		int16_t slice = st->measure(st->ctx, line * st->cacheline);
+		st->r->measured++;
+		if(slice >= 0 && slice < st->num_slices)
+			votes[slice]++;
+		int lead = 0, runner = 0;
+		for (int s = 0; s < st->num_slices; ++s)
+		{
+			if(votes[s] > lead)
+			{
+				runner = lead;
+				lead = votes[s];
+				best = s;
+			}
+			else if(votes[s] > runner)
+				runner = votes[s];
+		}
+		if(lead >= runner + 2)
+		{
+			*slot = best;
+			return 1;
+		}
+	}
+	*slot = -1;
+	return 1;
+}
+
+//Rescores every d against the positions probed so far, returns how many still match on all of them
+static uint64_t period_rescore(period_state_t *st, uint64_t period, uint64_t base, uint64_t checks)
+{
+	uint64_t alive = 0;
+	for (uint64_t d = 0; d < period; ++d)
+	{
+		st->mismatches[d] = 0;
+		for (uint64_t i = 0; i < checks; ++i)
+		{
+			int16_t a = st->first[st->probes[i] ^ d];
+			int16_t b = period_line(st, base + st->probes[i]);
+			st->mismatches[d] += a >= 0 && b >= 0 && a != b;
+		}
+		alive += st->mismatches[d] == 0;
+	}
+	return alive;
+}
+
+//Once no d matches every position, settles the lines the closest d (or ds) disagree on, in block 0 and in the
+//block, and rescores. Repeats while that reads anything again, then moves on to the next closest while they
+//disagree on at most a quarter of the positions, so misreads cached in block 0 are outvoted rather than carried
+//into every later block. Returns how many d match after.
+static uint64_t period_resolve(period_state_t *st, uint64_t period, uint64_t base, uint64_t checks)
+{
+	uint64_t alive = 0;
+	uint32_t closest = UINT32_MAX;
+	for (uint64_t d = 0; d < period; ++d)
+		closest = st->mismatches[d] < closest ? st->mismatches[d] : closest;
+	uint32_t level = closest;
+	while(alive == 0)
+	{
+		int reread = 0;
+		for (uint64_t d = 0; d < period; ++d)
+		{
+			if(st->mismatches[d] == 0 || st->mismatches[d] > level)
+				continue;
+			for (uint64_t i = 0; i < checks; ++i)
+			{
+				uint64_t q = st->probes[i];
+				int16_t a = st->first[q ^ d], b = period_line(st, base + q);
+				if(a >= 0 && b >= 0 && a != b)
+				{
+					reread |= period_settle(st, q ^ d);
+					reread |= period_settle(st, base + q);
+				}
+			}
+		}
+		alive = period_rescore(st, period, base, checks);
+		if(!reread)
+		{
+			if((uint64_t)(level + 1) * 4 > checks)
+				break;
+			level++;
+		}
+	}
+	return alive;
+}
+
+//1 if the block of period lines at base is block 0 XORed by some d. Every d is scored against each measured
+//position, so only the lines needed to rule out all but the right d, then verify it, are measured. Lines are
+//read to a majority before they rule out the last d, after which no mismatch is tolerated: master sequences
+//are close to periodic at half their length, a wrong period often differs in only a few lines of a block.
+static int period_block_matches(period_state_t *st, uint64_t period, uint64_t base)
+{
+	st->r->blocks++;
+	if(base >= st->page_lines)
+	{
+		st->block_base = base;
+		for (uint64_t i = 0; i < period; ++i)
+		{
+			st->block[i] = PERIOD_UNMEASURED;
+			st->block_settled[i] = 0;
+		}
+	}
+	for (uint64_t d = 0; d < period; ++d)
+		st->mismatches[d] = 0;
+
+	//Small blocks are compared whole, larger ones at random positions
+	int exhaustive = period <= 2 * PERIOD_VERIFY;
+	uint64_t max_probes = exhaustive ? period : PERIOD_MAX_PROBES + PERIOD_VERIFY;
+	uint64_t checks = 0;
+	uint64_t alive = period;
+	for (uint64_t p = 0; p < max_probes; ++p)
+	{
+		uint64_t q = exhaustive ? p : rand64() % period;
+		int16_t b = period_line(st, base + q);
+		if(b < 0)
+			continue;
+		st->probes[checks++] = q;
+		//B[q] = A[q ^ d] for the right d
+		alive = 0;
+		for (uint64_t d = 0; d < period; ++d)
+		{
+			int16_t a = st->first[q ^ d];
+			if(a >= 0 && a != b)
+				st->mismatches[d]++;
+			alive += st->mismatches[d] == 0;
+		}
+		if(alive == 0)
+			alive = period_resolve(st, period, base, checks);
+		if(alive == 0)
+			return 0;
+		if(alive == 1 && checks >= PERIOD_VERIFY)
+			return 1;
+	}
+	//Either every position was compared, or several offsets fit (A repeats itself) and all agree with B
+	return alive > 0;
+}
+
+//A random block other than block 0
+static uint64_t period_random_block(period_state_t *st, uint64_t period)
+{
+	uint64_t blocks_per_page = st->page_lines / period;
+	uint64_t page = st->n_pages > 1 ? 1 + rand64() % (st->n_pages - 1) : 0;
+	uint64_t block = rand64() % blocks_per_page;
+	if(page == 0 && block == 0)
+		block = 1;
+	return page * st->page_lines + block * period;
+}
+
+uint64_t period_detect(uint8_t *mem, uint64_t len, uint64_t page_size, int cacheline, int num_slices, uint64_t max_period,
+	period_measure_t measure, void *ctx, period_result_t *result)
+{
+	period_result_t local;
+	period_result_t *r = result ? result : &local;
+	r->period = 0;
+	r->measured = 0;
+	r->blocks = 0;
+	r->rejected = 0;
+
+	//2^n slice parts have no master sequence, the XOR reduction is the slice
+	if((num_slices & (num_slices - 1)) == 0)
+	{
+		r->period = 1;
+		return 1;
+	}
+
+	period_state_t st = {0};
+	st.mem = mem;
+	st.len = len;
+	st.page_lines = page_size / cacheline;
+	st.n_pages = len / page_size;
+	st.cacheline = cacheline;
+	st.num_slices = num_slices;
+	st.measure = measure;
+	st.ctx = ctx;
+	st.r = r;
+	if(max_period > st.page_lines)
+		max_period = st.page_lines;
+	if(st.n_pages == 0)
+		return 0;
+	st.first = malloc(st.page_lines * sizeof(int16_t));
+	st.block = malloc(max_period * sizeof(int16_t));
+	st.first_settled = calloc(st.page_lines, sizeof(uint8_t));
+	st.block_settled = calloc(max_period, sizeof(uint8_t));
+	st.mismatches = malloc(max_period * sizeof(uint32_t));
+	st.probes = malloc((max_period + PERIOD_MAX_PROBES + PERIOD_VERIFY) * sizeof(uint64_t));
+	for (uint64_t i = 0; i < st.page_lines; ++i)
+		st.first[i] = PERIOD_UNMEASURED;
+
+	for (uint64_t period = 1; period <= max_period; period <<= 1)
+	{
+		//Block 0 is needed in full, it grows by the previous period each time
+		for (uint64_t i = 0; i < period; ++i)
+			period_line(&st, i);
+
+		//Each block at a single bit offset within the page changes one bit of the ID at a time
+		int disagree = 0;
+		for (uint64_t base = period; base < st.page_lines && disagree < PERIOD_REJECT_BLOCKS; base <<= 1)
+			disagree += !period_block_matches(&st, period, base);
+
+		//Then blocks anywhere in the buffer, which also differ in the bits above the page. A period one block
+		//disagrees with is tested further, a wrong one soon disagrees again.
+		int single_block = st.n_pages == 1 && st.page_lines == period;
+		int tests = disagree > 0 ? PERIOD_RANDOM_BLOCKS + PERIOD_EXTRA_BLOCKS : PERIOD_RANDOM_BLOCKS;
+		for (int i = 0; i < tests && disagree < PERIOD_REJECT_BLOCKS && !single_block; ++i)
+		{
+			if(!period_block_matches(&st, period, period_random_block(&st, period)))
+			{
+				disagree++;
+				tests = PERIOD_RANDOM_BLOCKS + PERIOD_EXTRA_BLOCKS;
+			}
+		}
+
+		if(disagree < PERIOD_REJECT_BLOCKS)
+		{
+			r->period = period;
+			break;
+		}
+		r->rejected++;
+	}
+
+	free(st.first);
+	free(st.block);
+	free(st.first_settled);
+	free(st.block_settled);
+	free(st.mismatches);
+	free(st.probes);
+	return r->period;
+}
+
+void period_result_print(FILE *f, period_result_t *r)
+{
+	fprintf(f, "Period: %lu lines | Lines measured: %lu | Blocks compared: %lu | Periods rejected: %d\n",
+		r->period, r->measured, r->blocks, r->rejected);
+}
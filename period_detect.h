@@ -0,0 +1,45 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef PERIOD_DETECT_H
+#define PERIOD_DETECT_H
+
+//Finds the sequence length (XOR period) of the slice pattern from as few measured lines as possible.
+//A period P holds when every aligned block of P physically contiguous lines is block 0 with its line
+//index XORed by a constant: B[a] = A[a ^ d]. Candidates are tried from P = 1 upwards, and the first one
+//which fewer than PERIOD_REJECT_BLOCKS test blocks disagree with is the sequence length.
+
+//Returns the slice of mem[offset], or a negative value if it could not be measured
+typedef int16_t (*period_measure_t)(void *ctx, uint64_t offset);
+
+//Positions a block must agree with block 0 on before it is accepted. A wrong period matches each one with
+//probability about 1/num_slices, so a block of a wrong period survives this many only by chance.
+#define PERIOD_VERIFY 16
+//Blocks from other pages tested after the single bit offsets within the first page
+#define PERIOD_RANDOM_BLOCKS 8
+//Probes spent narrowing down d before a block with several consistent offsets is accepted
+#define PERIOD_MAX_PROBES 64
+//Blocks that must disagree with block 0 before a period is rejected, so one block thrown out by misreads that
+//outvoted a line does not reject the right period. Once one disagrees, up to PERIOD_EXTRA_BLOCKS more are tested.
+#define PERIOD_REJECT_BLOCKS 2
+#define PERIOD_EXTRA_BLOCKS 16
+//Reads of a line that disagrees with block 0 before it is given up as unreadable
+#define PERIOD_MAX_READS 7
+
+struct period_result
+{
+	uint64_t period;
+	//Lines measured, and blocks compared against block 0
+	uint64_t measured;
+	uint64_t blocks;
+	//Candidate periods rejected on the way
+	int rejected;
+} typedef period_result_t;
+
+//mem must be backed by page_size pages (physically contiguous within a page). max_period is in lines and
+//is capped at the lines per page. Returns the period in lines, or 0 if none up to max_period holds.
+uint64_t period_detect(uint8_t *mem, uint64_t len, uint64_t page_size, int cacheline, int num_slices, uint64_t max_period,
+	period_measure_t measure, void *ctx, period_result_t *result);
+void period_result_print(FILE *f, period_result_t *r);
+
+#endif //PERIOD_DETECT_H
@@ -0,0 +1,207 @@
+#include "pfn_index.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+//Pages translated per pagemap_translate() call by a prefault thread
+#define PFN_INDEX_PREFAULT_CHUNK 4096
+
+static pfn_index_t *pfn_index_sort_ctx;
+
+static int pfn_index_compare(const void *a, const void *b)
+{
+	uint64_t pa = pfn_index_sort_ctx->paddr[*(const uint64_t *)a];
+	uint64_t pb = pfn_index_sort_ctx->paddr[*(const uint64_t *)b];
+	return (pa > pb) - (pa < pb);
+}
+
+//Builds the physical to virtual lookup once paddr[] is filled
+static void pfn_index_sort(pfn_index_t *idx)
+{
+	for (uint64_t p = 0; p < idx->n_pages; ++p)
+		idx->by_paddr[p] = p;
+	pfn_index_sort_ctx = idx;
+	qsort(idx->by_paddr, idx->n_pages, sizeof(uint64_t), pfn_index_compare);
+	pfn_index_sort_ctx = NULL;
+}
+
+pfn_index_t *pfn_index_init(uint8_t *mem, uint64_t len, uint64_t page_size)
+{
+	pfn_index_t *idx = calloc(1, sizeof(pfn_index_t));
+	idx->mem = mem;
+	idx->len = len;
+	idx->page_size = page_size;
+	idx->page_bits = find_set_bit(page_size);
+	idx->n_pages = len / page_size;
+	idx->paddr = malloc(idx->n_pages * sizeof(uint64_t));
+	idx->by_paddr = malloc(idx->n_pages * sizeof(uint64_t));
+
+	uint64_t *vaddrs = malloc(idx->n_pages * sizeof(uint64_t));
+	for (uint64_t p = 0; p < idx->n_pages; ++p)
+		vaddrs[p] = (uint64_t)&mem[p * page_size];
+	if(vtop_batch((unsigned int)getpid(), vaddrs, idx->paddr, idx->n_pages) != 0)
+	{
+		perror("pfn_index_init()");
+		free(vaddrs);
+		pfn_index_destroy(idx);
+		return NULL;
+	}
+	free(vaddrs);
+
+	pfn_index_sort(idx);
+	return idx;
+}
+
+struct pfn_index_prefault_args
+{
+	pfn_index_t *idx;
+	uint64_t first;
+	uint64_t last;
+	int fail;
+};
+
+static void *pfn_index_prefault_thread(void *targs)
+{
+	struct pfn_index_prefault_args *args = (struct pfn_index_prefault_args *)targs;
+	pfn_index_t *idx = args->idx;
+	int fd = pagemap_open((unsigned int)getpid());
+	if(fd < 0)
+	{
+		args->fail = errno;
+		return NULL;
+	}
+	uint64_t vaddrs[PFN_INDEX_PREFAULT_CHUNK];
+	for (uint64_t p = args->first; p < args->last; p += PFN_INDEX_PREFAULT_CHUNK)
+	{
+		uint64_t n = args->last - p < PFN_INDEX_PREFAULT_CHUNK ? args->last - p : PFN_INDEX_PREFAULT_CHUNK;
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			uint8_t *page = &idx->mem[(p + i) * idx->page_size];
+			__atomic_fetch_add(page, 0, __ATOMIC_RELAXED);
+			vaddrs[i] = (uint64_t)page;
+		}
+		pagemap_translate(fd, vaddrs, &idx->paddr[p], n);
+	}
+	close(fd);
+	return NULL;
+}
+
+pfn_index_t *pfn_index_prefault(uint8_t *mem, uint64_t len, uint64_t page_size, int threads)
+{
+	if(threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	pfn_index_t *idx = calloc(1, sizeof(pfn_index_t));
+	idx->mem = mem;
+	idx->len = len;
+	idx->page_size = page_size;
+	idx->page_bits = find_set_bit(page_size);
+	idx->n_pages = len / page_size;
+	idx->paddr = malloc(idx->n_pages * sizeof(uint64_t));
+	idx->by_paddr = malloc(idx->n_pages * sizeof(uint64_t));
+	if(threads > idx->n_pages)
+		threads = idx->n_pages > 0 ? idx->n_pages : 1;
+
+	pthread_t *tids = malloc(threads * sizeof(pthread_t));
+	struct pfn_index_prefault_args *args = calloc(threads, sizeof(struct pfn_index_prefault_args));
+	for (int t = 0; t < threads; ++t)
+	{
+		args[t].idx = idx;
+		args[t].first = idx->n_pages * t / threads;
+		args[t].last = idx->n_pages * (t + 1) / threads;
+		int err = pthread_create(&tids[t], NULL, pfn_index_prefault_thread, &args[t]);
+		if(err)
+		{
+			printf("Error: unable to create thread: %d\n", err);
+			exit(1);
+		}
+	}
+	int fail = 0;
+	for (int t = 0; t < threads; ++t)
+	{
+		pthread_join(tids[t], NULL);
+		fail = args[t].fail ? args[t].fail : fail;
+	}
+	free(tids);
+	free(args);
+	if(fail)
+	{
+		errno = fail;
+		perror("pfn_index_prefault()");
+		pfn_index_destroy(idx);
+		return NULL;
+	}
+
+	pfn_index_sort(idx);
+	return idx;
+}
+
+pfn_index_t *pfn_index_from(uint8_t *mem, uint64_t len, uint64_t page_size, const uint64_t *paddr)
+{
+	pfn_index_t *idx = calloc(1, sizeof(pfn_index_t));
+	idx->mem = mem;
+	idx->len = len;
+	idx->page_size = page_size;
+	idx->page_bits = find_set_bit(page_size);
+	idx->n_pages = len / page_size;
+	idx->paddr = malloc(idx->n_pages * sizeof(uint64_t));
+	idx->by_paddr = malloc(idx->n_pages * sizeof(uint64_t));
+	memcpy(idx->paddr, paddr, idx->n_pages * sizeof(uint64_t));
+	pfn_index_sort(idx);
+	return idx;
+}
+
+int64_t pfn_index_check(pfn_index_t *idx, uint64_t n, unsigned seed)
+{
+	if(idx->n_pages == 0)
+		return 0;
+	int fd = pagemap_open((unsigned int)getpid());
+	if(fd < 0)
+		return -1;
+	int64_t differ = 0;
+	for (uint64_t i = 0; i < n; ++i)
+	{
+		uint64_t page = i == 0 ? 0 : i == 1 ? idx->n_pages - 1 : (((uint64_t)rand_r(&seed) << 31) ^ rand_r(&seed)) % idx->n_pages;
+		uint64_t vaddr = (uint64_t)&idx->mem[page * idx->page_size];
+		uint64_t paddr;
+		pagemap_translate(fd, &vaddr, &paddr, 1);
+		differ += paddr == (uint64_t)-1 || paddr != idx->paddr[page];
+	}
+	close(fd);
+	return differ;
+}
+
+uint64_t pfn_index_untranslated(pfn_index_t *idx)
+{
+	uint64_t n = 0;
+	for (uint64_t p = 0; p < idx->n_pages; ++p)
+		n += idx->paddr[p] == (uint64_t)-1;
+	return n;
+}
+
+void pfn_index_destroy(pfn_index_t *idx)
+{
+	if(idx == NULL)
+		return;
+	free(idx->paddr);
+	free(idx->by_paddr);
+	free(idx);
+}
+
+int64_t pfn_index_ptov(pfn_index_t *idx, uint64_t paddr)
+{
+	uint64_t base = paddr & ~(idx->page_size - 1);
+	uint64_t lo = 0, hi = idx->n_pages;
+	while(lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		uint64_t pa = idx->paddr[idx->by_paddr[mid]];
+		if(pa == base)
+			return (int64_t)((idx->by_paddr[mid] << idx->page_bits) | (paddr & (idx->page_size - 1)));
+		if(pa < base)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
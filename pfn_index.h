@@ -0,0 +1,47 @@
+#include <stdint.h>
+
+#include "helpers.h"
+
+#ifndef PFN_INDEX_H
+#define PFN_INDEX_H
+
+//Physical address of every page of a buffer, translated once so lookups after that are an array index.
+//Pages are assumed to be physically contiguous (huge pages, or 4KB pages when page_size is 4096).
+struct pfn_index
+{
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t page_size;
+	int page_bits;
+	uint64_t n_pages;
+	//Physical base of each page, -1 if it could not be translated
+	uint64_t *paddr;
+	//Page numbers sorted by physical address, for physical to virtual lookups
+	uint64_t *by_paddr;
+} typedef pfn_index_t;
+
+pfn_index_t *pfn_index_init(uint8_t *mem, uint64_t len, uint64_t page_size);
+//pfn_index_init() for a freshly mapped buffer. threads (0 for one per online CPU) each fault in a disjoint run of
+//pages and translate it in the same pass, so the kernel zeroes pages on every core rather than on whichever thread
+//touches them first. Every page is written, a page only read is the shared zero page until its first write.
+pfn_index_t *pfn_index_prefault(uint8_t *mem, uint64_t len, uint64_t page_size, int threads);
+//Index of a buffer whose pages' physical bases are already known, n_pages of them in paddr (copied)
+pfn_index_t *pfn_index_from(uint8_t *mem, uint64_t len, uint64_t page_size, const uint64_t *paddr);
+//Translates n pages, the first, the last and the rest at random, and compares them with the index. Returns how many
+//differ, or -1 if pagemap cannot be read. Pages must be mapped to translate, an unmapped one counts as differing.
+int64_t pfn_index_check(pfn_index_t *idx, uint64_t n, unsigned seed);
+//Pages of the index that could not be translated. Without root every page is.
+uint64_t pfn_index_untranslated(pfn_index_t *idx);
+void pfn_index_destroy(pfn_index_t *idx);
+//Offset into the buffer of paddr, -1 if paddr is not in the buffer
+int64_t pfn_index_ptov(pfn_index_t *idx, uint64_t paddr);
+
+static inline uint64_t pfn_index_vtop(pfn_index_t *idx, uint64_t offset)
+{
+	uint64_t base = idx->paddr[offset >> idx->page_bits];
+	if(base == (uint64_t)-1)
+		return -1;
+	return base | (offset & (idx->page_size - 1));
+}
+
+#endif //PFN_INDEX_H
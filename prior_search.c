@@ -0,0 +1,322 @@
+#include "prior_search.h"
+#include "pfn_index.h"
+#include "helpers.h"
+#include "slicehash.h"
+#include <perf_counters.h>
+#include <dirent.h>
+#include <string.h>
+
+//Slices a prediction histogram can hold, -1 (address out of range) included
+#define PRIOR_MAX_SLICES 64
+
+struct prior_candidate
+{
+	char source[160];
+	int xor_map[ADDR_BITS];
+	slicehash_t *h;
+	//Slice predicted for each pool line
+	int16_t *pred;
+	uint32_t mismatches;
+} typedef prior_candidate_t;
+
+struct prior_set
+{
+	prior_candidate_t *c;
+	int n;
+	int cap;
+} typedef prior_set_t;
+
+static int prior_same(slicehash_t *h, const int *xor_map, const int16_t *master_sequence, uint64_t seq_len)
+{
+	const int16_t *ms = slicehash_master_sequence(h);
+	if(slicehash_seq_len(h) != seq_len || (ms == NULL) != (master_sequence == NULL))
+		return 0;
+	if(ms != NULL && memcmp(ms, master_sequence, seq_len * sizeof(int16_t)) != 0)
+		return 0;
+	return memcmp(slicehash_xor_map(h), xor_map, ADDR_BITS * sizeof(int)) == 0;
+}
+
+//Adds a candidate unless the same hash is already in the set
+static void prior_add(prior_set_t *set, const char *source, const int *xor_map, const int16_t *master_sequence, uint64_t seq_len)
+{
+	for (int i = 0; i < set->n; ++i)
+	{
+		if(prior_same(set->c[i].h, xor_map, master_sequence, seq_len))
+			return;
+	}
+	slicehash_t *h = slicehash_create(xor_map, ADDR_BITS, master_sequence, seq_len, L3_CACHELINE);
+	if(h == NULL)
+		return;
+	if(set->n == set->cap)
+	{
+		set->cap = set->cap ? set->cap * 2 : 64;
+		set->c = realloc(set->c, set->cap * sizeof(prior_candidate_t));
+	}
+	prior_candidate_t *c = &set->c[set->n++];
+	memset(c, 0, sizeof(prior_candidate_t));
+	snprintf(c->source, sizeof(c->source), "%s", source);
+	memcpy(c->xor_map, xor_map, ADDR_BITS * sizeof(int));
+	c->h = h;
+}
+
+//Saved results for machines with this many slices and this cacheline size
+static int prior_load(const char *dir, int num_cbos, slicehash_t ***bases, char ***names)
+{
+	DIR *d = opendir(dir);
+	if(d == NULL)
+		return 0;
+	int n = 0, cap = 0;
+	struct dirent *e;
+	while((e = readdir(d)) != NULL)
+	{
+		size_t name_len = strlen(e->d_name);
+		if(name_len < 5 || strcmp(e->d_name + name_len - 4, ".txt") != 0)
+			continue;
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		slicehash_t *h = slicehash_load(path);
+		if(h == NULL)
+			continue;
+		if(slicehash_num_slices(h) != num_cbos || slicehash_cacheline(h) != L3_CACHELINE)
+		{
+			slicehash_destroy(h);
+			continue;
+		}
+		if(n == cap)
+		{
+			cap = cap ? cap * 2 : 16;
+			*bases = realloc(*bases, cap * sizeof(slicehash_t *));
+			*names = realloc(*names, cap * sizeof(char *));
+		}
+		(*bases)[n] = h;
+		(*names)[n] = strndup(e->d_name, name_len - 4);
+		n++;
+	}
+	closedir(d);
+	return n;
+}
+
+//Every saved result shifted by up to PRIOR_MAX_SHIFT bits and cut or padded to ADDR_BITS. Results with fewer
+//address bits are also extended with the high bits of any related result (same master sequence, and the same
+//xor_map on the bits both have).
+static void prior_generate(prior_set_t *set, slicehash_t **bases, char **names, int n_bases)
+{
+	for (int i = 0; i < n_bases; ++i)
+	{
+		const int *src = slicehash_xor_map(bases[i]);
+		const int16_t *ms = slicehash_master_sequence(bases[i]);
+		uint64_t seq_len = slicehash_seq_len(bases[i]);
+		int src_bits = slicehash_addr_bits(bases[i]);
+		//Bits below low index the line within the sequence and have no xor_map entry
+		int low = find_set_bit(seq_len * L3_CACHELINE);
+		char source[160];
+		int xor_map[ADDR_BITS];
+
+		//Unshifted first, so it wins ties against shifts the measured lines cannot tell apart
+		for (int k = 0; k <= 2 * PRIOR_MAX_SHIFT; ++k)
+		{
+			int shift = k % 2 ? (k + 1) / 2 : -(k / 2);
+			for (int b = 0; b < ADDR_BITS; ++b)
+			{
+				int from = b - shift;
+				xor_map[b] = (b >= low && from >= low && from < src_bits) ? src[from] : 0;
+			}
+			if(shift == 0)
+				snprintf(source, sizeof(source), "%s", names[i]);
+			else
+				snprintf(source, sizeof(source), "%s shifted %+d", names[i], shift);
+			prior_add(set, source, xor_map, ms, seq_len);
+		}
+
+		if(src_bits >= ADDR_BITS)
+			continue;
+		for (int j = 0; j < n_bases; ++j)
+		{
+			const int *other = slicehash_xor_map(bases[j]);
+			const int16_t *other_ms = slicehash_master_sequence(bases[j]);
+			if(slicehash_addr_bits(bases[j]) <= src_bits || slicehash_seq_len(bases[j]) != seq_len)
+				continue;
+			if((ms == NULL) != (other_ms == NULL) || (ms != NULL && memcmp(ms, other_ms, seq_len * sizeof(int16_t)) != 0))
+				continue;
+			if(memcmp(&src[low], &other[low], (src_bits - low) * sizeof(int)) != 0)
+				continue;
+			for (int b = 0; b < ADDR_BITS; ++b)
+				xor_map[b] = b < src_bits ? src[b] : (b < slicehash_addr_bits(bases[j]) ? other[b] : 0);
+			snprintf(source, sizeof(source), "%s extended from %s", names[i], names[j]);
+			prior_add(set, source, xor_map, ms, seq_len);
+		}
+	}
+}
+
+//Information a measurement of pool line i gives about the live candidates, the entropy of their predictions
+static double prior_entropy(prior_set_t *set, int i, int alive)
+{
+	int counts[PRIOR_MAX_SLICES + 1] = {0};
+	for (int c = 0; c < set->n; ++c)
+	{
+		if(set->c[c].mismatches > PRIOR_SLACK)
+			continue;
+		int16_t p = set->c[c].pred[i];
+		counts[p < 0 || p >= PRIOR_MAX_SLICES ? 0 : p + 1]++;
+	}
+	double h = 0.0;
+	for (int s = 0; s <= PRIOR_MAX_SLICES; ++s)
+	{
+		if(counts[s] == 0)
+			continue;
+		double p = (double)counts[s] / alive;
+		h -= p * log2(p);
+	}
+	return h;
+}
+
+static int prior_alive(prior_set_t *set, int *best)
+{
+	int alive = 0;
+	*best = -1;
+	for (int c = 0; c < set->n; ++c)
+	{
+		if(set->c[c].mismatches > PRIOR_SLACK)
+			continue;
+		alive++;
+		if(*best < 0 || set->c[c].mismatches < set->c[*best].mismatches)
+			*best = c;
+	}
+	return alive;
+}
+
+int prior_search(uint8_t *mem, uint64_t len, pfn_index_t *pfn, const char *dir, prior_result_t *r)
+{
+	memset(r, 0, sizeof(prior_result_t));
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+
+	slicehash_t **bases = NULL;
+	char **names = NULL;
+	int n_bases = prior_load(dir, num_cbos, &bases, &names);
+	prior_set_t set = {0};
+	prior_generate(&set, bases, names, n_bases);
+	for (int i = 0; i < n_bases; ++i)
+	{
+		slicehash_destroy(bases[i]);
+		free(names[i]);
+	}
+	free(bases);
+	free(names);
+	r->candidates = set.n;
+	if(set.n == 0)
+		return 0;
+
+	//Random lines of the buffer with known physical addresses, and what each candidate says about them
+	uint64_t *pool_offset = malloc(PRIOR_POOL * sizeof(uint64_t));
+	uint64_t *pool_paddr = malloc(PRIOR_POOL * sizeof(uint64_t));
+	uint8_t *used = calloc(PRIOR_POOL, 1);
+	int pool = 0;
+	for (int tries = 0; tries < 4 * PRIOR_POOL && pool < PRIOR_POOL; ++tries)
+	{
+		uint64_t offset = (rand64() % len) & ~(uint64_t)(L3_CACHELINE - 1);
+		uint64_t paddr = pfn_index_vtop(pfn, offset);
+		if(paddr == (uint64_t)-1 || (paddr >> ADDR_BITS) > 0)
+			continue;
+		pool_offset[pool] = offset;
+		pool_paddr[pool] = paddr;
+		pool++;
+	}
+	for (int c = 0; c < set.n; ++c)
+	{
+		set.c[c].pred = malloc(PRIOR_POOL * sizeof(int16_t));
+		slicehash_slice_batch(set.c[c].h, pool_paddr, set.c[c].pred, pool);
+	}
+
+	//Measure whichever line splits the live candidates most evenly, until one is left or they all agree
+	slice_session_t *session = slice_session_init(mem, len);
+	int best;
+	int alive = prior_alive(&set, &best);
+	while(alive > 0 && r->probes < PRIOR_MAX_PROBES)
+	{
+		int pick = -1;
+		double pick_entropy = 0.0;
+		for (int i = 0; i < pool; ++i)
+		{
+			if(used[i])
+				continue;
+			double h = prior_entropy(&set, i, alive);
+			if(h > pick_entropy)
+			{
+				pick_entropy = h;
+				pick = i;
+			}
+		}
+		if(pick < 0)
+			break;
+		used[pick] = 1;
+		int16_t slice = slice_session_measure(session, pool_offset[pick]);
+		r->measured++;
+		if(slice < 0 || slice >= num_cbos)
+			continue;
+		r->probes++;
+		for (int c = 0; c < set.n; ++c)
+			set.c[c].mismatches += set.c[c].pred[pick] != slice;
+		alive = prior_alive(&set, &best);
+	}
+	r->survivors = alive;
+
+	//The one left has to predict lines it was not chosen on
+	if(alive > 0)
+	{
+		for (int i = 0; i < pool && r->confirmed < PRIOR_CONFIRM; ++i)
+		{
+			if(used[i])
+				continue;
+			used[i] = 1;
+			int16_t slice = slice_session_measure(session, pool_offset[i]);
+			r->measured++;
+			if(slice < 0 || slice >= num_cbos)
+				continue;
+			r->confirmed++;
+			r->confirm_mismatches += set.c[best].pred[i] != slice;
+		}
+		r->found = r->confirmed >= PRIOR_CONFIRM / 2 && r->confirm_mismatches <= PRIOR_SLACK;
+	}
+	slice_session_destroy(session);
+
+	if(r->found)
+	{
+		prior_candidate_t *c = &set.c[best];
+		const int16_t *ms = slicehash_master_sequence(c->h);
+		snprintf(r->source, sizeof(r->source), "%s", c->source);
+		memcpy(r->xor_map, c->xor_map, ADDR_BITS * sizeof(int));
+		r->seq_len = slicehash_seq_len(c->h);
+		if(ms != NULL)
+		{
+			r->master_sequence = malloc(r->seq_len * sizeof(int16_t));
+			memcpy(r->master_sequence, ms, r->seq_len * sizeof(int16_t));
+		}
+	}
+
+	for (int c = 0; c < set.n; ++c)
+	{
+		slicehash_destroy(set.c[c].h);
+		free(set.c[c].pred);
+	}
+	free(set.c);
+	free(pool_offset);
+	free(pool_paddr);
+	free(used);
+	return r->found;
+}
+
+void prior_result_print(FILE *f, prior_result_t *r)
+{
+	fprintf(f, "Prior search: %d candidates | Probes: %lu | Left: %d | Confirmed: %lu/%lu | Lines measured: %lu\n",
+		r->candidates, r->probes, r->survivors, r->confirmed - r->confirm_mismatches, r->confirmed, r->measured);
+	if(r->found)
+		fprintf(f, "Matched %s\n", r->source);
+	else
+		fprintf(f, "No known hash matched, running the full search\n");
+}
+
+void prior_result_destroy(prior_result_t *r)
+{
+	free(r->master_sequence);
+	r->master_sequence = NULL;
+}
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "uncore_address_map.h"
+
+#ifndef PRIOR_SEARCH_H
+#define PRIOR_SEARCH_H
+
+//Recovery from known hashes. Parts in a family share most of their hash, so candidates are built from saved
+//results (as is, with the xor_map shifted by a few bits, truncated to ADDR_BITS, or extended with the high bits
+//of a related result) and told apart by measuring the lines they disagree on most. If none survives, the
+//caller falls back to the full adjacent address search.
+
+//xor_map shifts tried either side of each saved result
+#define PRIOR_MAX_SHIFT 2
+//Random lines candidates are scored on, probes are chosen from these
+#define PRIOR_POOL 4096
+//Most lines measured while narrowing the candidates down
+#define PRIOR_MAX_PROBES 256
+//Lines the surviving candidate has to predict afterwards, and mismatches tolerated (misread lines)
+#define PRIOR_CONFIRM 64
+#define PRIOR_SLACK 2
+
+struct prior_result
+{
+	int found;
+	//Saved result the hash came from, and how it was changed
+	char source[160];
+	int xor_map[ADDR_BITS];
+	//NULL on 2^n slice machines
+	int16_t *master_sequence;
+	uint64_t seq_len;
+	int candidates;
+	//Candidates still agreeing with every probe when narrowing stopped
+	int survivors;
+	uint64_t probes;
+	uint64_t confirmed;
+	uint64_t confirm_mismatches;
+	uint64_t measured;
+} typedef prior_result_t;
+
+//Returns 1 and fills r if a candidate from the results in dir predicts this machine, 0 otherwise
+int prior_search(uint8_t *mem, uint64_t len, pfn_index_t *pfn, const char *dir, prior_result_t *r);
+void prior_result_print(FILE *f, prior_result_t *r);
+void prior_result_destroy(prior_result_t *r);
+
+#endif //PRIOR_SEARCH_H
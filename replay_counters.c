@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Replays a counter log (get_slice_mapping --record) through the classification
+// measure_slice_accesses() makes, so changes to it can be tried on a real machine's noise
+// without the machine. With the result of the machine the log was recorded on, each
+// classified reading is checked against the slice of its line.
+// ./replay_counters <log> [--result <result file>] [--passes <n>]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#include "counter_log.h"
+#include "helpers.h"
+#include "slicehash.h"
+
+static double replay_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <log> [--result <result file>] [--passes <n>]\n", argv[0]);
+		return 1;
+	}
+	const char *result = NULL;
+	int passes = 1;
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--result") == 0)
+			result = argv[i + 1];
+		else if(strcmp(argv[i], "--passes") == 0)
+			passes = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+	}
+	counter_log_reader_t *r = counter_log_open(argv[1]);
+	if(r == NULL)
+	{
+		printf("Could not open a counter log at %s\n", argv[1]);
+		return 1;
+	}
+	slicehash_t *h = NULL;
+	if(result != NULL)
+	{
+		h = slicehash_load(result);
+		if(h == NULL || slicehash_num_slices(h) != r->num_cbos)
+		{
+			printf("%s is not a result for a machine with %d CBos\n", result, r->num_cbos);
+			return 1;
+		}
+	}
+	int num_cbos = r->num_cbos;
+	int addr_bits = h ? slicehash_addr_bits(h) : 64;
+	uint64_t mask = addr_bits < 64 ? (1ULL << addr_bits) - 1 : -1ULL;
+
+	uint64_t probes = 0, baselines = 0, classes[4] = {0};
+	uint64_t checked = 0, correct = 0;
+	uint64_t per_slice[num_cbos], per_slice_correct[num_cbos];
+	memset(per_slice, 0, sizeof(per_slice));
+	memset(per_slice_correct, 0, sizeof(per_slice_correct));
+	uint64_t first_ns = 0, last_ns = 0;
+	double busiest_sum = 0.0, busiest_floor = -1.0;
+	counter_log_record_t rec;
+	uint32_t totals[num_cbos];
+	double data[num_cbos];
+	double elapsed = 0.0;
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		counter_log_rewind(r);
+		double start = replay_now();
+		while(counter_log_next(r, &rec, totals))
+		{
+			double samples = rec.samples ? rec.samples : 1;
+			for (int s = 0; s < num_cbos; ++s)
+				data[s] = totals[s] / samples;
+			if(pass > 0)
+			{
+				int16_t slice;
+				counter_classify(data, num_cbos, &slice);
+				continue;
+			}
+			if(first_ns == 0)
+				first_ns = rec.time_ns;
+			last_ns = rec.time_ns;
+			if(rec.kind == COUNTER_LOG_BASELINE)
+			{
+				double busiest = 0.0;
+				for (int s = 0; s < num_cbos; ++s)
+					busiest = data[s] > busiest ? data[s] : busiest;
+				busiest_sum += busiest;
+				if(busiest_floor < 0.0 || busiest < busiest_floor)
+					busiest_floor = busiest;
+				baselines++;
+				continue;
+			}
+			probes++;
+			int16_t slice = -1;
+			int c = counter_classify(data, num_cbos, &slice);
+			classes[c]++;
+			if(c == COUNTER_SLICE && h != NULL && rec.paddr != (uint64_t)-1)
+			{
+				int truth = slicehash_slice(h, rec.paddr & mask);
+				checked++;
+				per_slice[truth]++;
+				if(truth == slice)
+				{
+					correct++;
+					per_slice_correct[truth]++;
+				}
+			}
+		}
+		elapsed += replay_now() - start;
+	}
+
+	printf("%s | %d CBos | %.2f s recorded\n", argv[1], num_cbos, (last_ns - first_ns) / 1e9);
+	printf("Readings: %lu probes, %lu baselines\n", probes, baselines);
+	if(probes > 0)
+	{
+		printf("Classified: %lu (%.2f%%)\n", classes[COUNTER_SLICE], 100.0 * classes[COUNTER_SLICE] / probes);
+		printf("Noisy: %lu (%.2f%%)\n", classes[COUNTER_NOISY], 100.0 * classes[COUNTER_NOISY] / probes);
+		printf("Z-score rejects: %lu (%.2f%%)\n", classes[COUNTER_ZSCORE], 100.0 * classes[COUNTER_ZSCORE] / probes);
+		printf("All zero (timing fallback): %lu (%.2f%%)\n", classes[COUNTER_ALL_ZERO], 100.0 * classes[COUNTER_ALL_ZERO] / probes);
+	}
+	if(baselines > 0)
+		printf("Baseline busiest CBo: mean %.3f, floor %.3f lookups/flush\n", busiest_sum / baselines, busiest_floor);
+	if(checked > 0)
+	{
+		printf("Accuracy against %s: %lu/%lu (%.4f%%)\n", result, correct, checked, 100.0 * correct / checked);
+		for (int s = 0; s < num_cbos; ++s)
+		{
+			if(per_slice[s] > 0)
+				printf("  Slice %d: %lu/%lu\n", s, per_slice_correct[s], per_slice[s]);
+		}
+	}
+	uint64_t readings = (probes + baselines) * passes;
+	printf("Replayed %lu readings in %.3f s (%.2f M readings/s)\n", readings, elapsed, elapsed > 0.0 ? readings / elapsed / 1e6 : 0.0);
+	counter_log_reader_close(r);
+	slicehash_destroy(h);
+	return 0;
+}
@@ -1,9 +1,36 @@
 #ifndef SETUP_INFO_H
 #define SETUP_INFO_H
 
-//Affinity to run the uncore performance counter interface on
-//Can isolate the core then run this tool on it
-#define AFFINITY 0
+//Logical CPU to run the uncore performance counter interface on. -1 picks the quietest P-core at run time (see
+//topology_measure_cpu()). Can isolate a core then run this tool on it.
+#ifndef AFFINITY
+	#define AFFINITY -1
+#endif
+
+//CBo event counted per flush (see cbo_event.h). With CBO_EVENT_AUTO a self-test on CBO_SELFTEST_LINES lines picks the
+//candidate with the best signal to noise on this CPU, and the fewest samples per read that still classify every line
+//as the full count does over CBO_SELFTEST_READS reads. Otherwise UNC_CBO_CACHE_LOOKUP.ANY_MESI is counted 10000 times.
+#ifndef CBO_EVENT_AUTO
+	#define CBO_EVENT_AUTO 1
+#endif
+#define CBO_SELFTEST_LINES 32
+#define CBO_SELFTEST_READS 4
+
+//Noise monitor (see measure_slice_accesses()). A baseline read with no probe running is taken every
+//NOISE_CHECK_INTERVAL lines and after every rejected reading. Background CBo lookups per flush above the host's
+//quietest baseline: over NOISE_HIGH each line is read more times and averaged, over NOISE_BURST measuring pauses
+//with exponential backoff, for at most NOISE_PAUSE_MAX_MS per episode.
+#ifndef NOISE_CHECK_INTERVAL
+	#define NOISE_CHECK_INTERVAL 64
+#endif
+#define NOISE_HIGH 0.25
+#define NOISE_BURST 0.75
+#define NOISE_MAX_READS 8
+#define NOISE_BACKOFF_MIN_US 500
+#define NOISE_BACKOFF_MAX_US 100000
+#ifndef NOISE_PAUSE_MAX_MS
+	#define NOISE_PAUSE_MAX_MS 5000
+#endif
 
 //For viewing slice mapping with different amounts of sequences
 #ifndef NUM_SEQUENCES
@@ -16,4 +43,17 @@
 //How many adjacent addresses we want for each memory address bit.
 #define NUM_ADJ_ADDR 2
 
+//Votes a master sequence entry needs (and a majority of) before it is settled, and how many times
+//unsettled entries are measured again before the most common slice is taken anyway.
+#define MASTER_SEQUENCE_VOTES 2
+#define MASTER_SEQUENCE_ROUNDS 8
+
+//Verification of the recovered function. Most samples taken, and the agreement it must show with 95% confidence.
+#ifndef VERIFY_SAMPLES
+	#define VERIFY_SAMPLES 4096
+#endif
+#ifndef VERIFY_TARGET
+	#define VERIFY_TARGET 0.99
+#endif
+
 #endif //SETUP_INFO_H
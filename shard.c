@@ -0,0 +1,216 @@
+#include "shard.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int shard_parse(const char *arg, shard_t *s)
+{
+	int index, count;
+	if(arg == NULL || sscanf(arg, "%d/%d", &index, &count) != 2 || count < 1 || index < 0 || index >= count)
+		return -1;
+	s->index = index;
+	s->count = count;
+	if(s->overlap < 1)
+		s->overlap = 1;
+	return 0;
+}
+
+int shard_has_bit(const shard_t *s, int bit, int first_bit)
+{
+	if(bit < first_bit)
+		return 0;
+	int owner = (bit - first_bit) % s->count;
+	return ((s->index - owner) % s->count + s->count) % s->count < s->overlap;
+}
+
+void shard_write_header(FILE *f, const shard_t *s, const char *model, int num_cbos, int addr_bits, uint64_t seq_len, int cacheline)
+{
+	if(model != NULL && model[0] != '\0')
+		fprintf(f, "Model: %s\n", model);
+	fprintf(f, "Shard: %d/%d | Overlap: %d\n", s->index, s->count, s->overlap);
+	fprintf(f, "CBos: %d\n", num_cbos);
+	fprintf(f, "Physical Address Bits: %d\n", addr_bits);
+	fprintf(f, "L3 Cacheline: %d\n", cacheline);
+	fprintf(f, "Sequence length is %lu cache lines\n", seq_len);
+}
+
+void shard_write_pair(FILE *f, int bit, int pair, int64_t id)
+{
+	fprintf(f, "Pair: %d %d %ld\n", bit, pair, id);
+}
+
+void shard_write_sequence(FILE *f, const uint64_t *paddrs, const int16_t *slices, uint64_t n, int cacheline)
+{
+	uint64_t start = 0;
+	while(start < n)
+	{
+		//Lines which could not be translated are left out
+		if(paddrs[start] == (uint64_t)-1)
+		{
+			start++;
+			continue;
+		}
+		uint64_t run = 1;
+		while(start + run < n && paddrs[start + run] == paddrs[start] + run * cacheline)
+			run++;
+		fprintf(f, "Sequence: 0x%lx %lu", paddrs[start], run);
+		for (uint64_t i = 0; i < run; ++i)
+			fprintf(f, " %d", slices[start + i]);
+		fputc('\n', f);
+		start += run;
+	}
+}
+
+shard_partial_t *shard_partial_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return NULL;
+	shard_partial_t *p = calloc(1, sizeof(shard_partial_t));
+	p->shard.index = -1;
+	uint64_t cap = 0;
+	int bad = 0;
+	char *line = NULL;
+	size_t line_cap = 0;
+	while(getline(&line, &line_cap, f) > 0)
+	{
+		int bit, pair, n;
+		int64_t id;
+		uint64_t paddr, len;
+		if(sscanf(line, "Model: %63s", p->model) == 1)
+			continue;
+		else if(sscanf(line, "Shard: %d/%d | Overlap: %d", &p->shard.index, &p->shard.count, &p->shard.overlap) >= 2)
+			continue;
+		else if(sscanf(line, "CBos: %d", &n) == 1)
+			p->num_cbos = n;
+		else if(sscanf(line, "Physical Address Bits: %d", &n) == 1)
+			p->addr_bits = n;
+		else if(sscanf(line, "L3 Cacheline: %d", &n) == 1)
+			p->cacheline = n;
+		else if(sscanf(line, "Sequence length is %d cache lines", &n) == 1)
+			p->seq_len = n > 0 && n <= SHARD_MAX_SEQ_LEN ? n : 0;
+		else if(sscanf(line, "Pair: %d %d %ld", &bit, &pair, &id) == 3)
+		{
+			if(bit < 0 || bit >= SHARD_MAX_BITS || pair < 0 || pair >= SHARD_MAX_PAIRS)
+				continue;
+			p->pair_id[bit][pair] = id;
+			if(pair + 1 > p->n_pairs[bit])
+				p->n_pairs[bit] = pair + 1;
+		}
+		else if(sscanf(line, "Sequence: %lx %lu%n", &paddr, &len, &n) == 2 && len > 0)
+		{
+			//Runs are never longer than a sequence, and the header comes first
+			if(len > p->seq_len)
+			{
+				bad = 1;
+				break;
+			}
+			if(p->n_seqs == cap)
+			{
+				cap = cap ? cap * 2 : 64;
+				p->seqs = realloc(p->seqs, cap * sizeof(shard_sequence_t));
+			}
+			shard_sequence_t *s = &p->seqs[p->n_seqs++];
+			s->paddr = paddr;
+			s->n = len;
+			s->slices = malloc(len * sizeof(int16_t));
+			char *c = line + n;
+			for (uint64_t i = 0; i < len && !bad; ++i)
+			{
+				char *end;
+				long slice = strtol(c, &end, 10);
+				bad = end == c || slice < -1 || slice > INT16_MAX;
+				s->slices[i] = (int16_t)slice;
+				c = end;
+			}
+			if(bad)
+				break;
+		}
+	}
+	free(line);
+	fclose(f);
+	if(bad || p->shard.index < 0 || p->seq_len == 0 || p->num_cbos == 0 || p->addr_bits == 0 || p->cacheline == 0)
+	{
+		shard_partial_destroy(p);
+		return NULL;
+	}
+	return p;
+}
+
+void shard_partial_destroy(shard_partial_t *p)
+{
+	if(p == NULL)
+		return;
+	for (uint64_t s = 0; s < p->n_seqs; ++s)
+		free(p->seqs[s].slices);
+	free(p->seqs);
+	free(p);
+}
+
+int64_t shard_pair_id(const int16_t *a, const int16_t *b, uint64_t seq_len, int num_cbos)
+{
+	//Mismatches of every candidate, the best and the runner up
+	uint64_t best_mismatches = UINT64_MAX, runner_up = UINT64_MAX, compared = 0;
+	int64_t best = -1;
+	if((num_cbos & (num_cbos - 1)) == 0)
+	{
+		uint64_t counts[num_cbos];
+		memset(counts, 0, sizeof(counts));
+		for (uint64_t line = 0; line < seq_len; ++line)
+		{
+			if(a[line] >= 0 && a[line] < num_cbos && b[line] >= 0 && b[line] < num_cbos)
+			{
+				counts[a[line] ^ b[line]]++;
+				compared++;
+			}
+		}
+		for (int i = 0; i < num_cbos; ++i)
+		{
+			uint64_t mismatches = compared - counts[i];
+			if(mismatches < best_mismatches)
+			{
+				runner_up = best_mismatches;
+				best_mismatches = mismatches;
+				best = i;
+			}
+			else if(mismatches < runner_up)
+				runner_up = mismatches;
+		}
+	}
+	else
+	{
+		for (uint64_t i = 0; i < seq_len; ++i)
+		{
+			uint64_t mismatches = 0, n = 0;
+			for (uint64_t line = 0; line < seq_len; ++line)
+			{
+				if(a[line] < 0 || a[line] >= num_cbos || b[line ^ i] < 0)
+					continue;
+				mismatches += a[line] != b[line ^ i];
+				n++;
+			}
+			if(mismatches < best_mismatches)
+			{
+				runner_up = best_mismatches;
+				best_mismatches = mismatches;
+				best = i;
+				compared = n;
+			}
+			else if(mismatches < runner_up)
+				runner_up = mismatches;
+		}
+	}
+	if(compared == 0 || best_mismatches == runner_up || best_mismatches * SHARD_PAIR_SLACK > compared)
+		return -1;
+	return best;
+}
+
+int64_t shard_pair_encode(uint64_t xor_a, uint64_t xor_b, const int16_t *a, const int16_t *b, uint64_t seq_len, int num_cbos)
+{
+	if(xor_a == SHARD_BAD_ID || xor_b == SHARD_BAD_ID)
+		return shard_pair_id(a, b, seq_len, num_cbos);
+	for (uint64_t line = 0; line < seq_len; ++line)
+		if(a[line] >= 0 && a[line] < num_cbos && b[line] >= 0 && b[line] < num_cbos)
+			return xor_a ^ xor_b;
+	return -1;
+}
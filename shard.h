@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef SHARD_H
+#define SHARD_H
+
+//Sharded recovery across identical machines. Each host measures a share of the address bits and writes a partial
+//result, merge_shards combines them. The ID of a bit only depends on the two sequences of each of its adjacent
+//pairs, so bits can be measured on different machines. The master sequence is not measured by shards at all: once
+//the merged xor_map is known, every line of every measured sequence is a vote for the entry it indexes.
+
+#define SHARD_MAX_BITS 64
+#define SHARD_MAX_PAIRS 16
+//Longest sequence a partial may hold, longer ones are rejected as corrupt
+#define SHARD_MAX_SEQ_LEN 65536
+//A pair's ID may disagree with at most 1/SHARD_PAIR_SLACK of the lines measured in both sequences. Misreads
+//are tolerated, wrong IDs are not: master sequences differ from themselves XORed by any ID in 1/16 of their lines.
+#define SHARD_PAIR_SLACK 8
+//ID fill_seq_data_adj() gives a sequence that matches no XOR of the reference sequence
+#define SHARD_BAD_ID 0xBADBAD
+
+struct shard
+{
+	int index;
+	int count;
+	//Shards measuring each bit, more than 1 lets the merge cross-check them
+	int overlap;
+} typedef shard_t;
+
+//A run of physically consecutive lines of a measured sequence, -1 where a line could not be measured
+struct shard_sequence
+{
+	uint64_t paddr;
+	uint64_t n;
+	int16_t *slices;
+} typedef shard_sequence_t;
+
+struct shard_partial
+{
+	char model[64];
+	shard_t shard;
+	int num_cbos;
+	int addr_bits;
+	int cacheline;
+	uint64_t seq_len;
+	//ID of each pair measured for a bit, -1 if the pair's sequences did not match. n_pairs[b] is 0 for bits the
+	//shard did not measure.
+	int64_t pair_id[SHARD_MAX_BITS][SHARD_MAX_PAIRS];
+	int n_pairs[SHARD_MAX_BITS];
+	shard_sequence_t *seqs;
+	uint64_t n_seqs;
+} typedef shard_partial_t;
+
+//"i/n", shards are numbered from 0. Returns -1 if arg is not one.
+int shard_parse(const char *arg, shard_t *s);
+//Bits from first_bit up are dealt out round robin, each to overlap consecutive shards
+int shard_has_bit(const shard_t *s, int bit, int first_bit);
+
+//model is written first if not NULL or empty, the merged result takes it from there
+void shard_write_header(FILE *f, const shard_t *s, const char *model, int num_cbos, int addr_bits, uint64_t seq_len, int cacheline);
+void shard_write_pair(FILE *f, int bit, int pair, int64_t id);
+//Lines whose physical addresses are paddrs, split into runs of consecutive lines
+void shard_write_sequence(FILE *f, const uint64_t *paddrs, const int16_t *slices, uint64_t n, int cacheline);
+
+//NULL if path cannot be read, lacks a header field, or has a sequence longer than the header's sequence length
+//or shorter than its own count
+shard_partial_t *shard_partial_load(const char *path);
+void shard_partial_destroy(shard_partial_t *p);
+
+//ID between the two sequences of an adjacent pair, as fill_seq_data_adj() finds it: the i for which a[line] is
+//b[line ^ i] on the most lines measured in both, or the most common XOR of their slices on 2^n slice machines.
+//-1 if the best i is tied or disagrees with more than 1/SHARD_PAIR_SLACK of the lines.
+int64_t shard_pair_id(const int16_t *a, const int16_t *b, uint64_t seq_len, int num_cbos);
+//ID a partial records for an adjacent pair whose sequences a and b fill_seq_data_adj() gave the IDs xor_a and xor_b.
+//Equal IDs are the pair ID 0, the bit does not move the sequence. With a SHARD_BAD_ID the pair is matched by
+//shard_pair_id(). -1 only if no line was measured in both sequences or no ID fits.
+int64_t shard_pair_encode(uint64_t xor_a, uint64_t xor_b, const int16_t *a, const int16_t *b, uint64_t seq_len, int num_cbos);
+
+#endif //SHARD_H
@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+//Simulated stand in for the part of the perfcounters interface this tool uses, so the measurement code can
+//be built and run (benchmarks, tests of the search logic) on hosts without MSR access. Build with -Isim.
+//Slices come from a saved result file (SLICE_SIM_RESULT, default output/i7-9850H_1634726880.txt) applied to
+//each line's physical address, or to its virtual address when pagemap hides PFNs (no root).
+//SLICE_SIM_NOISE is the probability a reading is unusable and has to be retried (default 0).
+//perf_counters_replay.c implements the same interface from a recorded counter log instead.
+
+#define MSR_UNC_CBO_PERFEVT_EN (1ULL << 22)
+
+struct counter
+{
+	uint32_t event;
+	uint32_t umask;
+	uint32_t filter;
+	const char *name;
+} typedef COUNTER_T;
+
+struct cbo_counter_info
+{
+	COUNTER_T counter;
+	int cbo;
+	uint64_t flags;
+} typedef CBO_COUNTER_INFO_T;
+
+struct uncore_result
+{
+	uint64_t total;
+} typedef uncore_result_t;
+
+struct uncore_perfmon
+{
+	int cpu;
+	int samples;
+	int num_cbo_ctrs;
+	CBO_COUNTER_INFO_T *cbo_ctrs;
+	uncore_result_t *results;
+} typedef uncore_perfmon_t;
+
+int uncore_get_num_cbo(int cpu);
+void uncore_perfmon_init(uncore_perfmon_t *u, int cpu, int samples, int num_cbo_ctrs, int num_arb_ctrs, int num_fixed_ctrs,
+	CBO_COUNTER_INFO_T *cbo_ctrs, void *arb_ctrs, void *fixed_ctrs);
+//Runs fn(arg0, arg1) once and fills results as if it had run samples times
+void uncore_perfmon_monitor(uncore_perfmon_t *u, void (*fn)(void *, void *), void *arg0, void *arg1);
+void uncore_perfmon_destroy(uncore_perfmon_t *u);
+
+#endif //PERF_COUNTERS_H
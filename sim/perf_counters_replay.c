@@ -0,0 +1,155 @@
+#include "perf_counters.h"
+#include "../helpers.h"
+#include "../slicehash.h"
+#include "../counter_log.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+//Replays counter vectors recorded with get_slice_mapping --record in place of the simulated model, so the search can
+//be rerun offline on a real machine's noise. SLICE_REPLAY_LOG is the log, SLICE_SIM_RESULT the result of the machine
+//it was recorded on. Physical addresses differ between runs, so recorded vectors are not looked up by address: they
+//are grouped by the slice the result gives their line, and a read of a line in slice s is served the next vector
+//recorded for a line in s. A read with nothing flushed is served the next recorded baseline.
+
+#define REPLAY_DEFAULT_RESULT "output/i7-9850H_1634726880.txt"
+
+struct replay_bucket
+{
+	uint32_t *totals;
+	uint32_t samples;
+	uint64_t n;
+	uint64_t cap;
+	uint64_t next;
+} typedef replay_bucket_t;
+
+static slicehash_t *replay_hash = NULL;
+static int replay_pagemap = -1;
+static int replay_num_cbos = 0;
+//One bucket per slice, the baselines last
+static replay_bucket_t *replay_buckets = NULL;
+
+static void replay_bucket_add(replay_bucket_t *b, const uint32_t *totals, uint32_t samples)
+{
+	if(b->n == b->cap)
+	{
+		b->cap = b->cap ? b->cap * 2 : 1024;
+		b->totals = realloc(b->totals, b->cap * replay_num_cbos * sizeof(uint32_t));
+	}
+	memcpy(&b->totals[b->n * replay_num_cbos], totals, replay_num_cbos * sizeof(uint32_t));
+	b->samples = samples;
+	b->n++;
+}
+
+static uint64_t replay_mask(uint64_t paddr)
+{
+	int bits = slicehash_addr_bits(replay_hash);
+	return bits < 64 ? paddr & ((1ULL << bits) - 1) : paddr;
+}
+
+static slicehash_t *replay_get_hash()
+{
+	if(replay_hash != NULL)
+		return replay_hash;
+	const char *result = getenv("SLICE_SIM_RESULT");
+	replay_hash = slicehash_load(result ? result : REPLAY_DEFAULT_RESULT);
+	if(replay_hash == NULL)
+	{
+		fprintf(stderr, "perf_counters_replay: could not load %s, set SLICE_SIM_RESULT\n", result ? result : REPLAY_DEFAULT_RESULT);
+		exit(1);
+	}
+	const char *path = getenv("SLICE_REPLAY_LOG");
+	counter_log_reader_t *r = path ? counter_log_open(path) : NULL;
+	if(r == NULL)
+	{
+		fprintf(stderr, "perf_counters_replay: could not open the counter log, set SLICE_REPLAY_LOG\n");
+		exit(1);
+	}
+	replay_num_cbos = slicehash_num_slices(replay_hash);
+	if(r->num_cbos != replay_num_cbos)
+	{
+		fprintf(stderr, "perf_counters_replay: %s has %d CBos, the result %d\n", path, r->num_cbos, replay_num_cbos);
+		exit(1);
+	}
+	replay_buckets = calloc(replay_num_cbos + 1, sizeof(replay_bucket_t));
+	counter_log_record_t rec;
+	uint32_t totals[replay_num_cbos];
+	while(counter_log_next(r, &rec, totals))
+	{
+		if(rec.kind == COUNTER_LOG_BASELINE)
+			replay_bucket_add(&replay_buckets[replay_num_cbos], totals, rec.samples);
+		else if(rec.paddr != (uint64_t)-1)
+			replay_bucket_add(&replay_buckets[slicehash_slice(replay_hash, replay_mask(rec.paddr))], totals, rec.samples);
+	}
+	counter_log_reader_close(r);
+	int recorded = 0;
+	for (int s = 0; s < replay_num_cbos; ++s)
+		recorded += replay_buckets[s].n > 0;
+	if(recorded == 0)
+	{
+		fprintf(stderr, "perf_counters_replay: %s has no probe readings\n", path);
+		exit(1);
+	}
+	replay_pagemap = pagemap_open((unsigned)getpid());
+	return replay_hash;
+}
+
+//Physical address of vaddr, or vaddr itself when pagemap gives no PFN
+static uint64_t replay_paddr(uint64_t vaddr)
+{
+	uint64_t paddr = -1;
+	if(replay_pagemap >= 0)
+		pagemap_translate(replay_pagemap, &vaddr, &paddr, 1);
+	if(paddr == (uint64_t)-1 || (paddr >> 12) == 0)
+		paddr = vaddr;
+	return replay_mask(paddr);
+}
+
+int uncore_get_num_cbo(int cpu)
+{
+	return slicehash_num_slices(replay_get_hash());
+}
+
+void uncore_perfmon_init(uncore_perfmon_t *u, int cpu, int samples, int num_cbo_ctrs, int num_arb_ctrs, int num_fixed_ctrs,
+	CBO_COUNTER_INFO_T *cbo_ctrs, void *arb_ctrs, void *fixed_ctrs)
+{
+	replay_get_hash();
+	u->cpu = cpu;
+	u->samples = samples;
+	u->num_cbo_ctrs = num_cbo_ctrs;
+	u->cbo_ctrs = cbo_ctrs;
+	u->results = calloc(num_cbo_ctrs, sizeof(uncore_result_t));
+}
+
+//Vectors are served round robin from the line's slice. A slice the recording never measured borrows the nearest
+//recorded slice's vectors with the CBos rotated onto it, and no recorded baselines reads as an idle socket.
+void uncore_perfmon_monitor(uncore_perfmon_t *u, void (*fn)(void *, void *), void *arg0, void *arg1)
+{
+	fn(arg0, arg1);
+	int slice = arg0 == NULL ? replay_num_cbos : slicehash_slice(replay_hash, replay_paddr((uint64_t)arg0));
+	int from = slice, rotate = 0;
+	if(slice < replay_num_cbos)
+	{
+		while(replay_buckets[from].n == 0)
+			from = (from + 1) % replay_num_cbos;
+		rotate = slice - from;
+	}
+	replay_bucket_t *b = &replay_buckets[from];
+	for (int s = 0; s < u->num_cbo_ctrs; ++s)
+		u->results[s].total = 0;
+	if(b->n == 0)
+		return;
+	const uint32_t *totals = &b->totals[b->next * replay_num_cbos];
+	b->next = (b->next + 1) % b->n;
+	for (int s = 0; s < u->num_cbo_ctrs; ++s)
+	{
+		int cbo = ((u->cbo_ctrs[s].cbo - rotate) % replay_num_cbos + replay_num_cbos) % replay_num_cbos;
+		u->results[s].total = (uint64_t)totals[cbo] * u->samples / (b->samples ? b->samples : u->samples);
+	}
+}
+
+void uncore_perfmon_destroy(uncore_perfmon_t *u)
+{
+	free(u->results);
+	u->results = NULL;
+}
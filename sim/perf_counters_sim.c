@@ -0,0 +1,119 @@
+#include "perf_counters.h"
+#include "../helpers.h"
+#include "../slicehash.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SIM_DEFAULT_RESULT "output/i7-9850H_1634726880.txt"
+
+static slicehash_t *sim_hash = NULL;
+static int sim_pagemap = -1;
+static double sim_noise = 0.0;
+static double sim_burst_period = 0.0, sim_burst_duty = 0.0;
+static unsigned sim_seed = 1;
+
+//Loaded on first use, every caller shares one hash
+static slicehash_t *sim_get_hash()
+{
+	if(sim_hash != NULL)
+		return sim_hash;
+	const char *path = getenv("SLICE_SIM_RESULT");
+	sim_hash = slicehash_load(path ? path : SIM_DEFAULT_RESULT);
+	if(sim_hash == NULL)
+	{
+		fprintf(stderr, "perf_counters_sim: could not load %s, set SLICE_SIM_RESULT\n", path ? path : SIM_DEFAULT_RESULT);
+		exit(1);
+	}
+	const char *noise = getenv("SLICE_SIM_NOISE");
+	sim_noise = noise ? atof(noise) : 0.0;
+	//"<period ms>,<duty>", another process hammering the LLC for the first duty of every period
+	const char *burst = getenv("SLICE_SIM_BURST");
+	if(burst != NULL && sscanf(burst, "%lf,%lf", &sim_burst_period, &sim_burst_duty) != 2)
+		sim_burst_period = 0.0;
+	sim_pagemap = pagemap_open((unsigned)getpid());
+	return sim_hash;
+}
+
+//Physical address of vaddr, or vaddr itself when pagemap gives no PFN
+static uint64_t sim_paddr(uint64_t vaddr)
+{
+	slicehash_t *h = sim_get_hash();
+	uint64_t paddr = -1;
+	if(sim_pagemap >= 0)
+		pagemap_translate(sim_pagemap, &vaddr, &paddr, 1);
+	if(paddr == (uint64_t)-1 || (paddr >> 12) == 0)
+		paddr = vaddr;
+	int bits = slicehash_addr_bits(h);
+	return bits < 64 ? paddr & ((1ULL << bits) - 1) : paddr;
+}
+
+int uncore_get_num_cbo(int cpu)
+{
+	return slicehash_num_slices(sim_get_hash());
+}
+
+void uncore_perfmon_init(uncore_perfmon_t *u, int cpu, int samples, int num_cbo_ctrs, int num_arb_ctrs, int num_fixed_ctrs,
+	CBO_COUNTER_INFO_T *cbo_ctrs, void *arb_ctrs, void *fixed_ctrs)
+{
+	sim_get_hash();
+	u->cpu = cpu;
+	u->samples = samples;
+	u->num_cbo_ctrs = num_cbo_ctrs;
+	u->cbo_ctrs = cbo_ctrs;
+	u->results = calloc(num_cbo_ctrs, sizeof(uncore_result_t));
+}
+
+static int sim_in_burst()
+{
+	if(sim_burst_period <= 0.0)
+		return 0;
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	double ms = t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+	return ms - (uint64_t)(ms / sim_burst_period) * sim_burst_period < sim_burst_period * sim_burst_duty;
+}
+
+//Share of the socket's background lookups an event counts: a quarter for each line state in its umask (bits 0-3), and
+//all requests for ANY (bit 7), or a part of them for read, write and external snoop lookups (bits 4-6)
+static double sim_event_share(uint32_t umask)
+{
+	double states = __builtin_popcount(umask & 0xF) / 4.0;
+	double requests = (umask & 0x80) ? 1.0 : ((umask & 0x10) ? 0.5 : 0.0) + ((umask & 0x20) ? 0.3 : 0.0) + ((umask & 0x40) ? 0.2 : 0.0);
+	return states * requests;
+}
+
+//The CBo owning the line sees each flush (a little over 1 per sample), the others only background traffic. A flush
+//is modelled as a lookup in I by a read or any request, so other events do not see it. Background is 1 per 10 samples
+//for an event counting everything, less for narrower ones, with Poisson-like jitter that grows relative to the count as
+//samples fall. A noisy reading puts a second CBo over 1, which the caller has to throw away, and is as much rarer as
+//the event's background is. arg0 NULL is a read with nothing flushed. During a burst every CBo sees up to one extra
+//lookup per sample, of which the event counts its share.
+void uncore_perfmon_monitor(uncore_perfmon_t *u, void (*fn)(void *, void *), void *arg0, void *arg1)
+{
+	fn(arg0, arg1);
+	int slice = arg0 == NULL ? -1 : slicehash_slice(sim_hash, sim_paddr((uint64_t)arg0));
+	uint32_t umask = u->num_cbo_ctrs > 0 ? u->cbo_ctrs[0].counter.umask : 0x8F;
+	double share = sim_event_share(umask);
+	if(!(umask & 0x08) || !(umask & 0x90))
+		slice = -1;
+	int noisy = sim_noise > 0.0 && rand_r(&sim_seed) < sim_noise * share * RAND_MAX;
+	int burst = sim_in_burst();
+	uint64_t mean = (uint64_t)(u->samples * share / 10);
+	for (int s = 0; s < u->num_cbo_ctrs; ++s)
+	{
+		uint64_t background = mean + rand_r(&sim_seed) % (mean / 10 + (uint64_t)(3 * sqrt(mean)) + 1);
+		if(burst)
+			background += rand_r(&sim_seed) % ((uint64_t)(u->samples * share) + 1);
+		u->results[s].total = background;
+		if(u->cbo_ctrs[s].cbo == slice || (slice >= 0 && noisy && u->cbo_ctrs[s].cbo == (slice + 1) % u->num_cbo_ctrs))
+			u->results[s].total += u->samples;
+	}
+}
+
+void uncore_perfmon_destroy(uncore_perfmon_t *u)
+{
+	free(u->results);
+	u->results = NULL;
+}
@@ -0,0 +1,11 @@
+#include "perf_counters.h"
+
+#ifndef PERF_COUNTERS_UTIL_H
+#define PERF_COUNTERS_UTIL_H
+
+static inline void mfence()
+{
+	asm volatile("mfence");
+}
+
+#endif //PERF_COUNTERS_UTIL_H
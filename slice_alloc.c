@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include "slice_alloc.h"
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGETLB
+	#define MAP_HUGETLB 0x40000 /* arch specific */
+#endif
+
+#define SLICE_ALLOC_PAGE_SIZE (1ULL << 21)
+
+static void slice_pool_push(slice_pool_t *p, int slice, uint64_t granule, uint64_t lines)
+{
+	uint64_t n = p->n_free_runs[slice];
+	//Stacks grow by doubling, they start empty
+	if((n & (n - 1)) == 0)
+		p->free_runs[slice] = realloc(p->free_runs[slice], (n ? n * 2 : 64) * sizeof(slice_run_t));
+	p->free_runs[slice][n].granule = granule;
+	p->free_runs[slice][n].lines = lines;
+	p->n_free_runs[slice]++;
+	p->free_lines[slice] += __builtin_popcountll(lines);
+}
+
+//Splits one hugepage's lines by slice. The inverse hash gives the lines of each slice directly.
+static void slice_pool_partition_page(slice_pool_t *p, uint64_t page, uint64_t *granule_lines)
+{
+	uint64_t granules = p->page_size / SLICE_ALLOC_GRANULE;
+	uint64_t pbase = p->pfn->paddr[page];
+	for (int s = 0; s < p->num_slices; ++s)
+	{
+		memset(granule_lines, 0, granules * sizeof(uint64_t));
+		slicehash_iter_t *it = slicehash_iter_begin(p->hash, pbase, pbase + p->page_size, s);
+		uint64_t pa;
+		while(slicehash_iter_next(it, &pa))
+		{
+			uint64_t offset = pa - pbase;
+			granule_lines[offset / SLICE_ALLOC_GRANULE] |= 1ULL << ((offset % SLICE_ALLOC_GRANULE) / p->cacheline);
+		}
+		slicehash_iter_end(it);
+		for (uint64_t g = 0; g < granules; ++g)
+		{
+			if(granule_lines[g])
+				slice_pool_push(p, s, page * p->page_size + g * SLICE_ALLOC_GRANULE, granule_lines[g]);
+		}
+	}
+}
+
+static slice_pool_t *slice_pool_alloc(const slicehash_t *hash, uint64_t len)
+{
+	if(SLICE_ALLOC_GRANULE / slicehash_cacheline(hash) > 64)
+		return NULL;
+
+	slice_pool_t *p = calloc(1, sizeof(slice_pool_t));
+	p->hash = hash;
+	p->page_size = SLICE_ALLOC_PAGE_SIZE;
+	p->len = (len + p->page_size - 1) & ~(p->page_size - 1);
+	p->cacheline = slicehash_cacheline(hash);
+	p->num_slices = slicehash_num_slices(hash);
+	return p;
+}
+
+//Splits every translated page of the pool by slice
+static slice_pool_t *slice_pool_partition(slice_pool_t *p)
+{
+	p->free_runs = calloc(p->num_slices, sizeof(slice_run_t *));
+	p->n_free_runs = calloc(p->num_slices, sizeof(uint64_t));
+	p->free_lines = calloc(p->num_slices, sizeof(uint64_t));
+	pthread_mutex_init(&p->lock, NULL);
+
+	uint64_t *granule_lines = malloc((p->page_size / SLICE_ALLOC_GRANULE) * sizeof(uint64_t));
+	for (uint64_t page = 0; page < p->pfn->n_pages; ++page)
+	{
+		if(p->pfn->paddr[page] == (uint64_t)-1)
+			continue;
+		slice_pool_partition_page(p, page, granule_lines);
+	}
+	free(granule_lines);
+	return p;
+}
+
+slice_pool_t *slice_pool_init(const slicehash_t *hash, uint64_t len)
+{
+	slice_pool_t *p = slice_pool_alloc(hash, len);
+	if(p == NULL)
+		return NULL;
+	p->mem = mmap(NULL, p->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p->mem == MAP_FAILED)
+	{
+		perror("slice_pool_init()");
+		free(p);
+		return NULL;
+	}
+
+	//Translate once. Every later lookup goes through the index.
+	p->pfn = pfn_index_init(p->mem, p->len, p->page_size);
+	if(p->pfn == NULL)
+	{
+		munmap(p->mem, p->len);
+		free(p);
+		return NULL;
+	}
+	//Partitioning by the slice of untranslated pages would put every line in one slice
+	if(pfn_index_untranslated(p->pfn) != 0)
+	{
+		fprintf(stderr, "slice_pool_init(): pagemap gives no physical addresses, run as root\n");
+		pfn_index_destroy(p->pfn);
+		munmap(p->mem, p->len);
+		free(p);
+		return NULL;
+	}
+	return slice_pool_partition(p);
+}
+
+slice_pool_t *slice_pool_init_file(const slicehash_t *hash, uint64_t len, const char *path, const char *index_path)
+{
+	slice_pool_t *p = slice_pool_alloc(hash, len);
+	if(p == NULL)
+		return NULL;
+	p->frame_pool = frame_pool_open(path, index_path, p->len, p->page_size, 0);
+	if(p->frame_pool == NULL)
+	{
+		perror("slice_pool_init_file()");
+		free(p);
+		return NULL;
+	}
+	p->mem = p->frame_pool->mem;
+	p->pfn = p->frame_pool->pfn;
+	return slice_pool_partition(p);
+}
+
+void slice_pool_destroy(slice_pool_t *p)
+{
+	if(p == NULL)
+		return;
+	for (int s = 0; s < p->num_slices; ++s)
+		free(p->free_runs[s]);
+	free(p->free_runs);
+	free(p->n_free_runs);
+	free(p->free_lines);
+	if(p->frame_pool != NULL)
+	{
+		frame_pool_close(p->frame_pool);
+	}
+	else
+	{
+		pfn_index_destroy(p->pfn);
+		munmap(p->mem, p->len);
+	}
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+slice_buf_t *slice_alloc(slice_pool_t *p, int slice, size_t size)
+{
+	if(slice < 0 || slice >= p->num_slices)
+		return NULL;
+	uint64_t n = (size + p->cacheline - 1) / p->cacheline;
+
+	pthread_mutex_lock(&p->lock);
+	if(p->free_lines[slice] < n)
+	{
+		pthread_mutex_unlock(&p->lock);
+		return NULL;
+	}
+
+	slice_buf_t *b = malloc(sizeof(slice_buf_t));
+	b->slice = slice;
+	b->n_lines = n;
+	b->lines = malloc(n * sizeof(uint8_t *));
+
+	uint64_t taken = 0;
+	while(taken < n)
+	{
+		slice_run_t *run = &p->free_runs[slice][p->n_free_runs[slice] - 1];
+		while(run->lines && taken < n)
+		{
+			int l = __builtin_ctzll(run->lines);
+			run->lines &= run->lines - 1;
+			b->lines[taken++] = &p->mem[run->granule + l * p->cacheline];
+		}
+		//Whatever is left of a split run stays on top of the stack
+		if(run->lines == 0)
+			p->n_free_runs[slice]--;
+	}
+	p->free_lines[slice] -= n;
+	pthread_mutex_unlock(&p->lock);
+	return b;
+}
+
+void slice_free(slice_pool_t *p, slice_buf_t *b)
+{
+	if(b == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	uint64_t i = 0;
+	//Lines from the same granule were handed out together, so merge them back into one run
+	while(i < b->n_lines)
+	{
+		uint64_t offset = b->lines[i] - p->mem;
+		uint64_t granule = offset & ~((uint64_t)SLICE_ALLOC_GRANULE - 1);
+		uint64_t lines = 0;
+		while(i < b->n_lines && (uint64_t)(b->lines[i] - p->mem) - granule < SLICE_ALLOC_GRANULE)
+		{
+			lines |= 1ULL << (((uint64_t)(b->lines[i] - p->mem) - granule) / p->cacheline);
+			i++;
+		}
+		slice_pool_push(p, b->slice, granule, lines);
+	}
+	pthread_mutex_unlock(&p->lock);
+	free(b->lines);
+	free(b);
+}
+
+uint64_t slice_pool_free_lines(slice_pool_t *p, int slice)
+{
+	if(slice < 0 || slice >= p->num_slices)
+		return 0;
+	return p->free_lines[slice];
+}
@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include "helpers.h"
+#include "pfn_index.h"
+#include "slicehash.h"
+#include "frame_pool.h"
+
+#ifndef SLICE_ALLOC_H
+#define SLICE_ALLOC_H
+
+#define SLICE_ALLOC_GRANULE 4096
+
+//Lines of one slice within a 4KB granule of the pool, bit n of lines is line n of the granule
+struct slice_run
+{
+	uint64_t granule;
+	uint64_t lines;
+} typedef slice_run_t;
+
+//Hugepage pool whose cache lines are partitioned by LLC slice
+struct slice_pool
+{
+	uint8_t *mem;
+	uint64_t len;
+	uint64_t page_size;
+	int cacheline;
+	pfn_index_t *pfn;
+	//Set when the pages come from a frame pool, which keeps them for the next process
+	frame_pool_t *frame_pool;
+	const slicehash_t *hash;
+	int num_slices;
+	//Per slice stack of free runs
+	slice_run_t **free_runs;
+	uint64_t *n_free_runs;
+	uint64_t *free_lines;
+	pthread_mutex_t lock;
+} typedef slice_pool_t;
+
+//An allocation: n_lines lines, all in the same slice, which are not contiguous in memory
+struct slice_buf
+{
+	int slice;
+	uint64_t n_lines;
+	uint8_t **lines;
+} typedef slice_buf_t;
+
+//Reserves len bytes of hugepages, translates them once and splits their lines by slice according to hash
+slice_pool_t *slice_pool_init(const slicehash_t *hash, uint64_t len);
+//slice_pool_init() over a frame pool at path (see frame_pool.h), whose saved index spares the translation when the
+//pages are still where an earlier process left them
+slice_pool_t *slice_pool_init_file(const slicehash_t *hash, uint64_t len, const char *path, const char *index_path);
+void slice_pool_destroy(slice_pool_t *p);
+//Allocates at least size bytes of lines in slice, NULL if the slice does not have enough free lines
+slice_buf_t *slice_alloc(slice_pool_t *p, int slice, size_t size);
+void slice_free(slice_pool_t *p, slice_buf_t *b);
+uint64_t slice_pool_free_lines(slice_pool_t *p, int slice);
+
+#endif //SLICE_ALLOC_H
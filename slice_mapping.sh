@@ -11,19 +11,6 @@ find_set_bit()
 	return $COUNT
 }
 
-is_power_of_two()
-{
-	TEMP=$1
-	TEMP=$(($1 & $(($1 - 1))))
-	if [[ $TEMP -eq 0 ]]; then
-		return 1
-	else
-		return 0
-	fi
-}
-
-make get_num_slices
-
 #CPU Cores info
 CORES=$(grep -c ^processor /proc/cpuinfo)
 HT=$(lscpu | grep Thread | awk '{print $4}')
@@ -56,6 +43,41 @@ L2_CACHELINE=$(getconf -a | grep LEVEL2_CACHE_LINESIZE | awk '{print $2}')
 L3_ASSOCIATIVITY=$(getconf -a | grep LEVEL3_CACHE_ASSOC | awk '{print $2}')
 L3_CACHELINE=$(getconf -a | grep LEVEL3_CACHE_LINESIZE | awk '{print $2}')
 
+USAGE="Usage: sudo ./slice_mapping.sh --[view|get] [--save] [--prior] [--shard i/n] [--pool]"
+
+#Options after the mode, in any order:
+#--save keeps the result in ./output
+#--prior tries the hashes saved in ./output (and their close relatives) before the full search
+#--pool keeps the buffer in a hugetlbfs file between runs, so later runs skip reserving, faulting in and translating it.
+#Its huge pages stay in use until the file is deleted: sudo rm /dev/hugepages/slice_mapping_pool
+#--shard i/n measures this host's share of the address bits, merge_shards combines the partials of every host
+SAVE=0
+PRIOR=""
+POOL=""
+SHARD=""
+ARGS=("$@")
+for ((i = 1; i < $#; i++)); do
+	case ${ARGS[$i]} in
+		--save)
+			SAVE=1;;
+		--prior)
+			PRIOR="--prior ./output";;
+		--pool)
+			POOL="--pool /dev/hugepages/slice_mapping_pool";;
+		--shard)
+			i=$((i+1))
+			SHARD=${ARGS[$i]}
+			if [[ -z $SHARD ]]; then
+				echo "$USAGE"
+				exit 1
+			fi;;
+		*)
+			echo "Unknown option ${ARGS[$i]}"
+			echo "$USAGE"
+			exit 1;;
+	esac
+done
+
 if [[ $1 = "--view" ]]; then
 	#Enable huge pages and MSR interacton
 	sudo modprobe msr
@@ -75,29 +97,19 @@ if [[ $1 = "--view" ]]; then
 	#Turn off huge pages
 	echo 0 | sudo tee /proc/sys/vm/nr_hugepages
 elif [[ $1 = "--get" ]]; then
-	#Enable huge pages and MSR interacton
+	#Enable huge pages and MSR interacton. A pool kept from an earlier run already holds its pages.
 	sudo modprobe msr
-	echo 65536 | sudo tee /proc/sys/vm/nr_hugepages
+	if [[ -n $POOL ]] && ! mountpoint -q /dev/hugepages; then
+		sudo mkdir -p /dev/hugepages && sudo mount -t hugetlbfs none /dev/hugepages
+	fi
+	if [[ -z $POOL || ! -e /dev/hugepages/slice_mapping_pool ]]; then
+		echo 65536 | sudo tee /proc/sys/vm/nr_hugepages
+	fi
 	if [[ $(sudo cat /proc/sys/vm/nr_hugepages) -eq 0 ]]; then
 		echo "Could not create hugepages, check system settings. Exiting."
 		exit 0
 	fi
-	SEQ_LEN=1
-	N_SLICES=$(sudo ./get_num_slices)
-	is_power_of_two $N_SLICES
-	if [[ $? -eq 1 ]]; then
-		echo "Sequence length is 1 due to slice power of 2"
-		SEQ_LEN=1
-	else
-		echo "Finding sequence length"
-		#Compile
-		sudo make clean
-		sudo make view_slice_mapping OPS="-DNUM_SEQUENCES=64 -DCORES=$CORES -DHT=$HT -DNUM_THREADS=$NUM_THREADS -DRAM=$RAM -DADDR_BITS=$ADDR_BITS -DUSEHUGEPAGE -DL1D=$L1D -DL1_ASSOCIATIVITY=$L1_ASSOCIATIVITY -DL1_CACHELINE=$L1_CACHELINE -DL2=$L2 -DL2_ASSOCIATIVITY=$L2_ASSOCIATIVITY -DL2_CACHELINE=$L2_CACHELINE -DL3_CACHELINE=$L3_CACHELINE"
-		#Getting SEQ_LEN by parsing view_slice_mapping
-		SEQ_LEN=$(sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./view_slice_mapping | grep "Max Sequence Length:" | awk '{print $4}')
-		echo "Sequence length found: $SEQ_LEN"
-	fi
-
+	#The sequence length is found by get_slice_mapping itself, so it is not given at compile time
 	#Run with every core available
 	#Reduce RAM until we don't fail on allocating memory, starting from 15/16 of total system RAM and reducing this by 1/16 each time until it works
 	RES=1
@@ -105,9 +117,20 @@ elif [[ $1 = "--get" ]]; then
 		#Compile
 		echo "Compiling with $RAM RAM"
 		sudo make clean
-		sudo make get_slice_mapping OPS="-DSEQ_LEN=$SEQ_LEN -DCORES=$CORES -DHT=$HT -DNUM_THREADS=$NUM_THREADS -DRAM=$RAM -DADDR_BITS=$ADDR_BITS -DUSEHUGEPAGE -DL1D=$L1D -DL1_ASSOCIATIVITY=$L1_ASSOCIATIVITY -DL1_CACHELINE=$L1_CACHELINE -DL2=$L2 -DL2_ASSOCIATIVITY=$L2_ASSOCIATIVITY -DL2_CACHELINE=$L2_CACHELINE -DL3_CACHELINE=$L3_CACHELINE"
+		sudo make get_slice_mapping OPS="-DCORES=$CORES -DHT=$HT -DNUM_THREADS=$NUM_THREADS -DRAM=$RAM -DADDR_BITS=$ADDR_BITS -DUSEHUGEPAGE -DL1D=$L1D -DL1_ASSOCIATIVITY=$L1_ASSOCIATIVITY -DL1_CACHELINE=$L1_CACHELINE -DL2=$L2 -DL2_ASSOCIATIVITY=$L2_ASSOCIATIVITY -DL2_CACHELINE=$L2_CACHELINE -DL3_CACHELINE=$L3_CACHELINE"
 		echo
-		if [[ $2 = "--save" ]]; then
+		if [[ -n $SHARD ]]; then
+			MODEL=$(lscpu | grep "Intel" | awk -F "Intel" '{print $2}' | awk -F " " '{print $3}')
+			MODEL=$(printf "%s" $MODEL)
+			mkdir -p ./output/shards
+			OF=$(printf "./output/shards/%s_%s_%s.txt\n" $MODEL ${SHARD/\//of} $(hostname))
+			echo "Saving partial result to $OF"
+			sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./get_slice_mapping $POOL --shard $SHARD --shard-out $OF --model $MODEL
+			RES=$?
+			if [[ $RES -ne 0 ]]; then
+				rm -f $OF
+			fi
+		elif [[ $SAVE -eq 1 ]]; then
 		 	MODEL=$(lscpu | grep "Intel" | awk -F "Intel" '{print $2}' | awk -F " " '{print $3}')
 		 	MODEL=$(printf "%s" $MODEL)
 		 	DATE=$(echo -n $(date +"%s"))
@@ -134,8 +157,8 @@ elif [[ $1 = "--get" ]]; then
 		 	echo "L3 Associativity: $L3_ASSOCIATIVITY" >> $OF
 		 	echo "L3 Cacheline: $L3_CACHELINE" >> $OF
 		 	echo "------------------------------------------------" >> $OF
-		 	#Run the tool
-		 	sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./get_slice_mapping >> $OF
+		 	#Run the tool, phase timings are kept next to the output (even for a failed run)
+		 	sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./get_slice_mapping $PRIOR $POOL --metrics ${OF%.txt}_metrics.json >> $OF
 			RES=$?
 			#Delete the output file if tool failed
 			if [[ $RES -ne 0 ]]; then
@@ -143,7 +166,7 @@ elif [[ $1 = "--get" ]]; then
 			fi
 		else
 			echo
-		 	date &&	sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./get_slice_mapping && date
+		 	date &&	sudo chrt -r 1 sudo taskset -c 0-$(($CORES-1)) ./get_slice_mapping $PRIOR $POOL && date
 			RES=$?
 		fi
 		RAM=$(($RAM/$PORTION))
@@ -158,8 +181,10 @@ elif [[ $1 = "--get" ]]; then
 		RAM=$(($RAM*$PORTION))
 	done
 	echo "Done"
-    #Turn off huge pages
-	echo 0 | sudo tee /proc/sys/vm/nr_hugepages
+	#Turn off huge pages, unless the pool keeps them for the next run
+	if [[ -z $POOL ]]; then
+		echo 0 | sudo tee /proc/sys/vm/nr_hugepages
+	fi
 else
-	echo "Usage: sudo ./slice_mapping.sh --[view|get] [--save]"
+	echo "$USAGE"
 fi
@@ -0,0 +1,360 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Shows how a running process's resident memory is spread over the LLC slices. Every mapping
+// in /proc/<pid>/maps is translated through pagemap in chunks (one pread per chunk rather than
+// a vtop() per page), and every line of each resident page is counted with a saved result.
+// Chunks are shared out between worker threads. With --interval the profile is repeated, so
+// the spread can be followed while the process runs. --pagemap-out saves the translation of the
+// last snapshot for slice_tracesim.
+// sudo ./slice_profile <result file | model> <pid> [--threads n] [--interval s] [--count n] [--top n] [--pagemap-out file]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "helpers.h"
+#include "slicehash.h"
+#include "slice_trace.h"
+
+//Pages translated with one pread and handed to a worker at a time
+#define PROFILE_CHUNK_PAGES 4096
+#define PROFILE_MAX_SLICES 64
+
+struct profile_mapping
+{
+	uint64_t start;
+	uint64_t end;
+	char perms[8];
+	char name[256];
+	uint64_t resident;
+	//Lines per slice, the last entry counts lines outside the hash's address bits
+	uint64_t lines[PROFILE_MAX_SLICES + 1];
+} typedef profile_mapping_t;
+
+struct profile_chunk
+{
+	int mapping;
+	uint64_t first_page;
+	uint64_t n_pages;
+	//Resident pages, kept for --pagemap-out
+	slice_trace_page_t *records;
+	uint64_t n_records;
+} typedef profile_chunk_t;
+
+struct profile
+{
+	slicehash_t *h;
+	int num_slices;
+	int pagemap;
+	profile_mapping_t *maps;
+	int n_maps;
+	profile_chunk_t *chunks;
+	uint64_t n_chunks;
+	uint64_t next_chunk;
+	int keep_records;
+} typedef profile_t;
+
+static double profile_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Reads /proc/<pid>/maps, returns the number of mappings or -1 if the process is gone
+static int profile_read_maps(pid_t pid, profile_mapping_t **maps)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return -1;
+	int n = 0, cap = 0;
+	char *line = NULL;
+	size_t line_len = 0;
+	while(getline(&line, &line_len, f) > 0)
+	{
+		if(n == cap)
+		{
+			cap = cap ? cap * 2 : 256;
+			*maps = realloc(*maps, cap * sizeof(profile_mapping_t));
+		}
+		profile_mapping_t *m = &(*maps)[n];
+		memset(m, 0, sizeof(profile_mapping_t));
+		int name_at = 0;
+		if(sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &m->start, &m->end, m->perms, &name_at) < 3)
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		snprintf(m->name, sizeof(m->name), "%s", name_at > 0 && line[name_at] ? &line[name_at] : "[anon]");
+		n++;
+	}
+	free(line);
+	fclose(f);
+	return n;
+}
+
+static void profile_split(profile_t *p)
+{
+	p->n_chunks = 0;
+	for (int i = 0; i < p->n_maps; ++i)
+		p->n_chunks += ((p->maps[i].end - p->maps[i].start) / 4096 + PROFILE_CHUNK_PAGES - 1) / PROFILE_CHUNK_PAGES;
+	p->chunks = realloc(p->chunks, p->n_chunks * sizeof(profile_chunk_t));
+	uint64_t c = 0;
+	for (int i = 0; i < p->n_maps; ++i)
+	{
+		uint64_t first = p->maps[i].start / 4096, last = p->maps[i].end / 4096;
+		for (uint64_t page = first; page < last; page += PROFILE_CHUNK_PAGES)
+		{
+			p->chunks[c].mapping = i;
+			p->chunks[c].first_page = page;
+			p->chunks[c].n_pages = last - page < PROFILE_CHUNK_PAGES ? last - page : PROFILE_CHUNK_PAGES;
+			p->chunks[c].records = NULL;
+			p->chunks[c].n_records = 0;
+			c++;
+		}
+	}
+	p->next_chunk = 0;
+}
+
+static void *profile_worker(void *arg)
+{
+	profile_t *p = arg;
+	uint64_t *entries = malloc(PROFILE_CHUNK_PAGES * sizeof(uint64_t));
+	uint64_t *pages = malloc(PROFILE_CHUNK_PAGES * sizeof(uint64_t));
+
+	uint64_t c;
+	while((c = __atomic_fetch_add(&p->next_chunk, 1, __ATOMIC_RELAXED)) < p->n_chunks)
+	{
+		profile_chunk_t *chunk = &p->chunks[c];
+		uint64_t lines[PROFILE_MAX_SLICES + 1] = {0};
+		uint64_t resident = 0;
+		//Short reads (e.g. [vsyscall], or a mapping removed since maps was read) leave the rest not resident
+		ssize_t got = pread(p->pagemap, entries, chunk->n_pages * sizeof(uint64_t), chunk->first_page * sizeof(uint64_t));
+		uint64_t n_entries = got > 0 ? got / sizeof(uint64_t) : 0;
+		for (uint64_t i = 0; i < n_entries; ++i)
+		{
+			uint64_t pfn = entries[i] & 0x7fffffffffffff;
+			//A zero PFN is also what readers without CAP_SYS_ADMIN get, which main() has already refused
+			if((entries[i] & PAGEMAP_PRESENT) && pfn != 0)
+				pages[resident++] = pfn << 12;
+		}
+		slicehash_count_pages(p->h, pages, resident, 4096, lines);
+		if(p->keep_records && resident > 0)
+		{
+			chunk->records = malloc(resident * sizeof(slice_trace_page_t));
+			for (uint64_t i = 0, r = 0; i < n_entries; ++i)
+			{
+				uint64_t pfn = entries[i] & 0x7fffffffffffff;
+				if((entries[i] & PAGEMAP_PRESENT) && pfn != 0)
+				{
+					chunk->records[r].vpage = chunk->first_page + i;
+					chunk->records[r].pfn = pfn;
+					r++;
+				}
+			}
+			chunk->n_records = resident;
+		}
+
+		profile_mapping_t *m = &p->maps[chunk->mapping];
+		__atomic_fetch_add(&m->resident, resident, __ATOMIC_RELAXED);
+		for (int s = 0; s <= p->num_slices; ++s)
+		{
+			if(lines[s])
+				__atomic_fetch_add(&m->lines[s], lines[s], __ATOMIC_RELAXED);
+		}
+	}
+	free(entries);
+	free(pages);
+	return NULL;
+}
+
+//Chunks are in address order, so their records already make a sorted snapshot
+static void profile_write_records(profile_t *p, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if(f == NULL)
+	{
+		perror("slice_profile()");
+		exit(1);
+	}
+	for (uint64_t c = 0; c < p->n_chunks; ++c)
+	{
+		fwrite(p->chunks[c].records, sizeof(slice_trace_page_t), p->chunks[c].n_records, f);
+		free(p->chunks[c].records);
+		p->chunks[c].records = NULL;
+	}
+	fclose(f);
+}
+
+static int profile_compare_resident(const void *a, const void *b)
+{
+	const profile_mapping_t *ma = a, *mb = b;
+	return (ma->resident < mb->resident) - (ma->resident > mb->resident);
+}
+
+//Largest slice share over the mean share, 1.0 is an even spread
+static double profile_imbalance(const uint64_t *lines, int num_slices)
+{
+	uint64_t total = 0, max = 0;
+	for (int s = 0; s < num_slices; ++s)
+	{
+		total += lines[s];
+		if(lines[s] > max)
+			max = lines[s];
+	}
+	return total ? (double)max * num_slices / total : 0.0;
+}
+
+static void profile_print(profile_t *p, pid_t pid, int snapshot, double seconds, int threads, int top)
+{
+	uint64_t lines[PROFILE_MAX_SLICES + 1] = {0};
+	uint64_t resident = 0, total = 0;
+	for (int i = 0; i < p->n_maps; ++i)
+	{
+		resident += p->maps[i].resident;
+		for (int s = 0; s <= p->num_slices; ++s)
+			lines[s] += p->maps[i].lines[s];
+	}
+	for (int s = 0; s < p->num_slices; ++s)
+		total += lines[s];
+
+	printf("Snapshot %d | pid %d | %.2f MB resident in %d mappings | %.3f s with %d threads\n",
+		snapshot, pid, resident * 4096.0 / (1 << 20), p->n_maps, seconds, threads);
+	printf("Slice %14s %8s\n", "Lines", "Share");
+	for (int s = 0; s < p->num_slices; ++s)
+		printf("%5d %14lu %7.2f%%\n", s, lines[s], total ? 100.0 * lines[s] / total : 0.0);
+	if(lines[p->num_slices])
+		printf("Lines past the hash's address bits: %lu\n", lines[p->num_slices]);
+	printf("Imbalance (largest share / mean share): %.3f\n\n", profile_imbalance(lines, p->num_slices));
+
+	qsort(p->maps, p->n_maps, sizeof(profile_mapping_t), profile_compare_resident);
+	printf("%-33s %5s %10s %6s", "Mapping", "Perms", "Resident", "Imbal");
+	for (int s = 0; s < p->num_slices; ++s)
+		printf("  s%-4d", s);
+	printf("  Name\n");
+	for (int i = 0; i < p->n_maps && i < top && p->maps[i].resident > 0; ++i)
+	{
+		profile_mapping_t *m = &p->maps[i];
+		uint64_t m_total = 0;
+		for (int s = 0; s < p->num_slices; ++s)
+			m_total += m->lines[s];
+		printf("%016lx-%016lx %5s %8.2fMB %6.3f", m->start, m->end, m->perms, m->resident * 4096.0 / (1 << 20),
+			profile_imbalance(m->lines, p->num_slices));
+		for (int s = 0; s < p->num_slices; ++s)
+			printf(" %5.1f%%", m_total ? 100.0 * m->lines[s] / m_total : 0.0);
+		printf("  %s\n", m->name);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 3)
+	{
+		printf("Usage: %s <result file | model> <pid> [--threads n] [--interval s] [--count n] [--top n] [--pagemap-out file]\n", argv[0]);
+		return 1;
+	}
+	profile_t p = {0};
+	p.h = slicehash_load(argv[1]);
+	if(p.h == NULL)
+		p.h = slicehash_load_db("output", argv[1]);
+	if(p.h == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	p.num_slices = slicehash_num_slices(p.h);
+	if(p.num_slices > PROFILE_MAX_SLICES || slicehash_cacheline(p.h) > 4096)
+	{
+		printf("Unsupported hash (%d slices, %d byte lines)\n", p.num_slices, slicehash_cacheline(p.h));
+		return 1;
+	}
+	pid_t pid = atoi(argv[2]);
+
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double interval = 0.0;
+	int count = 1, top = 20;
+	const char *records_path = NULL;
+	for (int i = 3; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--threads") == 0)
+			threads = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--interval") == 0)
+			interval = atof(argv[i + 1]);
+		else if(strcmp(argv[i], "--count") == 0)
+			count = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--top") == 0)
+			top = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--pagemap-out") == 0)
+			records_path = argv[i + 1];
+		else
+		{
+			printf("Usage: %s <result file | model> <pid> [--threads n] [--interval s] [--count n] [--top n] [--pagemap-out file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(threads < 1)
+		threads = 1;
+	//Without an interval there is only one snapshot to take
+	if(interval <= 0.0)
+		count = 1;
+
+	p.pagemap = pagemap_open(pid);
+	if(p.pagemap < 0)
+	{
+		perror("slice_profile()");
+		exit(1);
+	}
+	//Unprivileged readers get every PFN hidden, check before spending time on a profile of nothing
+	uint64_t probe = (uint64_t)&p, probe_paddr;
+	int self = pagemap_open(getpid());
+	pagemap_translate(self, &probe, &probe_paddr, 1);
+	close(self);
+	if(probe_paddr == (uint64_t)-1)
+	{
+		printf("pagemap gives no physical addresses, run as root\n");
+		return 1;
+	}
+
+	p.keep_records = records_path != NULL;
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	for (int snapshot = 1; count <= 0 || snapshot <= count; ++snapshot)
+	{
+		double start = profile_now();
+		p.n_maps = profile_read_maps(pid, &p.maps);
+		if(p.n_maps < 0)
+		{
+			printf("pid %d has exited\n", pid);
+			break;
+		}
+		profile_split(&p);
+		for (int t = 0; t < threads; ++t)
+		{
+			if(pthread_create(&workers[t], NULL, profile_worker, &p) != 0)
+			{
+				perror("slice_profile()");
+				exit(1);
+			}
+		}
+		for (int t = 0; t < threads; ++t)
+			pthread_join(workers[t], NULL);
+		double seconds = profile_now() - start;
+		if(records_path != NULL)
+			profile_write_records(&p, records_path);
+		profile_print(&p, pid, snapshot, seconds, threads, top);
+		fflush(stdout);
+
+		if(count <= 0 || snapshot < count)
+		{
+			double wait = interval - (profile_now() - start);
+			if(wait > 0.0)
+				usleep((useconds_t)(wait * 1e6));
+		}
+	}
+
+	free(workers);
+	free(p.maps);
+	free(p.chunks);
+	close(p.pagemap);
+	slicehash_destroy(p.h);
+	return 0;
+}
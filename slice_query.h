@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SLICE_QUERY_H
+#define SLICE_QUERY_H
+
+//Protocol and client library for slice_queryd, which answers slice queries for unprivileged processes.
+//Requests go over a SOCK_SEQPACKET Unix socket. Small batches are sent inline in the request, bulk batches
+//are written straight into a shared memory ring the client hands to the daemon, and only the slot number
+//goes over the socket. The daemon translates virtual addresses with the pagemap of the connecting process
+//(taken from the socket credentials and pinned with a pidfd), so a client can only ever learn about its own pages.
+
+#define SLICE_QUERY_SOCKET "/tmp/slice_queryd.sock"
+#define SLICE_QUERY_MAGIC 0x534c4351
+#define SLICE_QUERY_INLINE_MAX 32
+#define SLICE_QUERY_DEFAULT_SLOTS 8
+#define SLICE_QUERY_DEFAULT_SLOT_ENTRIES 4096
+//Largest ring the daemon will map, 64 slots of 1M entries is 640MB
+#define SLICE_QUERY_MAX_SLOTS 64
+#define SLICE_QUERY_MAX_SLOT_ENTRIES (1U << 20)
+//Clients served at once, one thread each. Further connections are closed until one leaves.
+#define SLICE_QUERY_MAX_CLIENTS 64
+
+enum slice_query_op
+{
+	SLICE_QUERY_ATTACH, //Ring fd is passed with SCM_RIGHTS
+	SLICE_QUERY_INLINE, //Addresses are in the request, slices in the response
+	SLICE_QUERY_RING    //Addresses and slices are in a ring slot
+};
+
+enum slice_query_type
+{
+	SLICE_QUERY_VIRT,
+	SLICE_QUERY_PHYS
+};
+
+struct slice_query_req
+{
+	uint32_t op;
+	uint32_t type;
+	uint32_t slot;
+	uint32_t count;
+	uint64_t addrs[SLICE_QUERY_INLINE_MAX];
+} typedef slice_query_req_t;
+
+//status is 0 on success, otherwise a negative errno
+struct slice_query_resp
+{
+	int32_t status;
+	uint32_t slot;
+	uint32_t count;
+	int16_t slices[SLICE_QUERY_INLINE_MAX];
+} typedef slice_query_resp_t;
+
+//The ring starts with this header, followed by slots. Each slot holds slot_entries addresses then slot_entries slices.
+//The ring is a memfd sealed against shrinking and growing, so the daemon can never be left mapping past its end.
+struct slice_query_ring_hdr
+{
+	uint32_t magic;
+	uint32_t slots;
+	uint32_t slot_entries;
+	uint32_t reserved;
+} typedef slice_query_ring_hdr_t;
+
+static inline uint64_t slice_query_slot_size(uint32_t slot_entries)
+{
+	return ((uint64_t)slot_entries * (sizeof(uint64_t) + sizeof(int16_t)) + 63) & ~63ULL;
+}
+
+//Bytes of a ring, 0 if slots or slot_entries is 0 or over the limits
+static inline uint64_t slice_query_ring_size(uint32_t slots, uint32_t slot_entries)
+{
+	uint64_t size;
+	if(slots == 0 || slots > SLICE_QUERY_MAX_SLOTS || slot_entries == 0 || slot_entries > SLICE_QUERY_MAX_SLOT_ENTRIES)
+		return 0;
+	if(__builtin_mul_overflow((uint64_t)slots, slice_query_slot_size(slot_entries), &size) || __builtin_add_overflow(size, 64, &size))
+		return 0;
+	return size;
+}
+
+static inline uint64_t *slice_query_slot_addrs(uint8_t *ring, uint32_t slot)
+{
+	slice_query_ring_hdr_t *hdr = (slice_query_ring_hdr_t *)ring;
+	return (uint64_t *)(ring + 64 + slot * slice_query_slot_size(hdr->slot_entries));
+}
+
+static inline int16_t *slice_query_slot_slices(uint8_t *ring, uint32_t slot)
+{
+	slice_query_ring_hdr_t *hdr = (slice_query_ring_hdr_t *)ring;
+	return (int16_t *)(slice_query_slot_addrs(ring, slot) + hdr->slot_entries);
+}
+
+struct slice_query_client
+{
+	int fd;
+	uint8_t *ring;
+	uint64_t ring_len;
+	uint32_t slots;
+	uint32_t slot_entries;
+} typedef slice_query_client_t;
+
+//Connects to the daemon and attaches a ring of slots * slot_entries entries. socket_path of NULL uses
+//SLICE_QUERY_SOCKET, slots or slot_entries of 0 use the defaults. Returns NULL if the daemon is not running or the
+//ring is over SLICE_QUERY_MAX_SLOTS or SLICE_QUERY_MAX_SLOT_ENTRIES.
+slice_query_client_t *slice_query_connect(const char *socket_path, uint32_t slots, uint32_t slot_entries);
+void slice_query_close(slice_query_client_t *c);
+
+//Slices of n addresses of this process, or n physical addresses. Slices of non resident pages are -1.
+//Batches of up to SLICE_QUERY_INLINE_MAX go inline, larger ones are pipelined through the ring.
+//Returns 0 on success, -1 on error.
+int slice_query_virt(slice_query_client_t *c, const uint64_t *vaddrs, int16_t *slices, uint64_t n);
+int slice_query_phys(slice_query_client_t *c, const uint64_t *paddrs, int16_t *slices, uint64_t n);
+
+//Zero copy interface. Fill slice_query_slot_addrs(c->ring, slot), submit it, and once slice_query_wait()
+//returns that slot its slices are in slice_query_slot_slices(c->ring, slot). Slots complete in submission order.
+int slice_query_submit(slice_query_client_t *c, uint32_t slot, int type, uint32_t count);
+//Returns the completed slot, or -1 on error
+int slice_query_wait(slice_query_client_t *c);
+
+#endif //SLICE_QUERY_H
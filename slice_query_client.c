@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include "slice_query.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int slice_query_send_fd(int sock, slice_query_req_t *req, int fd)
+{
+	struct iovec iov = { .iov_base = req, .iov_len = sizeof(*req) };
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(sock, &msg, 0) == sizeof(*req) ? 0 : -1;
+}
+
+slice_query_client_t *slice_query_connect(const char *socket_path, uint32_t slots, uint32_t slot_entries)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path ? socket_path : SLICE_QUERY_SOCKET, sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+		return NULL;
+	if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(sock);
+		return NULL;
+	}
+
+	slice_query_client_t *c = calloc(1, sizeof(slice_query_client_t));
+	c->fd = sock;
+	c->slots = slots ? slots : SLICE_QUERY_DEFAULT_SLOTS;
+	c->slot_entries = slot_entries ? slot_entries : SLICE_QUERY_DEFAULT_SLOT_ENTRIES;
+	c->ring_len = slice_query_ring_size(c->slots, c->slot_entries);
+
+	//The daemon only maps a ring whose size is sealed
+	int ring_fd = -1;
+	if(c->ring_len == 0)
+		goto fail;
+	ring_fd = memfd_create("slice_query_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(ring_fd < 0 || ftruncate(ring_fd, c->ring_len) < 0 || fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		goto fail;
+	c->ring = mmap(NULL, c->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if(c->ring == MAP_FAILED)
+	{
+		c->ring = NULL;
+		goto fail;
+	}
+	slice_query_ring_hdr_t *hdr = (slice_query_ring_hdr_t *)c->ring;
+	hdr->magic = SLICE_QUERY_MAGIC;
+	hdr->slots = c->slots;
+	hdr->slot_entries = c->slot_entries;
+
+	slice_query_req_t req = { .op = SLICE_QUERY_ATTACH };
+	slice_query_resp_t resp;
+	if(slice_query_send_fd(sock, &req, ring_fd) < 0 || recv(sock, &resp, sizeof(resp), 0) < (ssize_t)offsetof(slice_query_resp_t, slices) || resp.status != 0)
+		goto fail;
+	//The daemon has its own mapping now
+	close(ring_fd);
+	return c;
+
+fail:
+	if(ring_fd >= 0)
+		close(ring_fd);
+	slice_query_close(c);
+	return NULL;
+}
+
+void slice_query_close(slice_query_client_t *c)
+{
+	if(c == NULL)
+		return;
+	if(c->ring)
+		munmap(c->ring, c->ring_len);
+	close(c->fd);
+	free(c);
+}
+
+int slice_query_submit(slice_query_client_t *c, uint32_t slot, int type, uint32_t count)
+{
+	if(slot >= c->slots || count > c->slot_entries)
+		return -1;
+	slice_query_req_t req = { .op = SLICE_QUERY_RING, .type = type, .slot = slot, .count = count };
+	//Only the header is needed for ring requests
+	return send(c->fd, &req, offsetof(slice_query_req_t, addrs), 0) == offsetof(slice_query_req_t, addrs) ? 0 : -1;
+}
+
+int slice_query_wait(slice_query_client_t *c)
+{
+	slice_query_resp_t resp;
+	if(recv(c->fd, &resp, sizeof(resp), 0) < (ssize_t)offsetof(slice_query_resp_t, slices) || resp.status != 0)
+		return -1;
+	return resp.slot;
+}
+
+static int slice_query_inline(slice_query_client_t *c, int type, const uint64_t *addrs, int16_t *slices, uint32_t n)
+{
+	slice_query_req_t req = { .op = SLICE_QUERY_INLINE, .type = type, .count = n };
+	slice_query_resp_t resp;
+	memcpy(req.addrs, addrs, n * sizeof(uint64_t));
+	size_t len = offsetof(slice_query_req_t, addrs) + n * sizeof(uint64_t);
+	if(send(c->fd, &req, len, 0) != (ssize_t)len)
+		return -1;
+	if(recv(c->fd, &resp, sizeof(resp), 0) < (ssize_t)offsetof(slice_query_resp_t, slices) || resp.status != 0)
+		return -1;
+	memcpy(slices, resp.slices, n * sizeof(int16_t));
+	return 0;
+}
+
+//Keeps every slot in flight, a slot is refilled as soon as its previous batch comes back
+static int slice_query_batch(slice_query_client_t *c, int type, const uint64_t *addrs, int16_t *slices, uint64_t n)
+{
+	if(n <= SLICE_QUERY_INLINE_MAX)
+		return slice_query_inline(c, type, addrs, slices, n);
+
+	uint64_t *slot_start = malloc(c->slots * sizeof(uint64_t));
+	uint64_t sent = 0, done = 0;
+	uint32_t next = 0, in_flight = 0;
+	int ret = 0;
+	while(done < n)
+	{
+		while(sent < n && in_flight < c->slots)
+		{
+			uint32_t count = n - sent < c->slot_entries ? n - sent : c->slot_entries;
+			memcpy(slice_query_slot_addrs(c->ring, next), &addrs[sent], count * sizeof(uint64_t));
+			if(slice_query_submit(c, next, type, count) < 0)
+			{
+				ret = -1;
+				goto out;
+			}
+			slot_start[next] = sent;
+			sent += count;
+			next = (next + 1) % c->slots;
+			in_flight++;
+		}
+		int slot = slice_query_wait(c);
+		if(slot < 0)
+		{
+			ret = -1;
+			goto out;
+		}
+		uint64_t start = slot_start[slot];
+		uint64_t count = n - start < c->slot_entries ? n - start : c->slot_entries;
+		memcpy(&slices[start], slice_query_slot_slices(c->ring, slot), count * sizeof(int16_t));
+		done += count;
+		in_flight--;
+	}
+out:
+	free(slot_start);
+	return ret;
+}
+
+int slice_query_virt(slice_query_client_t *c, const uint64_t *vaddrs, int16_t *slices, uint64_t n)
+{
+	return slice_query_batch(c, SLICE_QUERY_VIRT, vaddrs, slices, n);
+}
+
+int slice_query_phys(slice_query_client_t *c, const uint64_t *paddrs, int16_t *slices, uint64_t n)
+{
+	return slice_query_batch(c, SLICE_QUERY_PHYS, paddrs, slices, n);
+}
@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Load generator for slice_queryd. Each thread connects on its own, then sends batches of
+// random addresses back to back for the given time. Virtual queries come from a buffer each
+// thread has touched, so every page is resident. Reports queries/sec and batch latency.
+// ./slice_query_load [threads] [batch] [seconds] [virt|phys] [socket path]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "slice_query.h"
+
+#define LOAD_BUFFER_SIZE (64ULL << 20)
+//Physical queries are spread over this much of the address space
+#define LOAD_PHYS_RANGE (16ULL << 30)
+
+struct load_thread
+{
+	pthread_t thread;
+	int id;
+	uint32_t batch;
+	double seconds;
+	int type;
+	const char *socket_path;
+	//Per batch round trip in ns
+	uint64_t *latency;
+	uint64_t n_batches;
+	uint64_t unresolved;
+	int failed;
+} typedef load_thread_t;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void *load(void *arg)
+{
+	load_thread_t *t = arg;
+	slice_query_client_t *c = slice_query_connect(t->socket_path, 0, 0);
+	if(c == NULL)
+	{
+		t->failed = 1;
+		return NULL;
+	}
+	uint8_t *buf = NULL;
+	if(t->type == SLICE_QUERY_VIRT)
+	{
+		buf = mmap(NULL, LOAD_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if(buf == MAP_FAILED)
+		{
+			t->failed = 1;
+			slice_query_close(c);
+			return NULL;
+		}
+	}
+
+	uint64_t *addrs = malloc(t->batch * sizeof(uint64_t));
+	int16_t *slices = malloc(t->batch * sizeof(int16_t));
+	uint64_t cap = 1 << 16;
+	t->latency = malloc(cap * sizeof(uint64_t));
+	unsigned seed = t->id + 1;
+	double end = now() + t->seconds;
+	while(now() < end)
+	{
+		for (uint32_t i = 0; i < t->batch; ++i)
+		{
+			uint64_t r = ((uint64_t)rand_r(&seed) << 31) ^ rand_r(&seed);
+			addrs[i] = t->type == SLICE_QUERY_VIRT ? (uint64_t)&buf[r % LOAD_BUFFER_SIZE] : r % LOAD_PHYS_RANGE;
+		}
+		struct timespec a, b;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		int ret = t->type == SLICE_QUERY_VIRT ? slice_query_virt(c, addrs, slices, t->batch) : slice_query_phys(c, addrs, slices, t->batch);
+		clock_gettime(CLOCK_MONOTONIC, &b);
+		if(ret < 0)
+		{
+			t->failed = 1;
+			break;
+		}
+		for (uint32_t i = 0; i < t->batch; ++i)
+			t->unresolved += slices[i] < 0;
+		if(t->n_batches == cap)
+		{
+			cap *= 2;
+			t->latency = realloc(t->latency, cap * sizeof(uint64_t));
+		}
+		t->latency[t->n_batches++] = (b.tv_sec - a.tv_sec) * 1000000000ULL + b.tv_nsec - a.tv_nsec;
+	}
+
+	free(addrs);
+	free(slices);
+	if(buf)
+		munmap(buf, LOAD_BUFFER_SIZE);
+	slice_query_close(c);
+	return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 1;
+	uint32_t batch = argc > 2 ? strtoul(argv[2], NULL, 0) : 1024;
+	double seconds = argc > 3 ? atof(argv[3]) : 5;
+	int type = argc > 4 && strcmp(argv[4], "phys") == 0 ? SLICE_QUERY_PHYS : SLICE_QUERY_VIRT;
+	const char *socket_path = argc > 5 ? argv[5] : NULL;
+	if(threads < 1 || batch < 1)
+	{
+		printf("Usage: %s [threads] [batch] [seconds] [virt|phys] [socket path]\n", argv[0]);
+		return 1;
+	}
+
+	load_thread_t *t = calloc(threads, sizeof(load_thread_t));
+	double start = now();
+	for (int i = 0; i < threads; ++i)
+	{
+		t[i].id = i;
+		t[i].batch = batch;
+		t[i].seconds = seconds;
+		t[i].type = type;
+		t[i].socket_path = socket_path;
+		pthread_create(&t[i].thread, NULL, load, &t[i]);
+	}
+	uint64_t n_batches = 0, unresolved = 0;
+	int failed = 0;
+	for (int i = 0; i < threads; ++i)
+	{
+		pthread_join(t[i].thread, NULL);
+		n_batches += t[i].n_batches;
+		unresolved += t[i].unresolved;
+		failed += t[i].failed;
+	}
+	double elapsed = now() - start;
+	if(failed)
+		printf("%d of %d threads could not connect or had a query fail, is slice_queryd running?\n", failed, threads);
+	if(n_batches == 0)
+		return 1;
+
+	uint64_t *latency = malloc(n_batches * sizeof(uint64_t));
+	uint64_t n = 0;
+	for (int i = 0; i < threads; ++i)
+	{
+		memcpy(&latency[n], t[i].latency, t[i].n_batches * sizeof(uint64_t));
+		n += t[i].n_batches;
+		free(t[i].latency);
+	}
+	qsort(latency, n, sizeof(uint64_t), compare_u64);
+
+	uint64_t queries = n_batches * batch;
+	printf("%s queries | %d threads | batch %u | %.1f s\n", type == SLICE_QUERY_VIRT ? "Virtual" : "Physical", threads, batch, elapsed);
+	printf("Queries/sec: %.0f | Batches/sec: %.0f | Unresolved: %lu\n", queries / elapsed, n_batches / elapsed, unresolved);
+	printf("Batch latency (us): p50 %.1f | p99 %.1f | max %.1f\n", latency[n / 2] / 1e3, latency[n * 99 / 100] / 1e3, latency[n - 1] / 1e3);
+
+	free(latency);
+	free(t);
+	return 0;
+}
@@ -0,0 +1,334 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Serves slice queries to unprivileged processes. The hash is loaded once, and every client
+// gets a thread with its own pagemap fd kept open for the life of the connection, so queries
+// never pay for parsing result files or reopening pagemap. At most SLICE_QUERY_MAX_CLIENTS are
+// served at once. See slice_query.h for the protocol.
+// sudo ./slice_queryd <result file | model> [socket path]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "helpers.h"
+#include "slicehash.h"
+#include "slice_query.h"
+
+#ifndef SO_PEERPIDFD
+	#define SO_PEERPIDFD 77 /* Linux 6.5 */
+#endif
+
+struct slice_query_conn
+{
+	int fd;
+	pid_t pid;
+	int pagemap;
+	uint8_t *ring;
+	uint64_t ring_len;
+	//Translation scratch, sized for the largest batch seen
+	uint64_t *paddrs;
+	uint64_t paddrs_len;
+	uint64_t queries;
+} typedef slice_query_conn_t;
+
+static slicehash_t *hash;
+static const char *socket_path = SLICE_QUERY_SOCKET;
+static int clients;
+
+static void handle_signal(int sig)
+{
+	unlink(socket_path);
+	_exit(0);
+}
+
+//Real UID of pid from /proc, -1 if it has gone
+static int64_t proc_uid(pid_t pid)
+{
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return -1;
+	int64_t uid = -1;
+	while(uid < 0 && fgets(line, sizeof(line), f) != NULL)
+		if(sscanf(line, "Uid: %ld", &uid) != 1)
+			uid = -1;
+	fclose(f);
+	return uid;
+}
+
+//pidfd of the process at the other end of fd. The kernel gives it directly from 6.5. Before that it is opened by the
+//PID in cred, which the process may have left for another to reuse, so it is only trusted if the process it names
+//has the client's UID.
+static int peer_pidfd(int fd, struct ucred *cred)
+{
+	int pidfd;
+	socklen_t len = sizeof(pidfd);
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERPIDFD, &pidfd, &len) == 0)
+		return pidfd;
+	pidfd = syscall(SYS_pidfd_open, cred->pid, 0);
+	if(pidfd >= 0 && proc_uid(cred->pid) != (int64_t)cred->uid)
+	{
+		close(pidfd);
+		return -1;
+	}
+	return pidfd;
+}
+
+//pagemap of the client whose pidfd is given, -1 if it cannot be read or the client exited before it was open. The
+//PID could belong to another process by then, whose pages the client must not see.
+static int peer_pagemap(int pidfd, pid_t pid)
+{
+	if(pidfd < 0)
+		return -1;
+	int pagemap = pagemap_open(pid);
+	struct pollfd p = { .fd = pidfd, .events = POLLIN };
+	if(pagemap >= 0 && poll(&p, 1, 0) != 0)
+	{
+		close(pagemap);
+		return -1;
+	}
+	return pagemap;
+}
+
+static int recv_fd(struct msghdr *msg)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+			return fd;
+		}
+	}
+	return -1;
+}
+
+//Maps the client's ring after checking it is sealed at its size and as big as its header claims. An unsealed
+//ring could be truncated under the mapping, and the next access to it would kill the daemon with SIGBUS.
+static int attach_ring(slice_query_conn_t *conn, int ring_fd)
+{
+	struct stat st;
+	if(ring_fd < 0)
+		return -EINVAL;
+	int seals = fcntl(ring_fd, F_GET_SEALS);
+	if(seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW))
+		return -EPERM;
+	if(fstat(ring_fd, &st) < 0 || (uint64_t)st.st_size < 64)
+		return -EINVAL;
+	if(conn->ring)
+		munmap(conn->ring, conn->ring_len);
+	conn->ring_len = st.st_size;
+	conn->ring = mmap(NULL, conn->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if(conn->ring == MAP_FAILED)
+	{
+		conn->ring = NULL;
+		return -errno;
+	}
+	slice_query_ring_hdr_t *hdr = (slice_query_ring_hdr_t *)conn->ring;
+	uint64_t size = slice_query_ring_size(hdr->slots, hdr->slot_entries);
+	if(hdr->magic != SLICE_QUERY_MAGIC || size == 0 || size > conn->ring_len)
+	{
+		munmap(conn->ring, conn->ring_len);
+		conn->ring = NULL;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int answer(slice_query_conn_t *conn, int type, const uint64_t *addrs, int16_t *slices, uint64_t n)
+{
+	if(type == SLICE_QUERY_VIRT && conn->pagemap < 0)
+		return -EACCES;
+	if(type == SLICE_QUERY_PHYS)
+	{
+		slicehash_slice_batch(hash, addrs, slices, n);
+	}
+	else
+	{
+		if(n > conn->paddrs_len)
+		{
+			conn->paddrs = realloc(conn->paddrs, n * sizeof(uint64_t));
+			conn->paddrs_len = n;
+		}
+		//Non resident pages come back as -1, which is out of range for the hash and so gives slice -1
+		pagemap_translate(conn->pagemap, addrs, conn->paddrs, n);
+		slicehash_slice_batch(hash, conn->paddrs, slices, n);
+	}
+	conn->queries += n;
+	return 0;
+}
+
+static void *serve(void *arg)
+{
+	slice_query_conn_t *conn = arg;
+	slice_query_req_t req;
+	slice_query_resp_t resp;
+	char control[CMSG_SPACE(sizeof(int))];
+
+	while(1)
+	{
+		struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+		struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+		ssize_t len = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+		if(len < (ssize_t)offsetof(slice_query_req_t, addrs))
+			break;
+
+		memset(&resp, 0, offsetof(slice_query_resp_t, slices));
+		resp.slot = req.slot;
+		resp.count = req.count;
+		size_t resp_len = offsetof(slice_query_resp_t, slices);
+		if(req.type != SLICE_QUERY_VIRT && req.type != SLICE_QUERY_PHYS)
+			req.op = -1;
+		if(req.op == SLICE_QUERY_ATTACH)
+		{
+			int ring_fd = recv_fd(&msg);
+			resp.status = attach_ring(conn, ring_fd);
+			if(ring_fd >= 0)
+				close(ring_fd);
+		}
+		else if(req.op == SLICE_QUERY_INLINE)
+		{
+			if(req.count > SLICE_QUERY_INLINE_MAX || len < (ssize_t)(offsetof(slice_query_req_t, addrs) + req.count * sizeof(uint64_t)))
+				resp.status = -EINVAL;
+			else
+			{
+				resp.status = answer(conn, req.type, req.addrs, resp.slices, req.count);
+				resp_len += req.count * sizeof(int16_t);
+			}
+		}
+		else if(req.op == SLICE_QUERY_RING)
+		{
+			//Copy the geometry out once, the client can write to the header at any time
+			slice_query_ring_hdr_t hdr;
+			uint64_t size = 0;
+			if(conn->ring)
+			{
+				hdr = *(volatile slice_query_ring_hdr_t *)conn->ring;
+				size = slice_query_ring_size(hdr.slots, hdr.slot_entries);
+			}
+			if(size == 0 || size > conn->ring_len || req.slot >= hdr.slots || req.count > hdr.slot_entries)
+				resp.status = -EINVAL;
+			else
+			{
+				uint64_t *addrs = (uint64_t *)(conn->ring + 64 + req.slot * slice_query_slot_size(hdr.slot_entries));
+				resp.status = answer(conn, req.type, addrs, (int16_t *)(addrs + hdr.slot_entries), req.count);
+			}
+		}
+		else
+			resp.status = -EINVAL;
+
+		if(send(conn->fd, &resp, resp_len, MSG_NOSIGNAL) != (ssize_t)resp_len)
+			break;
+	}
+
+	printf("pid %d disconnected after %lu queries\n", conn->pid, conn->queries);
+	if(conn->ring)
+		munmap(conn->ring, conn->ring_len);
+	if(conn->pagemap >= 0)
+		close(conn->pagemap);
+	close(conn->fd);
+	free(conn->paddrs);
+	free(conn);
+	__atomic_fetch_sub(&clients, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s <result file | model> [socket path]\n", argv[0]);
+		return 1;
+	}
+	hash = slicehash_load(argv[1]);
+	if(hash == NULL)
+		hash = slicehash_load_db("output", argv[1]);
+	if(hash == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	if(argc > 2)
+		socket_path = argv[2];
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		perror("slice_queryd()");
+		exit(1);
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	unlink(socket_path);
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 64) < 0)
+	{
+		perror("slice_queryd()");
+		exit(1);
+	}
+	//Any user may ask, the credentials limit them to their own pages
+	chmod(socket_path, 0666);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	printf("%s | %d slices | listening on %s\n", slicehash_model(hash), slicehash_num_slices(hash), socket_path);
+	while(1)
+	{
+		int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("slice_queryd()");
+			exit(1);
+		}
+		struct ucred cred;
+		socklen_t cred_len = sizeof(cred);
+		if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0)
+		{
+			close(fd);
+			continue;
+		}
+		if(__atomic_load_n(&clients, __ATOMIC_RELAXED) >= SLICE_QUERY_MAX_CLIENTS)
+		{
+			printf("pid %d refused, %d clients connected\n", cred.pid, SLICE_QUERY_MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+
+		slice_query_conn_t *conn = calloc(1, sizeof(slice_query_conn_t));
+		conn->fd = fd;
+		conn->pid = cred.pid;
+		//Physical queries still work if this fails, virtual ones are refused
+		int pidfd = peer_pidfd(fd, &cred);
+		conn->pagemap = peer_pagemap(pidfd, cred.pid);
+		if(pidfd >= 0)
+			close(pidfd);
+		printf("pid %d connected%s\n", conn->pid, conn->pagemap < 0 ? ", no pagemap access" : "");
+
+		pthread_t thread;
+		__atomic_fetch_add(&clients, 1, __ATOMIC_RELAXED);
+		if(pthread_create(&thread, NULL, serve, conn) != 0)
+		{
+			perror("slice_queryd()");
+			__atomic_fetch_sub(&clients, 1, __ATOMIC_RELAXED);
+			close(fd);
+			if(conn->pagemap >= 0)
+				close(conn->pagemap);
+			free(conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+#ifndef SLICE_TRACE_H
+#define SLICE_TRACE_H
+
+//File formats for slice_tracesim, both raw little endian arrays with no header so they can be written by anything.
+//A trace is one uint64_t address per access, in access order. Addresses are physical, unless a pagemap snapshot
+//is given to translate them. A snapshot (as written by slice_profile --pagemap-out) is one slice_trace_page_t
+//per resident 4KB page, sorted by vpage.
+
+struct slice_trace_page
+{
+	//Virtual address >> 12
+	uint64_t vpage;
+	uint64_t pfn;
+} typedef slice_trace_page_t;
+
+#endif //SLICE_TRACE_H
@@ -0,0 +1,370 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Replays an address trace against a saved slice hash and a model of the L3, to see how a
+// data layout would load the slices before deploying it. Each slice has its own LRU sets with
+// the associativity from the result header. The trace is memory mapped and walked in windows:
+// every thread hashes part of a window, then every thread replays the window's accesses for
+// the slices it owns, so each slice sees its accesses in trace order. See slice_trace.h for
+// the trace and pagemap snapshot formats.
+// ./slice_tracesim <result file | model> <trace> [--pagemap snapshot] [--sets n] [--ways n] [--threads n] [--top n]
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "slicehash.h"
+#include "slice_trace.h"
+
+//Accesses hashed and replayed per window
+#define TRACESIM_WINDOW (1 << 22)
+//Sets per slice when not given, 2MB slices of 16 ways and 64 byte lines
+#define TRACESIM_DEFAULT_SETS 2048
+#define TRACESIM_DEFAULT_WAYS 16
+//Slice values for accesses which cannot be hashed
+#define TRACESIM_PAST_BITS -1
+#define TRACESIM_UNTRANSLATED -2
+
+struct tracesim_slice
+{
+	//ways tags per set, most recently used first, 0 is an empty way
+	uint64_t *tags;
+	uint64_t *set_accesses;
+	uint64_t *set_evictions;
+	uint64_t accesses;
+	uint64_t hits;
+	uint64_t evictions;
+} typedef tracesim_slice_t;
+
+struct tracesim
+{
+	slicehash_t *h;
+	int num_slices;
+	int cacheline_bits;
+	uint64_t sets;
+	int ways;
+	int threads;
+	const uint64_t *trace;
+	uint64_t n;
+	uint64_t trace_len;
+	const slice_trace_page_t *snapshot;
+	uint64_t n_pages;
+	uint64_t snapshot_len;
+	//Current window
+	uint64_t *paddrs;
+	int16_t *slices;
+	tracesim_slice_t *state;
+	uint64_t untranslated;
+	uint64_t past_bits;
+	pthread_barrier_t barrier;
+} typedef tracesim_t;
+
+struct tracesim_worker
+{
+	tracesim_t *sim;
+	int id;
+} typedef tracesim_worker_t;
+
+static double tracesim_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const void *tracesim_map(const char *path, uint64_t *len)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror("slice_tracesim()");
+		exit(1);
+	}
+	*len = st.st_size;
+	if(*len == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+	{
+		perror("slice_tracesim()");
+		exit(1);
+	}
+	madvise(p, *len, MADV_SEQUENTIAL);
+	return p;
+}
+
+//Physical address of vaddr from the snapshot, -1 if the page was not resident. hint holds the last page found,
+//which nearby accesses usually share.
+static uint64_t tracesim_translate(tracesim_t *sim, uint64_t vaddr, uint64_t *hint)
+{
+	uint64_t vpage = vaddr >> 12;
+	if(*hint < sim->n_pages && sim->snapshot[*hint].vpage == vpage)
+		return (sim->snapshot[*hint].pfn << 12) | (vaddr & 4095);
+	uint64_t lo = 0, hi = sim->n_pages;
+	while(lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if(sim->snapshot[mid].vpage < vpage)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == sim->n_pages || sim->snapshot[lo].vpage != vpage)
+		return -1;
+	*hint = lo;
+	return (sim->snapshot[lo].pfn << 12) | (vaddr & 4095);
+}
+
+static void tracesim_access(tracesim_t *sim, tracesim_slice_t *s, uint64_t paddr)
+{
+	uint64_t line = paddr >> sim->cacheline_bits;
+	uint64_t set = line & (sim->sets - 1);
+	uint64_t tag = line + 1;
+	uint64_t *ways = &s->tags[set * sim->ways];
+	s->accesses++;
+	s->set_accesses[set]++;
+	int w = 0;
+	while(w < sim->ways - 1 && ways[w] != tag)
+		w++;
+	if(ways[w] == tag)
+		s->hits++;
+	else if(ways[w] != 0)
+	{
+		s->evictions++;
+		s->set_evictions[set]++;
+	}
+	memmove(&ways[1], &ways[0], w * sizeof(uint64_t));
+	ways[0] = tag;
+}
+
+static void *tracesim_worker(void *arg)
+{
+	tracesim_worker_t *worker = arg;
+	tracesim_t *sim = worker->sim;
+	uint64_t untranslated = 0, past_bits = 0, hint = 0;
+
+	for (uint64_t base = 0; base < sim->n; base += TRACESIM_WINDOW)
+	{
+		uint64_t len = sim->n - base < TRACESIM_WINDOW ? sim->n - base : TRACESIM_WINDOW;
+		uint64_t from = len * worker->id / sim->threads, to = len * (worker->id + 1) / sim->threads;
+		for (uint64_t i = from; i < to; ++i)
+			sim->paddrs[i] = sim->snapshot ? tracesim_translate(sim, sim->trace[base + i], &hint) : sim->trace[base + i];
+		slicehash_slice_batch(sim->h, &sim->paddrs[from], &sim->slices[from], to - from);
+		for (uint64_t i = from; i < to; ++i)
+		{
+			if(sim->paddrs[i] == (uint64_t)-1)
+			{
+				sim->slices[i] = TRACESIM_UNTRANSLATED;
+				untranslated++;
+			}
+			else if(sim->slices[i] == TRACESIM_PAST_BITS)
+				past_bits++;
+		}
+		pthread_barrier_wait(&sim->barrier);
+
+		for (uint64_t i = 0; i < len; ++i)
+		{
+			int16_t slice = sim->slices[i];
+			if(slice >= 0 && slice % sim->threads == worker->id)
+				tracesim_access(sim, &sim->state[slice], sim->paddrs[i]);
+		}
+		//The window's pages will not be read again
+		madvise((void *)((uint64_t)&sim->trace[base] & ~4095ULL), len * sizeof(uint64_t), MADV_DONTNEED);
+		pthread_barrier_wait(&sim->barrier);
+	}
+	__atomic_fetch_add(&sim->untranslated, untranslated, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sim->past_bits, past_bits, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+struct tracesim_hot_set
+{
+	int slice;
+	uint64_t set;
+	uint64_t evictions;
+	uint64_t accesses;
+} typedef tracesim_hot_set_t;
+
+static int tracesim_compare_hot(const void *a, const void *b)
+{
+	const tracesim_hot_set_t *ha = a, *hb = b;
+	if(ha->evictions != hb->evictions)
+		return (ha->evictions < hb->evictions) - (ha->evictions > hb->evictions);
+	return (ha->accesses < hb->accesses) - (ha->accesses > hb->accesses);
+}
+
+static void tracesim_print(tracesim_t *sim, double seconds, int top)
+{
+	uint64_t total = 0, max = 0;
+	for (int s = 0; s < sim->num_slices; ++s)
+	{
+		total += sim->state[s].accesses;
+		if(sim->state[s].accesses > max)
+			max = sim->state[s].accesses;
+	}
+	printf("Trace: %lu accesses | Untranslated: %lu | Past address bits: %lu | %.3f s with %d threads\n",
+		sim->n, sim->untranslated, sim->past_bits, seconds, sim->threads);
+	printf("L3 model: %d slices | %lu sets x %d ways per slice | %d byte lines\n\n",
+		sim->num_slices, sim->sets, sim->ways, 1 << sim->cacheline_bits);
+
+	printf("Slice %14s %8s %9s %14s %14s %10s\n", "Accesses", "Share", "Hit rate", "Evictions", "Hottest set", "Accesses");
+	for (int s = 0; s < sim->num_slices; ++s)
+	{
+		tracesim_slice_t *st = &sim->state[s];
+		uint64_t hot = 0;
+		for (uint64_t set = 1; set < sim->sets; ++set)
+		{
+			if(st->set_accesses[set] > st->set_accesses[hot])
+				hot = set;
+		}
+		printf("%5d %14lu %7.2f%% %8.2f%% %14lu %14lu %10lu\n", s, st->accesses, total ? 100.0 * st->accesses / total : 0.0,
+			st->accesses ? 100.0 * st->hits / st->accesses : 0.0, st->evictions, hot, st->set_accesses[hot]);
+	}
+	printf("Load imbalance (busiest slice / mean): %.3f\n\n", total ? (double)max * sim->num_slices / total : 0.0);
+
+	//Sets evicting the most, where lines mapping to the same slice and set are fighting over the ways
+	tracesim_hot_set_t *hot = malloc((top + 1) * sizeof(tracesim_hot_set_t));
+	int n_hot = 0;
+	for (int s = 0; s < sim->num_slices; ++s)
+	{
+		for (uint64_t set = 0; set < sim->sets; ++set)
+		{
+			if(sim->state[s].set_evictions[set] == 0)
+				continue;
+			tracesim_hot_set_t h = {s, set, sim->state[s].set_evictions[set], sim->state[s].set_accesses[set]};
+			if(n_hot == top && tracesim_compare_hot(&h, &hot[top - 1]) >= 0)
+				continue;
+			hot[n_hot < top ? n_hot++ : top - 1] = h;
+			qsort(hot, n_hot, sizeof(tracesim_hot_set_t), tracesim_compare_hot);
+		}
+	}
+	if(n_hot > 0)
+	{
+		printf("Most conflicted sets\n%5s %8s %14s %14s\n", "Slice", "Set", "Evictions", "Accesses");
+		for (int i = 0; i < n_hot; ++i)
+			printf("%5d %8lu %14lu %14lu\n", hot[i].slice, hot[i].set, hot[i].evictions, hot[i].accesses);
+	}
+	free(hot);
+}
+
+int main(int argc, char const *argv[])
+{
+	const char *usage = "Usage: %s <result file | model> <trace> [--pagemap snapshot] [--sets n] [--ways n] [--threads n] [--top n]\n";
+	if(argc < 3)
+	{
+		printf(usage, argv[0]);
+		return 1;
+	}
+	tracesim_t sim = {0};
+	sim.h = slicehash_load(argv[1]);
+	if(sim.h == NULL)
+		sim.h = slicehash_load_db("output", argv[1]);
+	if(sim.h == NULL)
+	{
+		printf("Could not load a slice hash from %s\n", argv[1]);
+		return 1;
+	}
+	sim.num_slices = slicehash_num_slices(sim.h);
+	sim.cacheline_bits = __builtin_ctz(slicehash_cacheline(sim.h));
+	sim.sets = TRACESIM_DEFAULT_SETS;
+	sim.ways = slicehash_l3_associativity(sim.h) > 0 ? slicehash_l3_associativity(sim.h) : TRACESIM_DEFAULT_WAYS;
+	sim.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *snapshot_path = NULL;
+	int top = 10;
+	for (int i = 3; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--pagemap") == 0)
+			snapshot_path = argv[i + 1];
+		else if(strcmp(argv[i], "--sets") == 0)
+			sim.sets = strtoull(argv[i + 1], NULL, 0);
+		else if(strcmp(argv[i], "--ways") == 0)
+			sim.ways = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--threads") == 0)
+			sim.threads = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "--top") == 0)
+			top = atoi(argv[i + 1]);
+		else
+		{
+			printf(usage, argv[0]);
+			return 1;
+		}
+	}
+	if(sim.sets == 0 || (sim.sets & (sim.sets - 1)) != 0 || sim.ways < 1)
+	{
+		printf("Sets must be a power of two and ways at least 1\n");
+		return 1;
+	}
+	//Threads own whole slices, more than one per slice would sit idle
+	if(sim.threads < 1)
+		sim.threads = 1;
+	if(sim.threads > sim.num_slices)
+		sim.threads = sim.num_slices;
+	if(top < 1)
+		top = 1;
+
+	sim.trace = tracesim_map(argv[2], &sim.trace_len);
+	sim.n = sim.trace_len / sizeof(uint64_t);
+	if(snapshot_path != NULL)
+	{
+		sim.snapshot = tracesim_map(snapshot_path, &sim.snapshot_len);
+		sim.n_pages = sim.snapshot_len / sizeof(slice_trace_page_t);
+	}
+
+	sim.paddrs = malloc(TRACESIM_WINDOW * sizeof(uint64_t));
+	sim.slices = malloc(TRACESIM_WINDOW * sizeof(int16_t));
+	sim.state = calloc(sim.num_slices, sizeof(tracesim_slice_t));
+	for (int s = 0; s < sim.num_slices; ++s)
+	{
+		sim.state[s].tags = calloc(sim.sets * sim.ways, sizeof(uint64_t));
+		sim.state[s].set_accesses = calloc(sim.sets, sizeof(uint64_t));
+		sim.state[s].set_evictions = calloc(sim.sets, sizeof(uint64_t));
+	}
+	pthread_barrier_init(&sim.barrier, NULL, sim.threads);
+
+	double start = tracesim_now();
+	pthread_t *threads = malloc(sim.threads * sizeof(pthread_t));
+	tracesim_worker_t *workers = malloc(sim.threads * sizeof(tracesim_worker_t));
+	for (int t = 0; t < sim.threads; ++t)
+	{
+		workers[t].sim = &sim;
+		workers[t].id = t;
+		if(pthread_create(&threads[t], NULL, tracesim_worker, &workers[t]) != 0)
+		{
+			perror("slice_tracesim()");
+			exit(1);
+		}
+	}
+	for (int t = 0; t < sim.threads; ++t)
+		pthread_join(threads[t], NULL);
+	tracesim_print(&sim, tracesim_now() - start, top);
+
+	pthread_barrier_destroy(&sim.barrier);
+	for (int s = 0; s < sim.num_slices; ++s)
+	{
+		free(sim.state[s].tags);
+		free(sim.state[s].set_accesses);
+		free(sim.state[s].set_evictions);
+	}
+	free(sim.state);
+	free(sim.paddrs);
+	free(sim.slices);
+	free(threads);
+	free(workers);
+	if(sim.trace != NULL)
+		munmap((void *)sim.trace, sim.trace_len);
+	if(sim.snapshot != NULL)
+		munmap((void *)sim.snapshot, sim.snapshot_len);
+	slicehash_destroy(sim.h);
+	return 0;
+}
@@ -0,0 +1,592 @@
+#define _GNU_SOURCE
+#include "slicehash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#define SLICEHASH_MAX_BITS 64
+
+struct slicehash
+{
+	int addr_bits;
+	int xor_map[SLICEHASH_MAX_BITS];
+	//Linear form of xor_map, bit i of the sequence ID is the parity of (paddr & mask[i])
+	uint64_t mask[SLICEHASH_MAX_BITS];
+	int mask_bits;
+	//NULL on 2^n slice machines
+	int16_t *master_sequence;
+	uint64_t seq_len;
+	int cacheline;
+	int cacheline_bits;
+	int num_slices;
+	char model[64];
+	int l3_associativity;
+	//Gaussian elimination of each address bit's contribution to v = (sequence offset ^ ID), done in address bit order so
+	//the result for the low k bits is just the entries from bits below k. basis_*[i] has its highest set bit at i.
+	uint64_t v_mask;
+	uint64_t basis_vec[SLICEHASH_MAX_BITS];
+	uint64_t basis_addr[SLICEHASH_MAX_BITS];
+	int basis_from[SLICEHASH_MAX_BITS];
+	//Combinations of address bits which leave v unchanged, ordered by their highest bit
+	uint64_t kernel[SLICEHASH_MAX_BITS];
+	int kernel_from[SLICEHASH_MAX_BITS];
+	int n_kernel;
+	//carry_v[t] is the change in v when the line number is incremented past t trailing ones, v of the t + 1 low
+	//line bits. v is linear, so v(line + 1) = v(line) ^ carry_v[ctz(~line)].
+	uint64_t carry_v[SLICEHASH_MAX_BITS];
+};
+
+struct slicehash_iter
+{
+	const slicehash_t *h;
+	//Remaining range, walked in aligned power of two blocks
+	uint64_t next_block;
+	uint64_t end;
+	uint64_t block;
+	int block_bits;
+	uint64_t block_v;
+	int n_kernel;
+	//Values of v which map to the requested slice
+	uint64_t *targets;
+	int n_targets;
+	int target;
+	//Gray code walk over the solutions for the current block and target
+	uint64_t solution;
+	uint64_t count;
+	uint64_t total;
+};
+
+static int slicehash_log2(uint64_t n)
+{
+	int pos = 0;
+	while(n >>= 1)
+		pos++;
+	return pos;
+}
+
+//Contribution of address bit b to v
+static uint64_t slicehash_column(const slicehash_t *h, int b)
+{
+	uint64_t col = 0;
+	if(b < h->addr_bits && h->xor_map[b] > 0)
+		col = (uint64_t)h->xor_map[b];
+	if(b >= h->cacheline_bits && (1ULL << (b - h->cacheline_bits)) < h->seq_len)
+		col ^= 1ULL << (b - h->cacheline_bits);
+	return col & h->v_mask;
+}
+
+static void slicehash_eliminate(slicehash_t *h)
+{
+	for (int i = 0; i < SLICEHASH_MAX_BITS; ++i)
+		h->basis_from[i] = -1;
+	h->n_kernel = 0;
+	for (int b = h->cacheline_bits; b < h->addr_bits; ++b)
+	{
+		uint64_t vec = slicehash_column(h, b);
+		uint64_t addr = 1ULL << b;
+		for (int i = SLICEHASH_MAX_BITS-1; i >= 0 && vec != 0; --i)
+		{
+			if(!((vec >> i) & 1))
+				continue;
+			if(h->basis_from[i] == -1)
+			{
+				h->basis_vec[i] = vec;
+				h->basis_addr[i] = addr;
+				h->basis_from[i] = b;
+				vec = 0;
+				addr = 0;
+				break;
+			}
+			vec ^= h->basis_vec[i];
+			addr ^= h->basis_addr[i];
+		}
+		if(addr != 0)
+		{
+			h->kernel[h->n_kernel] = addr;
+			h->kernel_from[h->n_kernel] = b;
+			h->n_kernel++;
+		}
+	}
+}
+
+slicehash_t *slicehash_create(const int *xor_map, int addr_bits, const int16_t *master_sequence, uint64_t seq_len, int cacheline)
+{
+	if(xor_map == NULL || addr_bits <= 0 || addr_bits > SLICEHASH_MAX_BITS || cacheline <= 0)
+		return NULL;
+	if(master_sequence != NULL && (seq_len == 0 || (seq_len & (seq_len - 1)) != 0))
+		return NULL;
+
+	slicehash_t *h = calloc(1, sizeof(slicehash_t));
+	h->addr_bits = addr_bits;
+	h->cacheline = cacheline;
+	h->cacheline_bits = slicehash_log2(cacheline);
+	h->seq_len = master_sequence != NULL ? seq_len : 1;
+
+	int max_id = 0;
+	for (int b = 0; b < addr_bits; ++b)
+	{
+		h->xor_map[b] = xor_map[b];
+		if(xor_map[b] > max_id)
+			max_id = xor_map[b];
+	}
+	h->mask_bits = slicehash_log2(max_id) + 1;
+	for (int i = 0; i < h->mask_bits; ++i)
+	{
+		for (int b = 0; b < addr_bits; ++b)
+		{
+			if(xor_map[b] > 0 && (xor_map[b] & (1 << i)))
+				h->mask[i] |= (1ULL << b);
+		}
+	}
+
+	if(master_sequence != NULL)
+	{
+		h->master_sequence = malloc(seq_len * sizeof(int16_t));
+		memcpy(h->master_sequence, master_sequence, seq_len * sizeof(int16_t));
+		for (uint64_t i = 0; i < seq_len; ++i)
+		{
+			if(master_sequence[i] + 1 > h->num_slices)
+				h->num_slices = master_sequence[i] + 1;
+		}
+	}
+	else
+	{
+		h->num_slices = 1 << h->mask_bits;
+	}
+	h->v_mask = master_sequence != NULL ? seq_len - 1 : ~0ULL;
+	slicehash_eliminate(h);
+	for (int t = 0; t < SLICEHASH_MAX_BITS; ++t)
+	{
+		uint64_t flipped = t + 1 + h->cacheline_bits >= 64 ? ~0ULL << h->cacheline_bits : ((2ULL << t) - 1) << h->cacheline_bits;
+		for (int b = h->cacheline_bits; b < 64; ++b)
+		{
+			if((flipped >> b) & 1)
+				h->carry_v[t] ^= slicehash_column(h, b);
+		}
+	}
+	return h;
+}
+
+void slicehash_destroy(slicehash_t *h)
+{
+	if(h == NULL)
+		return;
+	free(h->master_sequence);
+	free(h);
+}
+
+//Parses "{a, b, c};" following the first '{' in line into vals, returns the count parsed
+static int parse_int_list(const char *line, int *vals, int max)
+{
+	const char *p = strchr(line, '{');
+	int n = 0;
+	if(p == NULL)
+		return 0;
+	p++;
+	while(n < max)
+	{
+		char *end;
+		long v = strtol(p, &end, 0);
+		if(end == p)
+			break;
+		vals[n++] = (int)v;
+		p = end;
+		while(*p == ' ' || *p == ',')
+			p++;
+		if(*p == '}')
+			break;
+	}
+	return n;
+}
+
+slicehash_t *slicehash_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return NULL;
+
+	char *line = NULL;
+	size_t line_len = 0;
+	int xor_map[SLICEHASH_MAX_BITS];
+	int addr_bits = 0;
+	int *seq = NULL;
+	int seq_count = 0;
+	uint64_t seq_len = 1;
+	int cacheline = 64;
+	int l3_associativity = 0;
+	int want_sequence_line = 0;
+	char model[64] = "";
+
+	while(getline(&line, &line_len, f) != -1)
+	{
+		int n;
+		if(want_sequence_line)
+		{
+			//Older results only print the master sequence as digits grouped by 4
+			want_sequence_line = 0;
+			if(seq == NULL && seq_len > 1)
+			{
+				seq = malloc(seq_len * sizeof(int));
+				for (char *c = line; *c != '\0' && seq_count < (int)seq_len; ++c)
+				{
+					if(*c >= '0' && *c <= '9')
+						seq[seq_count++] = *c - '0';
+				}
+			}
+		}
+		else if(sscanf(line, "Model: %63s", model) == 1)
+			continue;
+		else if(sscanf(line, "L3 Associativity: %d", &n) == 1)
+			l3_associativity = n;
+		else if(sscanf(line, "L3 Cacheline: %d", &n) == 1)
+			cacheline = n;
+		else if(sscanf(line, "Sequence length is %d cache lines", &n) == 1)
+			seq_len = (uint64_t)n;
+		else if(addr_bits == 0 && sscanf(line, "int xor_map[%d]", &n) == 1 && n <= SLICEHASH_MAX_BITS)
+			addr_bits = parse_int_list(line, xor_map, n);
+		else if(sscanf(line, "int master_sequence[%d]", &n) == 1 && n > 0)
+		{
+			free(seq);
+			seq = malloc(n * sizeof(int));
+			seq_count = parse_int_list(line, seq, n);
+		}
+		else if(strncmp(line, "Master Sequence: ", 17) == 0)
+			want_sequence_line = 1;
+	}
+	free(line);
+	fclose(f);
+
+	slicehash_t *h = NULL;
+	if(addr_bits > 0)
+	{
+		if(seq_len > 1 && seq != NULL && seq_count == (int)seq_len)
+		{
+			int16_t *ms = malloc(seq_len * sizeof(int16_t));
+			for (uint64_t i = 0; i < seq_len; ++i)
+				ms[i] = (int16_t)seq[i];
+			h = slicehash_create(xor_map, addr_bits, ms, seq_len, cacheline);
+			free(ms);
+		}
+		else if(seq_len == 1)
+		{
+			h = slicehash_create(xor_map, addr_bits, NULL, 1, cacheline);
+		}
+	}
+	if(h != NULL)
+	{
+		snprintf(h->model, sizeof(h->model), "%s", model);
+		h->l3_associativity = l3_associativity;
+	}
+	free(seq);
+	return h;
+}
+
+slicehash_t *slicehash_load_db(const char *dir, const char *model)
+{
+	if(dir == NULL || model == NULL)
+		return NULL;
+	DIR *d = opendir(dir);
+	if(d == NULL)
+		return NULL;
+
+	//Result files are named <model>_<unix time>.txt, take the newest
+	struct dirent *e;
+	long newest = -1;
+	char best[4096] = "";
+	size_t model_len = strlen(model);
+	while((e = readdir(d)) != NULL)
+	{
+		long t;
+		if(strncmp(e->d_name, model, model_len) != 0 || e->d_name[model_len] != '_')
+			continue;
+		if(sscanf(e->d_name + model_len + 1, "%ld.txt", &t) == 1 && t > newest)
+		{
+			newest = t;
+			snprintf(best, sizeof(best), "%s/%s", dir, e->d_name);
+		}
+	}
+	closedir(d);
+	if(newest < 0)
+		return NULL;
+	return slicehash_load(best);
+}
+
+static inline int slicehash_slice_of(const slicehash_t *h, uint64_t paddr)
+{
+	if(h->addr_bits < 64 && (paddr >> h->addr_bits) > 0)
+		return -1;
+	uint64_t id = 0;
+	for (int i = 0; i < h->mask_bits; ++i)
+		id |= (uint64_t)__builtin_parityll(paddr & h->mask[i]) << i;
+	if(h->master_sequence == NULL)
+		return (int)id;
+	uint64_t sequence_offset = (paddr >> h->cacheline_bits) & (h->seq_len - 1);
+	return h->master_sequence[(sequence_offset ^ id) & (h->seq_len - 1)];
+}
+
+int slicehash_slice(const slicehash_t *h, uint64_t paddr)
+{
+	return slicehash_slice_of(h, paddr);
+}
+
+#define SLICEHASH_BATCH 64
+
+//Evaluates one mask over a block of addresses at a time, so the inner loop has no dependency between addresses
+void slicehash_slice_batch(const slicehash_t *h, const uint64_t *paddrs, int16_t *slices, size_t n)
+{
+	uint64_t id[SLICEHASH_BATCH];
+	uint64_t high_mask = h->addr_bits < 64 ? ~0ULL << h->addr_bits : 0;
+	uint64_t seq_mask = h->seq_len - 1;
+
+	for (size_t base = 0; base < n; base += SLICEHASH_BATCH)
+	{
+		size_t count = n - base < SLICEHASH_BATCH ? n - base : SLICEHASH_BATCH;
+		const uint64_t *pa = &paddrs[base];
+		for (size_t i = 0; i < count; ++i)
+			id[i] = 0;
+		for (int m = 0; m < h->mask_bits; ++m)
+		{
+			uint64_t mask = h->mask[m];
+			for (size_t i = 0; i < count; ++i)
+				id[i] |= (uint64_t)__builtin_parityll(pa[i] & mask) << m;
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			if(pa[i] & high_mask)
+				slices[base + i] = -1;
+			else if(h->master_sequence == NULL)
+				slices[base + i] = (int16_t)id[i];
+			else
+				slices[base + i] = h->master_sequence[(((pa[i] >> h->cacheline_bits) & seq_mask) ^ id[i]) & seq_mask];
+		}
+	}
+}
+
+//v of a line, the master sequence index (or slice on 2^n machines) before the table lookup
+static inline uint64_t slicehash_v(const slicehash_t *h, uint64_t paddr)
+{
+	uint64_t id = 0;
+	for (int i = 0; i < h->mask_bits; ++i)
+		id |= (uint64_t)__builtin_parityll(paddr & h->mask[i]) << i;
+	return (((paddr >> h->cacheline_bits) & (h->seq_len - 1)) ^ id) & h->v_mask;
+}
+
+void slicehash_slice_range(const slicehash_t *h, uint64_t pa, uint64_t len, int16_t *slices)
+{
+	uint64_t line = pa >> h->cacheline_bits;
+	uint64_t n = len >> h->cacheline_bits;
+	//Lines from the hash's address limit on have no slice
+	uint64_t in_range = n;
+	if(h->addr_bits < 64)
+	{
+		uint64_t limit = 1ULL << (h->addr_bits - h->cacheline_bits);
+		in_range = line >= limit ? 0 : (limit - line < n ? limit - line : n);
+	}
+	uint64_t v = slicehash_v(h, pa);
+	if(h->master_sequence != NULL)
+	{
+		for (uint64_t i = 0; i < in_range; ++i)
+		{
+			slices[i] = h->master_sequence[v];
+			v ^= h->carry_v[__builtin_ctzll(~(line + i))];
+		}
+	}
+	else
+	{
+		for (uint64_t i = 0; i < in_range; ++i)
+		{
+			slices[i] = (int16_t)v;
+			v ^= h->carry_v[__builtin_ctzll(~(line + i))];
+		}
+	}
+	for (uint64_t i = in_range; i < n; ++i)
+		slices[i] = -1;
+}
+
+//v is linear in the address, so for a page aligned base v(base + offset) = v(base) ^ v(offset). The lines of a
+//page are counted by looking up each distinct v(offset) once per page, rather than hashing every line.
+void slicehash_count_pages(const slicehash_t *h, const uint64_t *pages, size_t n, uint64_t page_size, uint64_t *counts)
+{
+	uint64_t lines = page_size / h->cacheline;
+	uint64_t n_v = h->master_sequence != NULL ? h->seq_len : 1ULL << h->mask_bits;
+	uint64_t *per_v = calloc(n_v, sizeof(uint64_t));
+	uint64_t *offset_v = malloc(n_v * sizeof(uint64_t));
+	uint64_t *offset_count = malloc(n_v * sizeof(uint64_t));
+	for (uint64_t l = 0; l < lines; ++l)
+		per_v[slicehash_v(h, l * h->cacheline)]++;
+	uint64_t distinct = 0;
+	for (uint64_t v = 0; v < n_v; ++v)
+	{
+		if(per_v[v] == 0)
+			continue;
+		offset_v[distinct] = v;
+		offset_count[distinct] = per_v[v];
+		distinct++;
+	}
+
+	uint64_t high_mask = h->addr_bits < 64 ? ~0ULL << h->addr_bits : 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		if(pages[i] & high_mask)
+		{
+			counts[h->num_slices] += lines;
+			continue;
+		}
+		uint64_t base_v = slicehash_v(h, pages[i]);
+		for (uint64_t d = 0; d < distinct; ++d)
+		{
+			uint64_t v = base_v ^ offset_v[d];
+			counts[h->master_sequence != NULL ? h->master_sequence[v] : (int)v] += offset_count[d];
+		}
+	}
+	free(per_v);
+	free(offset_v);
+	free(offset_count);
+}
+
+slicehash_iter_t *slicehash_iter_begin(const slicehash_t *h, uint64_t start, uint64_t end, int slice)
+{
+	slicehash_iter_t *it = calloc(1, sizeof(slicehash_iter_t));
+	uint64_t line_mask = (uint64_t)h->cacheline - 1;
+	it->h = h;
+	it->next_block = (start + line_mask) & ~line_mask;
+	//Every line starting before end is in the range, so an unaligned end rounds up
+	it->end = end > UINT64_MAX - line_mask ? ~line_mask : (end + line_mask) & ~line_mask;
+	if(h->addr_bits < 64 && it->end > (1ULL << h->addr_bits))
+		it->end = 1ULL << h->addr_bits;
+	it->targets = malloc(h->seq_len * sizeof(uint64_t));
+	if(h->master_sequence != NULL)
+	{
+		for (uint64_t v = 0; v < h->seq_len; ++v)
+		{
+			if(h->master_sequence[v] == slice)
+				it->targets[it->n_targets++] = v;
+		}
+	}
+	else if(slice >= 0 && slice < h->num_slices)
+	{
+		it->targets[it->n_targets++] = (uint64_t)slice;
+	}
+	it->target = it->n_targets;
+	return it;
+}
+
+//Finds a line in the current block whose v is the current target, by back substitution through the basis
+//entries from the block's free bits. Returns 0 if no line in the block has that v.
+static int slicehash_iter_solve(slicehash_iter_t *it)
+{
+	const slicehash_t *h = it->h;
+	uint64_t r = it->targets[it->target] ^ it->block_v;
+	uint64_t addr = 0;
+	for (int i = SLICEHASH_MAX_BITS-1; i >= 0 && r != 0; --i)
+	{
+		if(((r >> i) & 1) && h->basis_from[i] != -1 && h->basis_from[i] < it->block_bits)
+		{
+			r ^= h->basis_vec[i];
+			addr ^= h->basis_addr[i];
+		}
+	}
+	if(r != 0)
+		return 0;
+	it->solution = addr;
+	it->count = 0;
+	it->total = 1ULL << it->n_kernel;
+	return 1;
+}
+
+int slicehash_iter_next(slicehash_iter_t *it, uint64_t *paddr)
+{
+	const slicehash_t *h = it->h;
+	while(1)
+	{
+		if(it->count < it->total)
+		{
+			if(it->count > 0)
+				it->solution ^= h->kernel[__builtin_ctzll(it->count)];
+			it->count++;
+			*paddr = it->block | it->solution;
+			return 1;
+		}
+		it->count = it->total = 0;
+		if(++it->target < it->n_targets)
+		{
+			slicehash_iter_solve(it);
+			continue;
+		}
+		if(it->next_block >= it->end || it->n_targets == 0)
+			return 0;
+
+		//Largest aligned block starting here which fits in the range
+		int k = it->next_block == 0 ? 63 : __builtin_ctzll(it->next_block);
+		while(k > h->cacheline_bits && (k >= 64 || it->next_block + (1ULL << k) > it->end || it->next_block + (1ULL << k) < it->next_block))
+			k--;
+		it->block = it->next_block;
+		it->block_bits = k;
+		it->block_v = slicehash_v(h, it->block);
+		it->n_kernel = 0;
+		while(it->n_kernel < h->n_kernel && h->kernel_from[it->n_kernel] < k)
+			it->n_kernel++;
+		it->next_block += 1ULL << k;
+		it->target = -1;
+	}
+}
+
+void slicehash_iter_end(slicehash_iter_t *it)
+{
+	if(it == NULL)
+		return;
+	free(it->targets);
+	free(it);
+}
+
+size_t slicehash_find(const slicehash_t *h, uint64_t start, uint64_t end, int slice, uint64_t *out, size_t max)
+{
+	size_t found = 0;
+	slicehash_iter_t *it = slicehash_iter_begin(h, start, end, slice);
+	while(found < max && slicehash_iter_next(it, &out[found]))
+		found++;
+	slicehash_iter_end(it);
+	return found;
+}
+
+int slicehash_num_slices(const slicehash_t *h)
+{
+	return h->num_slices;
+}
+
+int slicehash_addr_bits(const slicehash_t *h)
+{
+	return h->addr_bits;
+}
+
+int slicehash_cacheline(const slicehash_t *h)
+{
+	return h->cacheline;
+}
+
+uint64_t slicehash_seq_len(const slicehash_t *h)
+{
+	return h->seq_len;
+}
+
+const int *slicehash_xor_map(const slicehash_t *h)
+{
+	return h->xor_map;
+}
+
+const int16_t *slicehash_master_sequence(const slicehash_t *h)
+{
+	return h->master_sequence;
+}
+
+const char *slicehash_model(const slicehash_t *h)
+{
+	return h->model;
+}
+
+int slicehash_l3_associativity(const slicehash_t *h)
+{
+	return h->l3_associativity;
+}
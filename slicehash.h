@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SLICEHASH_H
+#define SLICEHASH_H
+
+//Standalone slice hash evaluation for a recovered hash function.
+//Does not need perfcounters, root or any of the compile time machine info, so it can be linked into
+//anything which needs to know the slice of a physical address (link with -lslicehash).
+
+typedef struct slicehash slicehash_t;
+typedef struct slicehash_iter slicehash_iter_t;
+
+//Builds a hash from an xor_map of addr_bits entries. master_sequence is NULL on 2^n slice machines, otherwise
+//it holds seq_len entries. cacheline is the L3 cacheline size in bytes.
+slicehash_t *slicehash_create(const int *xor_map, int addr_bits, const int16_t *master_sequence, uint64_t seq_len, int cacheline);
+//Loads a hash from a get_slice_mapping result file, as saved by slice_mapping.sh --get --save
+slicehash_t *slicehash_load(const char *path);
+//Loads the most recent result for model (e.g. "i7-9850H") from a directory of result files, such as ./output
+slicehash_t *slicehash_load_db(const char *dir, const char *model);
+void slicehash_destroy(slicehash_t *h);
+
+//Returns the slice of paddr, or -1 if paddr has bits set past the hash's address bits
+int slicehash_slice(const slicehash_t *h, uint64_t paddr);
+//Slices of n physical addresses, written to slices
+void slicehash_slice_batch(const slicehash_t *h, const uint64_t *paddrs, int16_t *slices, size_t n);
+//Slices of the len / cacheline lines in [pa, pa + len), pa a multiple of the cacheline. The sequence index is
+//worked out for pa and then updated line to line, rather than hashing each line.
+void slicehash_slice_range(const slicehash_t *h, uint64_t pa, uint64_t len, int16_t *slices);
+//Adds the slices of every line of n pages to counts, which has num_slices entries plus one for lines past the
+//hash's address bits. pages holds page aligned physical addresses, page_size is a power of two.
+void slicehash_count_pages(const slicehash_t *h, const uint64_t *pages, size_t n, uint64_t page_size, uint64_t *counts);
+//Inverse query. Writes up to max cacheline addresses in [start, end) which map to slice into out,
+//returns the number written. Addresses come out in the iterator's order, see below.
+size_t slicehash_find(const slicehash_t *h, uint64_t start, uint64_t end, int slice, uint64_t *out, size_t max);
+
+//Streaming inverse query. Lines are solved for directly rather than by hashing every line in the range,
+//so the cost is proportional to the number of lines returned. The range is split into aligned power of two
+//blocks which are returned in address order, lines within a block are not sorted.
+slicehash_iter_t *slicehash_iter_begin(const slicehash_t *h, uint64_t start, uint64_t end, int slice);
+//Returns 1 and sets paddr to the next matching line, 0 once the range is exhausted
+int slicehash_iter_next(slicehash_iter_t *it, uint64_t *paddr);
+void slicehash_iter_end(slicehash_iter_t *it);
+
+int slicehash_num_slices(const slicehash_t *h);
+int slicehash_addr_bits(const slicehash_t *h);
+int slicehash_cacheline(const slicehash_t *h);
+uint64_t slicehash_seq_len(const slicehash_t *h);
+//addr_bits entries, and seq_len entries (NULL on 2^n slice machines), owned by the hash
+const int *slicehash_xor_map(const slicehash_t *h);
+const int16_t *slicehash_master_sequence(const slicehash_t *h);
+//Model and L3 associativity from the result file header, empty string and 0 if not known
+const char *slicehash_model(const slicehash_t *h);
+int slicehash_l3_associativity(const slicehash_t *h);
+
+#endif //SLICEHASH_H
@@ -0,0 +1,45 @@
+#!/bin/bash
+#Simulates sharded runs of saved results and checks merge_shards recovers them. i7-7500U has 2^n slices, where
+#bits which do not move the sequence have pair ID 0, i7-9850H has a master sequence. The merge keeps the model.
+#./test_merge_shards.sh [merge_shards binary]
+
+MERGE=${1:-./merge_shards}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+FAILED=0
+
+#Sequence as one digit per line, from the "Master Sequence:" line of a saved result or the array merge_shards prints
+saved_sequence()
+{
+	grep -A1 "^Master Sequence: *$" $1 | tail -n1 | tr -d ' \n'
+}
+merged_sequence()
+{
+	grep "^int master_sequence" $1 | sed 's/.*{\(.*\)}.*/\1/' | tr -d ', \n'
+}
+
+for RESULT in output/i7-7500U_1634520093.txt output/i7-9850H_1634726880.txt; do
+	for NOISE in 0 0.01; do
+		rm -f $DIR/*
+		$MERGE --simulate $RESULT 4 $DIR --overlap 2 --noise $NOISE > /dev/null
+		if ! $MERGE $DIR/shard_*.txt > $DIR/merged 2> $DIR/merge.log; then
+			echo "FAIL $RESULT noise $NOISE: merge failed"
+			cat $DIR/merge.log
+			FAILED=1
+			continue
+		fi
+		if [[ "$(grep "^Model:" $RESULT)" != "$(grep "^Model:" $DIR/merged)" ]]; then
+			echo "FAIL $RESULT noise $NOISE: model differs"
+			FAILED=1
+		elif [[ "$(grep "^int xor_map" $RESULT)" != "$(grep "^int xor_map" $DIR/merged)" ]]; then
+			echo "FAIL $RESULT noise $NOISE: xor_map differs"
+			FAILED=1
+		elif [[ "$(saved_sequence $RESULT)" != "$(merged_sequence $DIR/merged)" ]]; then
+			echo "FAIL $RESULT noise $NOISE: master sequence differs"
+			FAILED=1
+		else
+			echo "ok   $RESULT noise $NOISE"
+		fi
+	done
+done
+exit $FAILED
@@ -0,0 +1,405 @@
+#include "uncore_address_map.h"
+#include "topology.h"
+
+//Number of consecutive rounds the fastest core must stay the same before we trust it
+#define TIMING_PROBE_STABLE_ROUNDS 3
+#define TIMING_PROBE_MAX_ROUNDS 16
+//Upper bound on the samples each core takes in its turn, calibration picks the actual number
+#define TIMING_PROBE_MAX_SAMPLES 16
+//Largest eviction set tried, the same as the old hardcoded eviction loop for the most associative L2 in use
+#define TIMING_PROBE_MAX_EVSET_LEN(l2_ways) ((L1_ASSOCIATIVITY+(l2_ways))*8)
+
+//Calibration setup
+#define TIMING_CALIBRATION_LINES 64
+#define TIMING_CALIBRATION_SAMPLES 256
+#define TIMING_CALIBRATION_EVICTION_RATE 0.99
+//Required distance between local and remote LLC means, in combined standard deviations
+#define TIMING_CALIBRATION_SEPARATION 3.0
+
+struct timing_probe_thread_args
+{
+	timing_probe_t *probe;
+	int core;
+};
+
+static const char *timing_level_names[TIMING_LEVELS] = {"L1", "L2", "LLC local", "LLC remote"};
+
+//Accesses the eviction lines which share an L2 set with line, in an L2 of l2_sets sets
+static inline void timing_probe_evict(timing_probe_t *p, uint8_t *line, int evset_len, uint64_t l2_sets)
+{
+	uint64_t set_offset = (((uint64_t)line / L2_CACHELINE) & (l2_sets - 1)) * L2_CACHELINE;
+	for (int i = 0; i < evset_len; ++i)
+		memaccess(p->evset[i] + set_offset);
+}
+
+//Load the line into this core's L1, push it back to the LLC through the L2 eviction set and time the reload.
+//The line is evicted again afterwards so it is not left in this core's private caches for the next core's turn.
+static uint32_t timing_probe_sample(timing_probe_t *p, uint8_t *line, int evset_len, uint64_t l2_sets)
+{
+	uint32_t t = 0;
+
+	memaccess(line);
+	timing_probe_evict(p, line, evset_len, l2_sets);
+	t = memaccesstime(line);
+	timing_probe_evict(p, line, evset_len, l2_sets);
+	return t;
+}
+
+//Calibration sizes the eviction set on the measurement core, cores with a more associative L2 (E-core clusters on
+//hybrid parts) need proportionally more lines
+static int timing_probe_core_evset_len(timing_probe_t *p, int core)
+{
+	int len = (p->calib.evset_len * p->l2_ways[core] + p->l2_ways[p->measure_core] - 1) / p->l2_ways[p->measure_core];
+	return len < p->evset_len ? len : p->evset_len;
+}
+
+static void *timing_probe_thread(void *targs)
+{
+	struct timing_probe_thread_args args = *(struct timing_probe_thread_args *)targs;
+	timing_probe_t *p = args.probe;
+	free(targs);
+
+	while(1)
+	{
+		pthread_barrier_wait(&p->round_start);
+		if(p->stop)
+			break;
+
+		uint8_t *line = &p->mem[p->offset];
+		int evset_len = timing_probe_core_evset_len(p, args.core);
+		uint32_t *samples = &p->round_samples[args.core * p->round_samples_len];
+		//Round-robin: each core gets the line to itself for its turn
+		for (int turn = 0; turn < p->num_cores; ++turn)
+		{
+			if(turn == args.core)
+			{
+				uint32_t t_min = UINT32_MAX;
+				for (int s = 0; s < p->samples; ++s)
+				{
+					samples[s] = timing_probe_sample(p, line, evset_len, p->l2_sets[args.core]);
+					if(samples[s] > p->calib.llc_min && samples[s] < p->calib.llc_max && samples[s] < t_min)
+						t_min = samples[s];
+				}
+				p->round_time[args.core] = t_min;
+			}
+			pthread_barrier_wait(&p->turn);
+		}
+		pthread_barrier_wait(&p->round_end);
+	}
+	pthread_exit(NULL);
+}
+
+//Runs one round over mem[offset] on every core
+static void timing_probe_round(timing_probe_t *p, uint64_t offset)
+{
+	p->offset = offset;
+	pthread_barrier_wait(&p->round_start);
+	pthread_barrier_wait(&p->round_end);
+}
+
+static void timing_histogram_add(timing_calibration_t *c, int level, uint32_t t)
+{
+	if(t >= TIMING_HIST_BINS)
+		t = TIMING_HIST_BINS-1;
+	c->hist[level][t]++;
+	c->count[level]++;
+}
+
+//Returns the smallest latency with at least fraction of the level's samples at or below it
+static uint32_t timing_histogram_percentile(timing_calibration_t *c, int level, double fraction)
+{
+	uint64_t target = (uint64_t)ceil(fraction * (double)c->count[level]);
+	uint64_t seen = 0;
+	for (uint32_t t = 0; t < TIMING_HIST_BINS; ++t)
+	{
+		seen += c->hist[level][t];
+		if(seen >= target && seen > 0)
+			return t;
+	}
+	return TIMING_HIST_BINS-1;
+}
+
+static void timing_histogram_stats(timing_calibration_t *c, int level)
+{
+	double sum = 0.0, sq = 0.0;
+	for (uint32_t t = 0; t < TIMING_HIST_BINS; ++t)
+	{
+		sum += (double)t * c->hist[level][t];
+		sq += (double)t * t * c->hist[level][t];
+	}
+	if(c->count[level] == 0)
+		return;
+	c->mean[level] = sum / c->count[level];
+	c->stddev[level] = sqrt(fabs(sq / c->count[level] - c->mean[level] * c->mean[level]));
+}
+
+//Builds latency histograms for L1, L2, local and remote LLC hits on this host and derives
+//the probe's cutoffs, eviction set size and per-turn sample count from them.
+static void timing_probe_calibrate(timing_probe_t *p)
+{
+	timing_calibration_t *c = &p->calib;
+	uint64_t lines = TIMING_CALIBRATION_LINES;
+	if(lines * PAGE_SIZE > p->len)
+		lines = p->len / PAGE_SIZE > 0 ? p->len / PAGE_SIZE : 1;
+
+	//L1 and L2 hits are measured from the calling thread (on the measurement CPU), every core of a type has the same
+	//private caches
+	for (uint64_t l = 0; l < lines; ++l)
+	{
+		uint8_t *line = &p->mem[(l * PAGE_SIZE) % p->len];
+		for (int s = 0; s < TIMING_CALIBRATION_SAMPLES / 4; ++s)
+		{
+			memaccess(line);
+			timing_histogram_add(c, TIMING_L1, memaccesstime(line));
+
+			//Evict from L1 only, through lines one L1 stride apart
+			memaccess(line);
+			for (int i = 1; i <= L1_ASSOCIATIVITY * 2; ++i)
+				memaccess(&p->mem[((uint64_t)line - (uint64_t)p->mem + i * L1_STRIDE) % p->len]);
+			timing_histogram_add(c, TIMING_L2, memaccesstime(line));
+		}
+	}
+
+	//LLC hits with the largest eviction set, split into the fastest (local) core and the rest
+	int saved_samples = p->samples;
+	uint32_t saved_min = c->llc_min, saved_max = c->llc_max;
+	p->samples = p->round_samples_len;
+	c->llc_min = 0;
+	c->llc_max = UINT32_MAX;
+	c->evset_len = p->evset_len;
+	uint64_t *core_sum = malloc(p->num_cores * sizeof(uint64_t));
+	for (uint64_t l = 0; l < lines; ++l)
+	{
+		uint64_t offset = (l * PAGE_SIZE + (l % (PAGE_SIZE / L3_CACHELINE)) * L3_CACHELINE) % p->len;
+		memset(core_sum, 0, p->num_cores * sizeof(uint64_t));
+		for (int r = 0; r < TIMING_CALIBRATION_SAMPLES / p->samples; ++r)
+		{
+			timing_probe_round(p, offset);
+			for (int k = 0; k < p->num_cores * p->samples; ++k)
+				core_sum[k / p->samples] += p->round_samples[k];
+		}
+		int local = 0;
+		for (int k = 1; k < p->num_cores; ++k)
+		{
+			if(core_sum[k] < core_sum[local])
+				local = k;
+		}
+		//Last round's samples are representative of every round, so only those are histogrammed
+		for (int k = 0; k < p->num_cores * p->samples; ++k)
+			timing_histogram_add(c, (k / p->samples) == local ? TIMING_LLC_LOCAL : TIMING_LLC_REMOTE, p->round_samples[k]);
+	}
+	free(core_sum);
+	p->samples = saved_samples;
+	c->llc_min = saved_min;
+	c->llc_max = saved_max;
+
+	for (int level = 0; level < TIMING_LEVELS; ++level)
+		timing_histogram_stats(c, level);
+
+	//Anything at or below the slowest L2 hit was never evicted, anything well past the slowest remote LLC hit is DRAM or an interrupt
+	uint32_t l2_max = timing_histogram_percentile(c, TIMING_L2, 0.99);
+	uint32_t llc_local_min = timing_histogram_percentile(c, TIMING_LLC_LOCAL, 0.01);
+	c->llc_min = l2_max < llc_local_min ? l2_max : (l2_max + llc_local_min) / 2;
+	c->llc_max = timing_histogram_percentile(c, TIMING_LLC_REMOTE, 0.999) * 2;
+
+	//Smallest eviction set which still pushes the line past llc_min nearly every time
+	c->evset_len = p->evset_len;
+	int ways = p->l2_ways[p->measure_core];
+	for (int len = ways; len <= p->evset_len; len += ways)
+	{
+		int evicted = 0;
+		for (int s = 0; s < TIMING_CALIBRATION_SAMPLES; ++s)
+		{
+			uint8_t *line = &p->mem[((uint64_t)(s % lines) * PAGE_SIZE) % p->len];
+			if(timing_probe_sample(p, line, len, p->l2_sets[p->measure_core]) > c->llc_min)
+				evicted++;
+		}
+		if((double)evicted / TIMING_CALIBRATION_SAMPLES >= TIMING_CALIBRATION_EVICTION_RATE)
+		{
+			c->evset_len = len;
+			break;
+		}
+	}
+
+	//Samples needed so the local and remote means sit TIMING_CALIBRATION_SEPARATION standard errors apart
+	double gap = c->mean[TIMING_LLC_REMOTE] - c->mean[TIMING_LLC_LOCAL];
+	double spread = c->stddev[TIMING_LLC_LOCAL] + c->stddev[TIMING_LLC_REMOTE];
+	if(gap > 0.0)
+		c->samples = (int)ceil(pow(TIMING_CALIBRATION_SEPARATION * spread / gap, 2));
+	else
+		c->samples = TIMING_PROBE_MAX_SAMPLES;
+	if(c->samples < 1)
+		c->samples = 1;
+	if(c->samples > TIMING_PROBE_MAX_SAMPLES)
+		c->samples = TIMING_PROBE_MAX_SAMPLES;
+	p->samples = c->samples;
+	c->calibrated = 1;
+}
+
+timing_probe_t *timing_probe_init(uint8_t *mem, uint64_t len)
+{
+	cpu_topology_t *topo = topology_get();
+	timing_probe_t *p = calloc(1, sizeof(timing_probe_t));
+	p->mem = mem;
+	p->len = len;
+	p->num_cores = topo->num_cores;
+	p->round_samples_len = TIMING_PROBE_MAX_SAMPLES;
+	p->round_samples = calloc(p->num_cores * p->round_samples_len, sizeof(uint32_t));
+	p->round_time = calloc(p->num_cores, sizeof(uint32_t));
+	p->threads = calloc(p->num_cores, sizeof(pthread_t));
+
+	//Each core's L2 from sysfs, which differs between P-cores and E-core clusters on hybrid parts. The measurement
+	//core's thread runs on the measurement CPU itself rather than the core's first CPU.
+	int measure_cpu = topology_measure_cpu();
+	p->measure_core = topo->cpu_core[measure_cpu];
+	p->core_cpu = malloc(p->num_cores * sizeof(int));
+	p->l2_sets = malloc(p->num_cores * sizeof(uint64_t));
+	p->l2_ways = malloc(p->num_cores * sizeof(int));
+	uint64_t max_sets = 0;
+	int max_ways = 0;
+	for (int c = 0; c < p->num_cores; ++c)
+	{
+		int cpu = c == p->measure_core ? measure_cpu : topo->core_cpu[c];
+		p->core_cpu[c] = cpu;
+		p->l2_sets[c] = topo->l2_sets[cpu] > 0 ? topo->l2_sets[cpu] : L2_SETS;
+		p->l2_ways[c] = topo->l2_ways[cpu] > 0 ? topo->l2_ways[cpu] : L2_ASSOCIATIVITY;
+		max_sets = p->l2_sets[c] > max_sets ? p->l2_sets[c] : max_sets;
+		max_ways = p->l2_ways[c] > max_ways ? p->l2_ways[c] : max_ways;
+	}
+
+	//Defaults are the old hardcoded values until calibration replaces them
+	p->calib.llc_min = 30;
+	p->calib.llc_max = 10000;
+	p->calib.evset_len = TIMING_PROBE_MAX_EVSET_LEN(max_ways);
+	p->calib.samples = 10;
+	p->samples = p->calib.samples;
+
+	//L2 eviction set for L2 set 0. The target's set offset is added at probe time. Sets are powers of two, so lines
+	//one stride of the largest L2 apart are in set 0 of every core's L2.
+	p->evset_len = TIMING_PROBE_MAX_EVSET_LEN(max_ways);
+	p->evset = malloc(p->evset_len * sizeof(uint8_t *));
+	for (int i = 0; i < p->evset_len; ++i)
+	{
+		p->evset[i] = &mem[((uint64_t)(i+1) * max_sets * L2_CACHELINE) % len];
+		memaccess(p->evset[i]);
+	}
+
+	pthread_barrier_init(&p->round_start, NULL, p->num_cores + 1);
+	pthread_barrier_init(&p->round_end, NULL, p->num_cores + 1);
+	pthread_barrier_init(&p->turn, NULL, p->num_cores);
+
+	for (int c = 0; c < p->num_cores; ++c)
+	{
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		CPU_SET(p->core_cpu[c], &mask);
+		struct timing_probe_thread_args *args = malloc(sizeof(struct timing_probe_thread_args));
+		args->probe = p;
+		args->core = c;
+
+		int err = pthread_create(&p->threads[c], NULL, timing_probe_thread, (void *)args);
+		if(err)
+		{
+			printf("Error: unable to create thread: %d\n", err);
+			exit(1);
+		}
+		if(pthread_setaffinity_np(p->threads[c], sizeof(cpu_set_t), &mask) != 0)
+		{
+			perror("timing_probe_init()");
+			exit(1);
+		}
+	}
+
+	timing_probe_calibrate(p);
+	return p;
+}
+
+void timing_probe_destroy(timing_probe_t *p)
+{
+	if(p == NULL)
+		return;
+	p->stop = 1;
+	pthread_barrier_wait(&p->round_start);
+	for (int c = 0; c < p->num_cores; ++c)
+		pthread_join(p->threads[c], NULL);
+	pthread_barrier_destroy(&p->round_start);
+	pthread_barrier_destroy(&p->round_end);
+	pthread_barrier_destroy(&p->turn);
+	free(p->evset);
+	free(p->core_cpu);
+	free(p->l2_sets);
+	free(p->l2_ways);
+	free(p->threads);
+	free(p->round_time);
+	free(p->round_samples);
+	free(p);
+}
+
+//Returns the physical core with the lowest LLC access time to mem[offset], which is the slice the line lives in.
+int timing_probe_get_slice(timing_probe_t *p, uint64_t offset)
+{
+	if(offset >= p->len)
+		return -2;
+
+	uint32_t *best = malloc(p->num_cores * sizeof(uint32_t));
+	for (int c = 0; c < p->num_cores; ++c)
+		best[c] = UINT32_MAX;
+
+	int slice = -1;
+	int stable = 0;
+	for (int r = 0; r < TIMING_PROBE_MAX_ROUNDS && stable < TIMING_PROBE_STABLE_ROUNDS; ++r)
+	{
+		timing_probe_round(p, offset);
+
+		int round_slice = -1;
+		uint32_t min = UINT32_MAX;
+		for (int c = 0; c < p->num_cores; ++c)
+		{
+			if(p->round_time[c] < best[c])
+				best[c] = p->round_time[c];
+			if(best[c] < min)
+			{
+				min = best[c];
+				round_slice = c;
+			}
+		}
+		if(round_slice == slice)
+			stable++;
+		else
+			stable = 1;
+		slice = round_slice;
+	}
+	free(best);
+	return slice;
+}
+
+void timing_calibration_print(FILE *f, timing_calibration_t *c)
+{
+	fprintf(f, "Timing Calibration\n");
+	if(!c->calibrated)
+	{
+		fprintf(f, "Not calibrated, using defaults\n");
+	}
+	fprintf(f, "LLC Hit Window: %u-%u cycles | Eviction Set: %d lines | Samples: %d\n", c->llc_min, c->llc_max, c->evset_len, c->samples);
+	for (int level = 0; level < TIMING_LEVELS; ++level)
+	{
+		if(c->count[level] == 0)
+			continue;
+		fprintf(f, "%-10s | Count: %06lu | Mean: %6.1f | Stddev: %5.1f | P1: %4u | P50: %4u | P99: %4u\n", timing_level_names[level], c->count[level],
+				c->mean[level], c->stddev[level], timing_histogram_percentile(c, level, 0.01), timing_histogram_percentile(c, level, 0.5), timing_histogram_percentile(c, level, 0.99));
+	}
+	//Histogram as latency:count pairs, skipping empty bins
+	for (int level = 0; level < TIMING_LEVELS; ++level)
+	{
+		if(c->count[level] == 0)
+			continue;
+		fprintf(f, "%-10s |", timing_level_names[level]);
+		for (uint32_t t = 0; t < TIMING_HIST_BINS; ++t)
+		{
+			if(c->hist[level][t])
+				fprintf(f, " %u:%u", t, c->hist[level][t]);
+		}
+		fputc('\n', f);
+	}
+	fputc('\n', f);
+}
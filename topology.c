@@ -0,0 +1,334 @@
+#include "topology.h"
+#include "setup_info.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+
+static cpu_topology_t *topology = NULL;
+static pthread_mutex_t topology_mutex = PTHREAD_MUTEX_INITIALIZER;
+//Measurement CPU once chosen, and the counts it was chosen on
+static int measure_cpu = -1;
+static uint64_t measure_irqs = 0;
+static uint64_t measure_busy = 0;
+
+//Reads a single integer from a sysfs file, returns -1 if it cannot be read
+static int read_sysfs_int(const char *fmt, int cpu)
+{
+	char path[256];
+	int val = -1;
+	snprintf(path, sizeof(path), fmt, cpu);
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return -1;
+	if(fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+//Reads a sysfs file into buf, returns 0 on success
+static int read_sysfs_str(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return -1;
+	int ok = fgets(buf, len, f) != NULL;
+	fclose(f);
+	if(!ok)
+		return -1;
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+//Parses a cpulist ("0-3,8,10-11"), setting set[c] for each CPU below max. Returns the number of CPUs listed.
+static int parse_cpulist(const char *list, int *set, int max)
+{
+	int n = 0;
+	const char *p = list;
+	while(*p)
+	{
+		char *end;
+		long first = strtol(p, &end, 10);
+		if(end == p)
+			break;
+		long last = first;
+		if(*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (long c = first; c <= last; ++c)
+		{
+			if(set != NULL && c < max)
+				set[c] = 1;
+			n++;
+		}
+		if(*end != ',')
+			break;
+		p = end + 1;
+	}
+	return n;
+}
+
+//Unified or data L2 of cpu from its cache directory
+static void read_l2(cpu_topology_t *t, int cpu)
+{
+	char path[256], buf[256];
+	for (int index = 0; index < 8; ++index)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+		if(read_sysfs_str(path, buf, sizeof(buf)) != 0)
+			break;
+		if(atoi(buf) != 2)
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, index);
+		if(read_sysfs_str(path, buf, sizeof(buf)) == 0 && strcmp(buf, "Instruction") == 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+		uint64_t size = read_sysfs_str(path, buf, sizeof(buf)) == 0 ? strtoull(buf, NULL, 10) : 0;
+		if(strchr(buf, 'K'))
+			size <<= 10;
+		else if(strchr(buf, 'M'))
+			size <<= 20;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/ways_of_associativity", cpu, index);
+		int ways = read_sysfs_str(path, buf, sizeof(buf)) == 0 ? atoi(buf) : 0;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/coherency_line_size", cpu, index);
+		int line = read_sysfs_str(path, buf, sizeof(buf)) == 0 ? atoi(buf) : 0;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+		t->l2_shared[cpu] = read_sysfs_str(path, buf, sizeof(buf)) == 0 ? parse_cpulist(buf, NULL, 0) : 1;
+		if(ways > 0 && line > 0)
+		{
+			t->l2_ways[cpu] = ways;
+			t->l2_sets[cpu] = size / ways / line;
+		}
+		return;
+	}
+}
+
+//Physical cores are numbered in order of their first logical CPU, which matches the
+//slice numbering the timing fallback has always assumed (cpu % physical cores).
+static cpu_topology_t *topology_discover()
+{
+	int max_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+	cpu_topology_t *t = calloc(1, sizeof(cpu_topology_t));
+	t->cpu_core = malloc(max_cpus * sizeof(int));
+	t->core_cpu = malloc(max_cpus * sizeof(int));
+	t->cpu_type = calloc(max_cpus, sizeof(int));
+	t->l2_sets = calloc(max_cpus, sizeof(uint64_t));
+	t->l2_ways = calloc(max_cpus, sizeof(int));
+	t->l2_shared = calloc(max_cpus, sizeof(int));
+	int *core_id = malloc(max_cpus * sizeof(int));
+	int *package_id = malloc(max_cpus * sizeof(int));
+
+	for (int c = 0; c < max_cpus; ++c)
+	{
+		t->cpu_core[c] = -1;
+		//cpu0 has no online file on most systems, but is always online
+		if(c > 0 && read_sysfs_int("/sys/devices/system/cpu/cpu%d/online", c) == 0)
+			continue;
+		int core = read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+		int package = read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+		if(core == -1)
+			continue;
+		t->num_cpus++;
+
+		//Look for an existing physical core with the same ids
+		for (int p = 0; p < t->num_cores; ++p)
+		{
+			if(core_id[p] == core && package_id[p] == package)
+			{
+				t->cpu_core[c] = p;
+				t->smt = 1;
+				break;
+			}
+		}
+		if(t->cpu_core[c] == -1)
+		{
+			core_id[t->num_cores] = core;
+			package_id[t->num_cores] = package;
+			t->core_cpu[t->num_cores] = c;
+			t->cpu_core[c] = t->num_cores;
+			t->num_cores++;
+		}
+	}
+
+	//sysfs not available, fall back to treating every online CPU as its own core
+	if(t->num_cores == 0)
+	{
+		t->num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		t->num_cores = t->num_cpus;
+		for (int c = 0; c < t->num_cpus; ++c)
+		{
+			t->cpu_core[c] = c;
+			t->core_cpu[c] = c;
+		}
+	}
+
+	//Hybrid parts list their E-cores under the cpu_atom PMU
+	char buf[1024];
+	if(read_sysfs_str("/sys/devices/cpu_atom/cpus", buf, sizeof(buf)) == 0)
+	{
+		int *atom = calloc(max_cpus, sizeof(int));
+		parse_cpulist(buf, atom, max_cpus);
+		for (int c = 0; c < max_cpus; ++c)
+		{
+			if(atom[c])
+			{
+				t->cpu_type[c] = TOPOLOGY_CORE_E;
+				t->hybrid = 1;
+			}
+		}
+		free(atom);
+	}
+	for (int c = 0; c < max_cpus; ++c)
+	{
+		if(t->cpu_core[c] != -1)
+			read_l2(t, c);
+	}
+
+	free(core_id);
+	free(package_id);
+	return t;
+}
+
+cpu_topology_t *topology_get()
+{
+	pthread_mutex_lock(&topology_mutex);
+	if(topology == NULL)
+		topology = topology_discover();
+	pthread_mutex_unlock(&topology_mutex);
+	return topology;
+}
+
+//Interrupts and busy ticks (CPU time not spent idle) of each CPU so far
+static void read_cpu_activity(int max_cpus, uint64_t *irqs, uint64_t *busy)
+{
+	memset(irqs, 0, max_cpus * sizeof(uint64_t));
+	memset(busy, 0, max_cpus * sizeof(uint64_t));
+	char *line = NULL;
+	size_t line_len = 0;
+
+	//The header names the CPU of each column, offline CPUs have none
+	FILE *f = fopen("/proc/interrupts", "r");
+	if(f != NULL && getline(&line, &line_len, f) > 0)
+	{
+		int *column_cpu = malloc(max_cpus * sizeof(int));
+		int columns = 0, cpu, used;
+		char *p = line;
+		while(columns < max_cpus && sscanf(p, " CPU%d%n", &cpu, &used) == 1)
+		{
+			column_cpu[columns++] = cpu;
+			p += used;
+		}
+		while(getline(&line, &line_len, f) > 0)
+		{
+			p = strchr(line, ':');
+			if(p == NULL)
+				continue;
+			p++;
+			for (int col = 0; col < columns; ++col)
+			{
+				char *end;
+				uint64_t n = strtoull(p, &end, 10);
+				if(end == p)
+					break;
+				if(column_cpu[col] < max_cpus)
+					irqs[column_cpu[col]] += n;
+				p = end;
+			}
+		}
+		free(column_cpu);
+	}
+	if(f != NULL)
+		fclose(f);
+
+	f = fopen("/proc/stat", "r");
+	while(f != NULL && getline(&line, &line_len, f) > 0)
+	{
+		int cpu;
+		uint64_t v[8] = {0};
+		if(sscanf(line, "cpu%d %lu %lu %lu %lu %lu %lu %lu %lu", &cpu, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5)
+			continue;
+		if(cpu >= 0 && cpu < max_cpus)
+			busy[cpu] = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+	}
+	if(f != NULL)
+		fclose(f);
+	free(line);
+}
+
+//A core is as noisy as all of its logical CPUs together, as a sibling shares the core's caches. Cores whose type is
+//not P are only used when there are no P-cores, and cpu0 loses ties as it usually handles more of the system.
+static int topology_pick_quiet(cpu_topology_t *t)
+{
+	int max_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+	uint64_t *irqs0 = malloc(max_cpus * sizeof(uint64_t)), *busy0 = malloc(max_cpus * sizeof(uint64_t));
+	uint64_t *irqs1 = malloc(max_cpus * sizeof(uint64_t)), *busy1 = malloc(max_cpus * sizeof(uint64_t));
+	uint64_t *core_irqs = calloc(t->num_cores, sizeof(uint64_t)), *core_busy = calloc(t->num_cores, sizeof(uint64_t));
+	read_cpu_activity(max_cpus, irqs0, busy0);
+	usleep(TOPOLOGY_QUIET_SAMPLE_MS * 1000);
+	read_cpu_activity(max_cpus, irqs1, busy1);
+	for (int c = 0; c < max_cpus; ++c)
+	{
+		if(t->cpu_core[c] == -1)
+			continue;
+		core_irqs[t->cpu_core[c]] += irqs1[c] - irqs0[c];
+		core_busy[t->cpu_core[c]] += busy1[c] - busy0[c];
+	}
+
+	int has_p = 0;
+	for (int core = 0; core < t->num_cores; ++core)
+		has_p |= t->cpu_type[t->core_cpu[core]] == TOPOLOGY_CORE_P;
+	int best = -1;
+	uint64_t best_score = 0;
+	for (int core = t->num_cores - 1; core >= 0; --core)
+	{
+		if(has_p && t->cpu_type[t->core_cpu[core]] != TOPOLOGY_CORE_P)
+			continue;
+		uint64_t score = core_irqs[core] + TOPOLOGY_BUSY_WEIGHT * core_busy[core];
+		if(best == -1 || score < best_score)
+		{
+			best = core;
+			best_score = score;
+		}
+	}
+	//Quietest logical CPU of the core, the others are its siblings
+	int cpu = t->core_cpu[best];
+	for (int c = 0; c < max_cpus; ++c)
+	{
+		if(t->cpu_core[c] == best && irqs1[c] - irqs0[c] < irqs1[cpu] - irqs0[cpu])
+			cpu = c;
+	}
+	measure_irqs = core_irqs[best];
+	measure_busy = core_busy[best];
+
+	free(irqs0);
+	free(busy0);
+	free(irqs1);
+	free(busy1);
+	free(core_irqs);
+	free(core_busy);
+	return cpu;
+}
+
+int topology_measure_cpu()
+{
+	cpu_topology_t *t = topology_get();
+	pthread_mutex_lock(&topology_mutex);
+	if(measure_cpu == -1)
+		measure_cpu = AFFINITY >= 0 ? AFFINITY : topology_pick_quiet(t);
+	pthread_mutex_unlock(&topology_mutex);
+	return measure_cpu;
+}
+
+void topology_print(FILE *f)
+{
+	cpu_topology_t *t = topology_get();
+	int cpu = topology_measure_cpu();
+	fprintf(f, "Measuring on CPU %d | Core %d (%s) | ", cpu, t->cpu_core[cpu], t->cpu_type[cpu] == TOPOLOGY_CORE_E ? "E-core" : "P-core");
+	if(AFFINITY >= 0)
+		fprintf(f, "Set by AFFINITY");
+	else
+		fprintf(f, "Quietest core: %lu interrupts and %lu busy ticks in %d ms", measure_irqs, measure_busy, TOPOLOGY_QUIET_SAMPLE_MS);
+	if(t->l2_sets[cpu] > 0)
+		fprintf(f, " | L2 %lu sets x %d ways, shared by %d CPUs", t->l2_sets[cpu], t->l2_ways[cpu], t->l2_shared[cpu]);
+	fprintf(f, "\n");
+}
@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+//Online CPU layout read from sysfs. Discovered once and cached, as it does not change during a run.
+
+//Core types on hybrid parts. Every core of a non-hybrid part is a P-core.
+#define TOPOLOGY_CORE_P 0
+#define TOPOLOGY_CORE_E 1
+
+//How long interrupts and CPU time are counted for when choosing the measurement CPU, and how many interrupts a
+//tick (1/USER_HZ s) of CPU time taken by other tasks weighs as
+#define TOPOLOGY_QUIET_SAMPLE_MS 200
+#define TOPOLOGY_BUSY_WEIGHT 10
+
+struct cpu_topology
+{
+	int num_cpus;		//Online logical CPUs
+	int num_cores;		//Physical cores
+	int smt;			//1 if any physical core has more than one online logical CPU
+	int *cpu_core;		//Physical core index (0..num_cores-1) of each logical CPU, -1 if offline
+	int *core_cpu;		//First online logical CPU of each physical core
+	int hybrid;			//1 if there are E-cores
+	int *cpu_type;		//TOPOLOGY_CORE_P or TOPOLOGY_CORE_E, per logical CPU
+	//L2 geometry per logical CPU, 0 where sysfs does not say. E-cores in a cluster share one L2.
+	uint64_t *l2_sets;
+	int *l2_ways;
+	int *l2_shared;		//Logical CPUs sharing the L2
+} typedef cpu_topology_t;
+
+cpu_topology_t *topology_get();
+//Logical CPU the CBo measurements run on. AFFINITY if it is set, otherwise the P-core whose logical CPUs took
+//the fewest interrupts and the least CPU time from other tasks, picked on the first call.
+int topology_measure_cpu();
+//Prints the measurement CPU and why it was chosen
+void topology_print(FILE *f);
+
+#endif //TOPOLOGY_H
@@ -3,26 +3,50 @@
 #include <perf_counters.h>
 #include <perf_counters_util.h>
 #include <string.h>
+#include <time.h>
 
 
 #define UNCORE_PERFMON_SAMPLES 10000
 
+//Counted CBo event and flushes per perfmon read, chosen by cbo_event_selftest() unless set with measure_set_cbo_event()
+static cbo_event_t cbo_event = {0x34, 0x8F, 0, "UNC_CBO_CACHE_LOOKUP.ANY_MESI"};
+static int cbo_samples = UNCORE_PERFMON_SAMPLES;
+static int cbo_event_pending = CBO_EVENT_AUTO;
+static int cbo_samples_pending = CBO_EVENT_AUTO;
+
 #define FIRST(k,n) ((k) & ((1<<(n))-1))
 #define EXTRACT_BITS(k,m,n) FIRST((k)>>(m),((n)-(m)))
 
+//Timing fallback. The probe threads, their pinning and the L2 eviction set are set up once
+//and kept for as long as the caller keeps using the same buffer.
+static timing_probe_t *access_probe = NULL;
+
 //evict mem[offset] into L3 and measure access time
 //Requires huge pages to evict from L2
-//returns minimum access time from 1000 samples
+//returns minimum access time, using the host's calibration once the timing probe has run
 double get_slice_access_time(uint8_t *mem, uint64_t len, uint64_t offset)
 {
-	uint64_t t = 10000;
+	//L2 of the CPU measurements run on, falling back to the build's geometry when sysfs does not describe it
+	cpu_topology_t *topo = topology_get();
+	int cpu = topology_measure_cpu();
+	uint64_t l2_sets = topo->l2_sets[cpu] > 0 ? topo->l2_sets[cpu] : L2_SETS;
+	int l2_ways = topo->l2_ways[cpu] > 0 ? topo->l2_ways[cpu] : L2_ASSOCIATIVITY;
+	uint32_t llc_min = 30, llc_max = 10000;
+	int samples = 10, evset_len = (L1_ASSOCIATIVITY+l2_ways)*8;
+	if(access_probe != NULL && access_probe->calib.calibrated)
+	{
+		llc_min = access_probe->calib.llc_min;
+		llc_max = access_probe->calib.llc_max;
+		samples = access_probe->calib.samples;
+		evset_len = access_probe->calib.evset_len;
+	}
+	uint64_t t = llc_max;
 	uint64_t temp = 0;
 	int cl_index_bits = find_set_bit(L2_CACHELINE);
-	int l2_set_bits = find_set_bit(L2_SETS);
+	int l2_set_bits = find_set_bit(l2_sets);
 	register int mem_l2_set = EXTRACT_BITS((uint64_t)mem+offset, cl_index_bits, cl_index_bits + l2_set_bits);
 	if(offset < len)
 	{
-		int samples = 10;
 		for (int s = 0; s < samples; ++s)
 		{
 			clflush(mem+offset, 0);
@@ -30,13 +54,12 @@ double get_slice_access_time(uint8_t *mem, uint64_t len, uint64_t offset)
 			//initial access to bring into L1 cache
 			mem[offset] = offset;
 			mfence();
-			#pragma GCC unroll 4096
-			for (int i = 1; i <= (L1_ASSOCIATIVITY+L2_ASSOCIATIVITY)*8; ++i)
+			for (int i = 1; i <= evset_len; ++i)
 			{
-				memaccess(&mem[(i * L2_STRIDE + (mem_l2_set * L2_CACHELINE)) % len]);
+				memaccess(&mem[(i * l2_sets * L2_CACHELINE + (mem_l2_set * L2_CACHELINE)) % len]);
 			}
 			temp = (uint64_t)memaccesstime((void *)&mem[offset]);
-			if(temp > 30 && t > temp)
+			if(temp > llc_min && t > temp)
 			{
 				t = temp;
 			}
@@ -56,162 +79,399 @@ int access_get_slice(uint8_t *mem, uint64_t len, uint64_t offset)
 		return -2;
 	}
 
-	int num_cbos = uncore_get_num_cbo(AFFINITY);	
-	int num_proc = (int)sysconf(_SC_NPROCESSORS_ONLN);
-
-	//Check if hyperthreading is enabled, if so, halve the number of cores
-	int ht = 0;
-	uint32_t registers[4];
-	cpuid(&registers[0], &registers[1], &registers[2], &registers[3]);
-	if(registers[3] & (1 << 28) || HT == 1)
+	if(access_probe == NULL || access_probe->mem != mem || access_probe->len != len)
 	{
-		ht = 1;
+		timing_probe_destroy(access_probe);
+		access_probe = timing_probe_init(mem, len);
 	}
 
-	double *access_time = calloc(num_proc, sizeof(double));
+	return timing_probe_get_slice(access_probe, offset);
+}
 
-	#define ACCESS_SAMPLES 10
-	double access_min = 100000;
+//Calibration of the timing fallback, NULL if it has not been needed yet
+timing_calibration_t *access_get_calibration()
+{
+	if(access_probe == NULL)
+		return NULL;
+	return &access_probe->calib;
+}
 
-	for (int c = 0; c < num_proc; ++c)
-	{
-		double access_time_samples = 0;
-		double access_min = 100000;
+//Counter log, NULL unless measure_record() was called. Every perfmon read is appended with the physical address of
+//the flushed line, so the run can be replayed offline.
+static counter_log_t *record_log = NULL;
+static int record_pagemap = -1;
 
-		set_cpu(c);
+static void measure_record_close()
+{
+	counter_log_close(record_log);
+	record_log = NULL;
+	if(record_pagemap >= 0)
+		close(record_pagemap);
+	record_pagemap = -1;
+}
 
-		//get the avg min from ACCESS_SAMPLES results
-		for (int s = 0; s < ACCESS_SAMPLES; ++s)
-		{
-			access_time_samples += get_slice_access_time(mem, len, offset);
-		}
+int measure_record(const char *path)
+{
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	record_log = counter_log_create(path, num_cbos);
+	if(record_log == NULL)
+		return -1;
+	record_pagemap = pagemap_open(getpid());
+	if(record_pagemap < 0)
+	{
+		measure_record_close();
+		return -1;
+	}
+	atexit(measure_record_close);
+	return 0;
+}
 
-		if(access_min >= (access_time_samples / (double)ACCESS_SAMPLES))
-		{
-			access_time[c] = access_time_samples / (double)ACCESS_SAMPLES;
-			access_min = access_time[c];
-		}
+static void measure_record_reading(uncore_perfmon_t *u, uint8_t *line, int kind)
+{
+	if(record_log == NULL)
+		return;
+	uint64_t paddr = -1;
+	if(line != NULL)
+	{
+		uint64_t vaddr = (uint64_t)line;
+		pagemap_translate(record_pagemap, &vaddr, &paddr, 1);
 	}
+	uint64_t totals[u->num_cbo_ctrs];
+	for (int s = 0; s < u->num_cbo_ctrs; ++s)
+		totals[s] = u->results[s].total;
+	counter_log_append(record_log, paddr, kind, cbo_samples, totals);
+	//Baselines come every NOISE_CHECK_INTERVAL lines or so, flushing with them keeps what a killed run loses small
+	if(kind == COUNTER_LOG_BASELINE)
+		fflush(record_log->f);
+}
 
-	int access_slice = -1;
-	double min = 100000;
-	for (int c = 0; c < num_proc; ++c)
+//Noise monitor. The counters are socket wide and owned by the measuring thread, so rather than a thread of its own
+//the monitor takes its baseline reads from the same session between lines. Background is in CBo lookups per flush
+//on the busiest CBo, relative to the quietest baseline seen, which is this host's floor.
+struct noise_monitor
+{
+	double floor;
+	double level;
+	//Perfmon reads averaged per line, 1 unless the background is high
+	int reads;
+	uint64_t since_check;
+	//Current episode
+	int in_episode;
+	struct timespec start;
+	double peak;
+	double paused;
+	uint64_t readings;
+	uint64_t episodes;
+};
+
+static struct noise_monitor noise = {.floor = -1.0, .reads = 1, .since_check = NOISE_CHECK_INTERVAL};
+
+static double noise_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Stands in for the probe during a baseline read, taking about as long as a flush without touching memory
+static void noise_idle(void *arg0, void *arg1)
+{
+	uint64_t start = __builtin_ia32_rdtsc();
+	while(__builtin_ia32_rdtsc() - start < 200)
+		;
+}
+
+static double noise_baseline(uncore_perfmon_t *u)
+{
+	double busiest = 0.0;
+	uncore_perfmon_monitor(u, noise_idle, NULL, NULL);
+	metrics_count(METRIC_NOISE_BASELINES);
+	measure_record_reading(u, NULL, COUNTER_LOG_BASELINE);
+	for (int s = 0; s < u->num_cbo_ctrs; ++s)
 	{
-		//Check to see if this is the minimum
-		if(min >= access_time[c])
-		{
-			access_slice = c;
-			//if hyperthreading is on, modulo by physical core count to get the actual slice no.
-			if(ht)
-				access_slice %= (num_proc/2);
-			min = access_time[c];
-		}
+		double b = (double)u->results[s].total/(double)cbo_samples;
+		busiest = b > busiest ? b : busiest;
 	}
+	if(noise.floor < 0.0 || busiest < noise.floor)
+		noise.floor = busiest;
+	return busiest - noise.floor;
+}
 
-	free(access_time);
+static void noise_episode_begin()
+{
+	if(noise.in_episode)
+		return;
+	noise.in_episode = 1;
+	clock_gettime(CLOCK_MONOTONIC, &noise.start);
+	noise.peak = 0.0;
+	noise.paused = 0.0;
+	noise.readings = 0;
+	noise.episodes++;
+	metrics_count(METRIC_NOISE_EPISODES);
+}
 
-	return access_slice;
+static void noise_episode_end()
+{
+	if(!noise.in_episode)
+		return;
+	noise.in_episode = 0;
+	double length = noise_now() - (noise.start.tv_sec + noise.start.tv_nsec / 1e9);
+	fprintf(stderr, "Noise episode %lu: %.2f s, peak %.2f lookups/flush over the floor, %.2f s paused, %lu readings of up to %d reads\n",
+		noise.episodes, length, noise.peak, noise.paused, noise.readings, NOISE_MAX_READS);
 }
 
-int measure_slice_accesses(uncore_perfmon_t *u, uint8_t *mem, uint64_t len, uint64_t offset, int16_t *slice_res)
+//Takes a baseline and waits out a burst with exponential backoff, then sets how many reads each line gets until the
+//next check
+static void noise_check(uncore_perfmon_t *u)
 {
-	//Need to implement averages
-	int16_t total = 0;
-	int slice_count = 0;
+	noise.since_check = 0;
+	noise.level = noise_baseline(u);
+	int backoff = NOISE_BACKOFF_MIN_US;
+	while(noise.level > NOISE_BURST && noise.paused * 1000 < NOISE_PAUSE_MAX_MS)
+	{
+		noise_episode_begin();
+		noise.peak = noise.level > noise.peak ? noise.level : noise.peak;
+		usleep(backoff);
+		metrics_count(METRIC_NOISE_PAUSES);
+		noise.paused += backoff / 1e6;
+		backoff = backoff * 2 < NOISE_BACKOFF_MAX_US ? backoff * 2 : NOISE_BACKOFF_MAX_US;
+		noise.level = noise_baseline(u);
+	}
+
+	if(noise.level > NOISE_HIGH)
+	{
+		noise_episode_begin();
+		noise.peak = noise.level > noise.peak ? noise.level : noise.peak;
+		int reads = (int)(2 * noise.level / NOISE_HIGH);
+		noise.reads = reads < 2 ? 2 : reads > NOISE_MAX_READS ? NOISE_MAX_READS : reads;
+	}
+	else
+	{
+		noise_episode_end();
+		noise.reads = 1;
+	}
+}
 
+int measure_slice_accesses(uncore_perfmon_t *u, uint8_t *mem, uint64_t len, uint64_t offset, int16_t *slice_res)
+{
 	int fail = 1;
-	int found_slice_count = 0;
-	int all_zeroes_count = 0;
-	double mean, stddev;
 	double *data = calloc(u->num_cbo_ctrs, sizeof(double));
+	int attempts = 0;
 	while(fail)
 	{
-		int index_zscore  = -1;
-		int index_slice  = -1;
-		int all_zeroes = 0;
-		fail = 1;
-		found_slice_count = 0;
-		uncore_perfmon_monitor(u, clflush, (void *)&mem[offset], NULL);
-		for (int s = 0; s < u->num_cbo_ctrs; ++s)
+		//A rejected reading checks the background before trying again rather than retrying straight into a burst
+		if(attempts++ > 0)
 		{
-			//Collect data for later zscore calculation
-			data[s] = (double)u->results[s].total/(double)UNCORE_PERFMON_SAMPLES;
-			//printf("%f\n", data[s]);
-
-			//None of these values help us, reset.
-			if(data[s] >= 2.0 || data[s] <= 0.0)
-			{
-		        fail = 1;
-		        continue;
-			}
-			//These are the values we want.
-			if(data[s] >= 1.0)
-			{
-				index_slice = s;
-		        found_slice_count++;
-			}
-			else if (data[s] < 1.0)
-			{
-				all_zeroes++;
-			}
+			metrics_count(METRIC_RETRIES);
+			noise.since_check = NOISE_CHECK_INTERVAL;
 		}
-		//putchar('\n');
-		//Check if we got all zeroes, therefore no CBos experienced CLFLUSHes
-		if(all_zeroes == u->num_cbo_ctrs)
+		if(noise.since_check++ >= NOISE_CHECK_INTERVAL)
+			noise_check(u);
+		if(noise.in_episode)
+			noise.readings++;
+		memset(data, 0, u->num_cbo_ctrs * sizeof(double));
+		for (int r = 0; r < noise.reads; ++r)
 		{
-			all_zeroes_count++;			
-		}		
-		//We have gotten all 0's too many times. Use timing.
-		if(all_zeroes_count >= 1)
+			uncore_perfmon_monitor(u, clflush, (void *)&mem[offset], NULL);
+			metrics_count(METRIC_PERFMON_MONITOR);
+			measure_record_reading(u, &mem[offset], COUNTER_LOG_PROBE);
+			for (int s = 0; s < u->num_cbo_ctrs; ++s)
+				data[s] += (double)u->results[s].total/(double)cbo_samples/noise.reads;
+		}
+		switch(counter_classify(data, u->num_cbo_ctrs, slice_res))
 		{
-			*slice_res = access_get_slice(mem, len, offset);
-			fail = 0;
-			break;
+			case COUNTER_SLICE:
+				fail = 0;
+				break;
+			//No CBos experienced the CLFLUSHes. Use timing.
+			case COUNTER_ALL_ZERO:
+				metrics_count(METRIC_ALL_ZERO_FALLBACKS);
+				*slice_res = access_get_slice(mem, len, offset);
+				fail = 0;
+				break;
+			case COUNTER_ZSCORE:
+				metrics_count(METRIC_ZSCORE_REJECTS);
+				break;
+			//Measurement fail, too noisy
+			default:
+				break;
 		}
-		//Measurement fail, too noisy
-		if(found_slice_count != 1)
+	}
+	free(data);
+}
+
+
+void measure_set_cbo_event(const cbo_event_t *e, int samples)
+{
+	cbo_event_pending = e == NULL;
+	if(e != NULL)
+		cbo_event = *e;
+	cbo_samples_pending = samples <= 0 && e == NULL;
+	cbo_samples = samples > 0 ? samples : UNCORE_PERFMON_SAMPLES;
+}
+
+const cbo_event_t *measure_cbo_event(int *samples)
+{
+	if(samples != NULL)
+		*samples = cbo_samples;
+	return &cbo_event;
+}
+
+static CBO_COUNTER_INFO_T *cbo_counters(int num_cbos, const cbo_event_t *e)
+{
+	CBO_COUNTER_INFO_T *cbo_ctrs = malloc(num_cbos * sizeof(CBO_COUNTER_INFO_T));
+	for (int i = 0; i < num_cbos; ++i)
+	{
+		COUNTER_T temp = {e->event, e->umask, e->filter, e->name};
+		cbo_ctrs[i].counter = temp;
+		cbo_ctrs[i].cbo = i;
+		cbo_ctrs[i].flags = (MSR_UNC_CBO_PERFEVT_EN);
+	}
+	return cbo_ctrs;
+}
+
+//One perfmon read of every line with e, samples flushes each. slices[i] is the classification of line i, or -1.
+//Returns the sums over the lines of the hottest CBo, of the others and of their squares.
+static void cbo_selftest_read(const cbo_event_t *e, int samples, int num_cbos, uint8_t *mem, const uint64_t *lines, int n,
+	int16_t *slices, double *top, double *rest, double *rest_sq)
+{
+	uncore_perfmon_t u;
+	CBO_COUNTER_INFO_T *cbo_ctrs = cbo_counters(num_cbos, e);
+	uncore_perfmon_init(&u, topology_measure_cpu(), samples, num_cbos, 0, 0, cbo_ctrs, NULL, NULL);
+	double data[num_cbos];
+	*top = *rest = *rest_sq = 0.0;
+	for (int i = 0; i < n; ++i)
+	{
+		uncore_perfmon_monitor(&u, clflush, (void *)&mem[lines[i]], NULL);
+		metrics_count(METRIC_PERFMON_MONITOR);
+		int hottest = 0;
+		for (int s = 0; s < num_cbos; ++s)
 		{
-			fail = 1;
-			continue;
+			data[s] = (double)u.results[s].total/(double)samples;
+			hottest = data[s] > data[hottest] ? s : hottest;
 		}
-		else
+		*top += data[hottest];
+		for (int s = 0; s < num_cbos; ++s)
 		{
-			// use z-scores on from the sample to check the values again. If there are more than one Z score either greater than 0 or less than -1,
-			// then the range of values found is too large, and should be remeasured to get a more accurate result.
-			// Expected is only 1 value is positively greater than 1 stddev away from the mean, and the rest should be within -1 stddevs away from the mean.
-			int slice_not_found = 1;
-			mean = calculate_mean(data, u->num_cbo_ctrs);
-			stddev = calculate_stddev(data, u->num_cbo_ctrs, mean);
-
-			int valid_zscore = 0;
-			double zscore;
-			for (int s = 0; s < u->num_cbo_ctrs; ++s)
+			if(s == hottest)
+				continue;
+			*rest += data[s];
+			*rest_sq += data[s] * data[s];
+		}
+		slices[i] = -1;
+		if(counter_classify(data, num_cbos, &slices[i]) != COUNTER_SLICE)
+			slices[i] = -1;
+	}
+	uncore_perfmon_destroy(&u);
+	free(cbo_ctrs);
+}
+
+//Picks the candidate event with the best signal to noise on this CPU: the hottest CBo should see one lookup per flush
+//and the others as little and as steady a background as possible. Then picks the fewest samples per read which,
+//counting the retries they cause, cost the fewest flushes per line without ever classifying a line differently
+//from the full count.
+static void cbo_event_selftest(uint8_t *mem, uint64_t len, int num_cbos)
+{
+	uint64_t lines[CBO_SELFTEST_LINES];
+	int16_t slices[CBO_SELFTEST_LINES], reference[CBO_SELFTEST_LINES];
+	unsigned int pid = (unsigned int)getpid();
+	for (int i = 0; i < CBO_SELFTEST_LINES; ++i)
+	{
+		lines[i] = ((len / CBO_SELFTEST_LINES) * i + i * L3_CACHELINE) % len;
+		lines[i] -= lines[i] % L3_CACHELINE;
+		mem[lines[i]] = pid;
+	}
+
+	if(cbo_event_pending)
+	{
+		double best_snr = -1.0;
+		int best = 0;
+		printf("CBo event self-test on CPU %d, %d lines of %d samples:\n", topology_measure_cpu(), CBO_SELFTEST_LINES, UNCORE_PERFMON_SAMPLES);
+		printf("%-34s | Flush | Background | Spread | SNR | Classified\n", "Event");
+		for (int c = 0; c < CBO_EVENT_CANDIDATES; ++c)
+		{
+			double top, rest, rest_sq;
+			cbo_selftest_read(&cbo_event_candidates[c], UNCORE_PERFMON_SAMPLES, num_cbos, mem, lines, CBO_SELFTEST_LINES, slices, &top, &rest, &rest_sq);
+			double others = (double)CBO_SELFTEST_LINES * (num_cbos - 1);
+			double background = others > 0 ? rest / others : 0.0;
+			double spread = others > 0 ? sqrt(fabs(rest_sq / others - background * background)) : 0.0;
+			double flush = top / CBO_SELFTEST_LINES - background;
+			int classified = 0;
+			for (int i = 0; i < CBO_SELFTEST_LINES; ++i)
+				classified += slices[i] >= 0;
+			//An event which does not count each flush once cannot tell the slice at all
+			double snr = 0.0;
+			if(flush > 0.9 && flush < 1.1)
+				snr = flush / (background + spread + 1.0 / UNCORE_PERFMON_SAMPLES);
+			printf("%-34s | %5.3f | %10.4f | %6.4f | %5.1f | %d/%d\n", cbo_event_candidates[c].name, flush, background, spread, snr, classified, CBO_SELFTEST_LINES);
+			if(snr > best_snr)
 			{
-				zscore = calculate_zscore(data[s], mean, stddev);
-				if(zscore > 0.0 || zscore < -1.0)
-				{
-					index_zscore = s;
-					valid_zscore++;
-				}
+				best_snr = snr;
+				best = c;
+				memcpy(reference, slices, sizeof(reference));
 			}
-			//If we only found 1 valid zscore
-			if(valid_zscore == 1)
+		}
+		cbo_event = cbo_event_candidates[best];
+		cbo_event_pending = 0;
+	}
+	else
+	{
+		double top, rest, rest_sq;
+		cbo_selftest_read(&cbo_event, UNCORE_PERFMON_SAMPLES, num_cbos, mem, lines, CBO_SELFTEST_LINES, reference, &top, &rest, &rest_sq);
+	}
+
+	if(cbo_samples_pending)
+	{
+		static const int divisors[] = {1, 2, 5, 10, 20, 50};
+		double best_cost = -1.0;
+		cbo_samples = UNCORE_PERFMON_SAMPLES;
+		printf("Samples | Classified | Wrong | Flushes per line\n");
+		for (int d = 0; d < (int)(sizeof(divisors) / sizeof(divisors[0])); ++d)
+		{
+			int samples = UNCORE_PERFMON_SAMPLES / divisors[d];
+			int classified = 0, wrong = 0, reads = 0;
+			for (int r = 0; r < CBO_SELFTEST_READS; ++r)
 			{
-				if(index_zscore == index_slice)
+				double top, rest, rest_sq;
+				cbo_selftest_read(&cbo_event, samples, num_cbos, mem, lines, CBO_SELFTEST_LINES, slices, &top, &rest, &rest_sq);
+				for (int i = 0; i < CBO_SELFTEST_LINES; ++i)
 				{
-					*slice_res = index_slice;
-					fail = 0;
-				}
-				else
-				{
-					fail = 1;
+					if(reference[i] < 0)
+						continue;
+					reads++;
+					classified += slices[i] >= 0;
+					wrong += slices[i] >= 0 && slices[i] != reference[i];
 				}
 			}
+			double cost = classified > 0 ? (double)samples * reads / classified : 0.0;
+			printf("%7d | %4d/%-5d | %5d | %.0f\n", samples, classified, reads, wrong, cost);
+			if(wrong == 0 && classified * 2 >= reads && classified > 0 && (best_cost < 0.0 || cost < best_cost))
+			{
+				best_cost = cost;
+				cbo_samples = samples;
+			}
 		}
+		cbo_samples_pending = 0;
 	}
-	free(data);
 }
 
+//Counters for every CBo with the event in use, running the self-test first if it is still pending
+static CBO_COUNTER_INFO_T *cbo_perfmon_init(uncore_perfmon_t *u, int num_cbos, uint8_t *mem, uint64_t len)
+{
+	static int printed = 0;
+	if(cbo_event_pending || cbo_samples_pending)
+		cbo_event_selftest(mem, len, num_cbos);
+	if(!printed)
+	{
+		printf("Counting ");
+		cbo_event_print(stdout, &cbo_event);
+		printf(" with %d samples per read\n", cbo_samples);
+		printed = 1;
+	}
+	CBO_COUNTER_INFO_T *cbo_ctrs = cbo_counters(num_cbos, &cbo_event);
+	uncore_perfmon_init(u, topology_measure_cpu(), cbo_samples, num_cbos, 0, 0, cbo_ctrs, NULL, NULL);
+	return cbo_ctrs;
+}
 
 int get_slice_value(uint8_t *mem, uint64_t len, uint64_t offset)
 {
@@ -219,7 +479,7 @@ int get_slice_value(uint8_t *mem, uint64_t len, uint64_t offset)
 	uint8_t *ptr = &mem[offset];
 	cpu_set_t mask;			
 	CPU_ZERO(&mask);
-	CPU_SET(AFFINITY, &mask);
+	CPU_SET(topology_measure_cpu(), &mask);
 	int result = sched_setaffinity(0, sizeof(mask), &mask);
 	if(result == -1)
 	{
@@ -227,22 +487,11 @@ int get_slice_value(uint8_t *mem, uint64_t len, uint64_t offset)
 		exit(1);
 	}
 
-	int ret = 0;
 	int16_t slice = 0;
 	uncore_perfmon_t u;
-	uint8_t num_cbos = uncore_get_num_cbo(AFFINITY);
+	uint8_t num_cbos = uncore_get_num_cbo(topology_measure_cpu());
 
-	CBO_COUNTER_INFO_T *cbo_ctrs = malloc(num_cbos * sizeof(CBO_COUNTER_INFO_T));
-
-	for (int i = 0; i < num_cbos; ++i)
-	{
-		COUNTER_T temp = {0x34, 0x8F, 0, "UNC_CBO_CACHE_LOOKUP.ANY_MESI"};
-		cbo_ctrs[i].counter = temp;
-		cbo_ctrs[i].cbo = i;
-		cbo_ctrs[i].flags = (MSR_UNC_CBO_PERFEVT_EN);
-	}
-
-	uncore_perfmon_init(&u, AFFINITY, UNCORE_PERFMON_SAMPLES, num_cbos, 0, 0, cbo_ctrs, NULL, NULL);
+	CBO_COUNTER_INFO_T *cbo_ctrs = cbo_perfmon_init(&u, num_cbos, mem, len);
 
 	unsigned int pid = (unsigned int)getpid();
 	
@@ -269,19 +518,9 @@ int get_slice_value(uint8_t *mem, uint64_t len, uint64_t offset)
 void get_slice_values(uint8_t *mem, uint64_t len, uint64_t n_addr, uint64_t start_offset, int16_t *slice_map)
 {
 	uncore_perfmon_t u;
-	uint8_t num_cbos = uncore_get_num_cbo(AFFINITY);
+	uint8_t num_cbos = uncore_get_num_cbo(topology_measure_cpu());
 
-	CBO_COUNTER_INFO_T *cbo_ctrs = malloc(num_cbos * sizeof(CBO_COUNTER_INFO_T));
-
-	for (int i = 0; i < num_cbos; ++i)
-	{
-		COUNTER_T temp = {0x34, 0x8F, 0, "UNC_CBO_CACHE_LOOKUP.ANY_MESI"};
-		cbo_ctrs[i].counter = temp;
-		cbo_ctrs[i].cbo = i;
-		cbo_ctrs[i].flags = (MSR_UNC_CBO_PERFEVT_EN);
-	}
-
-	uncore_perfmon_init(&u, AFFINITY, UNCORE_PERFMON_SAMPLES, num_cbos, 0, 0, cbo_ctrs, NULL, NULL);
+	CBO_COUNTER_INFO_T *cbo_ctrs = cbo_perfmon_init(&u, num_cbos, mem, len);
 
 	unsigned int pid = (unsigned int)getpid();
 	for (uint64_t i = start_offset; i < n_addr; ++i)
@@ -296,12 +535,94 @@ void get_slice_values(uint8_t *mem, uint64_t len, uint64_t n_addr, uint64_t star
 	free(cbo_ctrs);
 }
 
+//One perfmon session kept open for measuring lines one at a time, in whatever order the caller needs them
+struct slice_session
+{
+	uint8_t *mem;
+	uint64_t len;
+	unsigned int pid;
+	uncore_perfmon_t u;
+	CBO_COUNTER_INFO_T *cbo_ctrs;
+	uint64_t measured;
+};
+
+slice_session_t *slice_session_init(uint8_t *mem, uint64_t len)
+{
+	//Setting scheduling to only run on a single core.
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(topology_measure_cpu(), &mask);
+	if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+	{
+		perror("slice_session_init()");
+		exit(1);
+	}
+
+	slice_session_t *s = calloc(1, sizeof(slice_session_t));
+	s->mem = mem;
+	s->len = len;
+	s->pid = (unsigned int)getpid();
+	uint8_t num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	s->cbo_ctrs = cbo_perfmon_init(&s->u, num_cbos, mem, len);
+	return s;
+}
+
+int16_t slice_session_measure(slice_session_t *s, uint64_t offset)
+{
+	int16_t slice = -1;
+	if(offset >= s->len)
+		return -1;
+	s->mem[offset] = s->pid;
+	measure_slice_accesses(&s->u, s->mem, s->len, offset, &slice);
+	s->measured++;
+	return slice;
+}
+
+uint64_t slice_session_measured(slice_session_t *s)
+{
+	return s->measured;
+}
+
+void slice_session_destroy(slice_session_t *s)
+{
+	if(s == NULL)
+		return;
+	uncore_perfmon_destroy(&s->u);
+	free(s->cbo_ctrs);
+	free(s);
+
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (int i = 0; i < CORES; ++i)
+		CPU_SET(i, &mask);
+	if(sched_setaffinity(0, sizeof(mask), &mask) == -1)
+	{
+		perror("slice_session_destroy()");
+		exit(1);
+	}
+}
+
+static int16_t slice_session_measure_line(void *ctx, uint64_t offset)
+{
+	return slice_session_measure((slice_session_t *)ctx, offset);
+}
+
+//Sequence length of this machine in cache lines, measured through one session. 0 if none up to MAX_ID was found.
+uint64_t find_sequence_length(uint8_t *mem, uint64_t len, period_result_t *result)
+{
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	slice_session_t *s = slice_session_init(mem, len);
+	uint64_t seq_len = period_detect(mem, len, PAGE_SIZE, L3_CACHELINE, num_cbos, MAX_ID, slice_session_measure_line, s, result);
+	slice_session_destroy(s);
+	return seq_len;
+}
+
 int get_slice_values_adj(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64_t seq_len)
 {
 	//Setting scheduling to only run on a single core.
 	cpu_set_t mask;			
 	CPU_ZERO(&mask);
-	CPU_SET(0, &mask);
+	CPU_SET(topology_measure_cpu(), &mask);
 	int result = sched_setaffinity(0, sizeof(mask), &mask);
 	if(result == -1)
 	{
@@ -311,24 +632,14 @@ int get_slice_values_adj(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64_t s
 
 	int ret = 0;
 	uncore_perfmon_t u;
-	uint8_t num_cbos = uncore_get_num_cbo(AFFINITY);
-
-	CBO_COUNTER_INFO_T *cbo_ctrs = malloc(num_cbos * sizeof(CBO_COUNTER_INFO_T));
-
-	for (int i = 0; i < num_cbos; ++i)
-	{
-		COUNTER_T temp = {0x34, 0x8F, 0, "UNC_CBO_CACHE_LOOKUP.ANY_MESI"};
-		cbo_ctrs[i].counter = temp;
-		cbo_ctrs[i].cbo = i;
-		cbo_ctrs[i].flags = (MSR_UNC_CBO_PERFEVT_EN);
-	}
+	uint8_t num_cbos = uncore_get_num_cbo(topology_measure_cpu());
 
-	uncore_perfmon_init(&u, AFFINITY, UNCORE_PERFMON_SAMPLES, num_cbos, 0, 0, cbo_ctrs, NULL, NULL);
+	CBO_COUNTER_INFO_T *cbo_ctrs = cbo_perfmon_init(&u, num_cbos, mem, len);
 
 	unsigned int pid = (unsigned int)getpid();
 	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 	{
-		for (uint64_t a = 0; a < NUM_ADJ_ADDR; ++a)
+		for (uint64_t a = 0; a < NUM_ADJ_ADDR && adj->measure[b]; ++a)
 		{
 			printf("Measuring Bit %02ld Adjacent Address Pair %03ld\r", b, a);
 			//adjacent a addresses
@@ -374,7 +685,7 @@ void fill_seq_data(sequence_data_t *seq_data, uint8_t *mem, int16_t *slice_map,
 	for (int s = 0; s < NUM_SEQUENCES; ++s)
 	{
 		unsigned int pid = (unsigned int)getpid();
-		int num_cbos = uncore_get_num_cbo(AFFINITY);
+		int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
 		mem[((s*L3_CACHELINE*seq_len))] = pid;
 		uint64_t pa = vtop(pid, (uint64_t)&mem[((s*L3_CACHELINE*seq_len))]);
 		seq_data[s].vaddr = (uint64_t)&mem[((s*L3_CACHELINE*seq_len))];
@@ -405,6 +716,8 @@ void fill_seq_data(sequence_data_t *seq_data, uint8_t *mem, int16_t *slice_map,
 				break;
 			}
 		}
+		if(seq_data[s].xor_op == 0xBADBAD)
+			metrics_count(METRIC_BADBAD);
 	}
 }
 
@@ -412,13 +725,13 @@ void fill_seq_data(sequence_data_t *seq_data, uint8_t *mem, int16_t *slice_map,
 void fill_seq_data_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len)
 {
 	unsigned int pid = (unsigned int)getpid();
-	int num_cbos = uncore_get_num_cbo(AFFINITY);
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
 	//Get flag for if the current machine has power of 2 number of cores.
-	int two_n_core_machine = is_power_of_two(uncore_get_num_cbo(AFFINITY));
+	int two_n_core_machine = is_power_of_two(uncore_get_num_cbo(topology_measure_cpu()));
 
 	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 	{
-		for (uint64_t a = 0; a < NUM_ADJ_ADDR; ++a)
+		for (uint64_t a = 0; a < NUM_ADJ_ADDR && adj->measure[b]; ++a)
 		{
 			//Accounts for offsets if bits within the 4KB page are set.
 			int len = seq_len;
@@ -475,6 +788,8 @@ void fill_seq_data_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len)
 						break;
 					}				
 				}			
+				if(adj->seq_a[b][a].xor_op == 0xBADBAD)
+					metrics_count(METRIC_BADBAD);
 				//Now do it for the other 'b' sequences.
 				for (uint64_t i = 0; i < MAX_ID; ++i)
 				{
@@ -497,6 +812,8 @@ void fill_seq_data_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len)
 						break;
 					}				
 				}
+				if(adj->seq_b[b][a].xor_op == 0xBADBAD)
+					metrics_count(METRIC_BADBAD);
 			}
 		}
 	}
@@ -524,7 +841,7 @@ void print_slice_values_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len)
 {
 	for (uint64_t b = START_BIT(seq_len); b < ADDR_BITS; ++b)
 	{
-		for (int a = 0; a < NUM_ADJ_ADDR; ++a)
+		for (int a = 0; a < NUM_ADJ_ADDR && adj->measure[b]; ++a)
 		{
 			//Print A
 			printf("Bit %ld Addr %d\n", b, a);
@@ -10,6 +10,11 @@
 
 #include "setup_info.h"
 #include "helpers.h"
+#include "period_detect.h"
+#include "topology.h"
+#include "pfn_index.h"
+#include "counter_log.h"
+#include "cbo_event.h"
 
 #ifndef UNCORE_ADDRESS_MAP_H
 #define UNCORE_ADDRESS_MAP_H
@@ -59,6 +64,8 @@ struct adjacent_address
 	//Sequence data for the above addresses
 	sequence_data_t seq_a[ADDR_BITS][NUM_ADJ_ADDR];
 	sequence_data_t seq_b[ADDR_BITS][NUM_ADJ_ADDR];
+	//Bits searched for and measured, all of them unless this run is one shard of a sharded recovery
+	uint8_t measure[ADDR_BITS];
 } typedef adj_addr_t;
 
 //////////////////////////////////////////////////////////////////////////////////////
@@ -66,10 +73,70 @@ struct adjacent_address
 adj_addr_t *adjacent_address_init();
 void adjacent_address_destroy(adj_addr_t *adj);
 
+//Latency histograms for each level a probed line can be served from, in cycles
+#define TIMING_HIST_BINS 1024
+enum {TIMING_L1, TIMING_L2, TIMING_LLC_LOCAL, TIMING_LLC_REMOTE, TIMING_LEVELS};
+
+struct timing_calibration
+{
+	int calibrated;
+	uint32_t hist[TIMING_LEVELS][TIMING_HIST_BINS];
+	uint64_t count[TIMING_LEVELS];
+	double mean[TIMING_LEVELS];
+	double stddev[TIMING_LEVELS];
+	//Samples outside (llc_min, llc_max) are not LLC hits and are discarded
+	uint32_t llc_min;
+	uint32_t llc_max;
+	//Eviction set size and samples per core needed on this host
+	int evset_len;
+	int samples;
+} typedef timing_calibration_t;
+
+//One thread pinned to each physical core, taking turns timing the same line.
+struct timing_probe
+{
+	uint8_t *mem;
+	uint64_t len;
+	int num_cores;
+	pthread_t *threads;
+	pthread_barrier_t round_start;
+	pthread_barrier_t round_end;
+	pthread_barrier_t turn;
+	//L2 eviction set for L2 set 0, precomputed once
+	uint8_t **evset;
+	int evset_len;
+	//CPU each core's thread runs on and that core's L2 geometry, the measurement core uses the measurement CPU
+	int measure_core;
+	int *core_cpu;
+	uint64_t *l2_sets;
+	int *l2_ways;
+	//Line being probed and each core's minimum access time for the current round
+	volatile uint64_t offset;
+	volatile int stop;
+	uint32_t *round_time;
+	//Every sample of the current round, round_samples_len per core
+	uint32_t *round_samples;
+	int round_samples_len;
+	int samples;
+	timing_calibration_t calib;
+} typedef timing_probe_t;
+
 //////////////////////////////////////////////////////////////////////////////////////
 
+timing_probe_t *timing_probe_init(uint8_t *mem, uint64_t len);
+void timing_probe_destroy(timing_probe_t *p);
+int timing_probe_get_slice(timing_probe_t *p, uint64_t offset);
+void timing_calibration_print(FILE *f, timing_calibration_t *c);
+
 double get_slice_access_time(uint8_t *mem, uint64_t len, uint64_t offset);
 int access_get_slice(uint8_t *mem, uint64_t len, uint64_t offset);
+timing_calibration_t *access_get_calibration();
+//Appends every perfmon read from now on to the counter log at path, -1 if it cannot be opened
+int measure_record(const char *path);
+//CBo event and flushes per perfmon read for every measurement from now on. e NULL picks the event by self-test before
+//the first measurement, and the samples too unless they are given.
+void measure_set_cbo_event(const cbo_event_t *e, int samples);
+const cbo_event_t *measure_cbo_event(int *samples);
 
 //////////////////////////////////////////////////////////////////////////////////////
 
@@ -78,18 +145,57 @@ void get_slice_values(uint8_t *mem, uint64_t len, uint64_t n_addr, uint64_t star
 void fill_seq_data(sequence_data_t *seq_data, uint8_t *mem, int16_t *slice_map, uint64_t seq_len);
 void print_slice_values(sequence_data_t *seq_data, uint64_t seq_len);
 
+//Persistent measurement session, pinned to the measurement CPU (topology_measure_cpu()) until destroyed
+typedef struct slice_session slice_session_t;
+slice_session_t *slice_session_init(uint8_t *mem, uint64_t len);
+//Slice of mem[offset], -1 if it could not be measured
+int16_t slice_session_measure(slice_session_t *s, uint64_t offset);
+uint64_t slice_session_measured(slice_session_t *s);
+void slice_session_destroy(slice_session_t *s);
 
-void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64_t seq_len);
+uint64_t find_sequence_length(uint8_t *mem, uint64_t len, period_result_t *result);
+
+
+void adjacent_address_search(adj_addr_t *adj, uint8_t *mem, uint64_t len, pfn_index_t *pfn, uint64_t seq_len);
 int get_slice_values_adj(adj_addr_t *adj, uint8_t *mem, uint64_t len, uint64_t seq_len);
 void fill_seq_data_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len);
 void print_slice_values_adj(adj_addr_t *adj, uint8_t *mem, uint64_t seq_len);
 
 void find_xor_for_each_bit(adj_addr_t *adj, int xor_map[ADDR_BITS], uint64_t seq_len);
 uint64_t calculate_xor_reduction(uint64_t addr, int xor_map[ADDR_BITS]);
-void find_master_sequence(adj_addr_t *adj, uint8_t *mem, uint64_t len, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS]);
+void find_master_sequence(adj_addr_t *adj, uint8_t *mem, uint64_t len, pfn_index_t *pfn, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS]);
 
 int calculate_address_slice(uint64_t paddr, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS]);
 
+//Agreement between the recovered function and measured slices, stratified by address bit and sequence ID
+struct verify_result
+{
+	uint64_t samples;
+	uint64_t agree;
+	uint64_t unmeasured;
+	double agreement;
+	//95% Wilson interval of the agreement
+	double lower;
+	double upper;
+	double target;
+	const char *verdict;
+	int stopped_early;
+	//Samples and errors among lines with each physical address bit set
+	uint64_t bit_samples[ADDR_BITS];
+	uint64_t bit_errors[ADDR_BITS];
+	//Samples and errors for each master sequence entry
+	uint64_t seq_len;
+	uint64_t *id_samples;
+	uint64_t *id_errors;
+} typedef verify_result_t;
+
+//master_sequence is NULL on 2^n slice machines. Stops before max_samples once the interval is clear of target.
+void verify_mapping(uint8_t *mem, uint64_t len, pfn_index_t *pfn, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS],
+	uint64_t max_samples, double target, verify_result_t *r);
+void verify_result_destroy(verify_result_t *r);
+void verify_result_print(FILE *f, verify_result_t *r);
+void verify_result_json(FILE *f, verify_result_t *r);
+
 //////////////////////////////////////////////////////////////////////////////////////
 
 #endif //UNCORE_ADDRESS_MAP_H
\ No newline at end of file
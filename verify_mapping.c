@@ -0,0 +1,217 @@
+#include "uncore_address_map.h"
+#include "pfn_index.h"
+#include <perf_counters.h>
+#include <string.h>
+
+//Two sided 95% confidence
+#define VERIFY_Z 1.96
+//Early stopping is checked once per batch
+#define VERIFY_BATCH 64
+
+//Wilson score interval for agree out of n
+static void verify_wilson(uint64_t agree, uint64_t n, double *lower, double *upper)
+{
+	if(n == 0)
+	{
+		*lower = 0.0;
+		*upper = 1.0;
+		return;
+	}
+	double p = (double)agree / n;
+	double z2 = VERIFY_Z * VERIFY_Z;
+	double centre = (p + z2 / (2 * n)) / (1 + z2 / n);
+	double half = VERIFY_Z * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n)) / (1 + z2 / n);
+	*lower = centre - half;
+	*upper = centre + half;
+}
+
+//Offset of a line in mem with physical address bit b set, -1 if none was found
+static int64_t verify_pick_bit(pfn_index_t *pfn, int b)
+{
+	for (int tries = 0; tries < 64; ++tries)
+	{
+		uint64_t page = rand64() % pfn->n_pages;
+		uint64_t base = pfn->paddr[page];
+		if(base == (uint64_t)-1)
+			continue;
+		uint64_t offset = rand64() % pfn->page_size;
+		if(b < pfn->page_bits)
+			offset |= 1ULL << b;
+		else if(!is_bit_k_set(base, b))
+			continue;
+		return (page << pfn->page_bits) + (offset & ~(uint64_t)(L3_CACHELINE - 1));
+	}
+	return -1;
+}
+
+//Offset of a line in mem which indexes entry v of the master sequence, -1 if none was found
+static int64_t verify_pick_id(pfn_index_t *pfn, uint64_t v, uint64_t seq_len, int xor_map[ADDR_BITS])
+{
+	uint64_t block_size = seq_len * L3_CACHELINE;
+	for (int tries = 0; tries < 64; ++tries)
+	{
+		uint64_t page = rand64() % pfn->n_pages;
+		uint64_t base = pfn->paddr[page];
+		if(base == (uint64_t)-1)
+			continue;
+		uint64_t block = (base + rand64() % pfn->page_size) & ~(block_size - 1);
+		uint64_t paddr = block + ((v ^ calculate_xor_reduction(block, xor_map)) & (seq_len - 1)) * L3_CACHELINE;
+		if(paddr < base || paddr >= base + pfn->page_size)
+			continue;
+		return (page << pfn->page_bits) + (paddr - base);
+	}
+	return -1;
+}
+
+//Samples alternate between address bit strata (a line with bit b set, for each bit in turn) and sequence ID
+//strata (a line indexing entry v, for each entry in turn), so every bit and every entry is covered early.
+//Sampling stops once the Wilson interval is entirely above or below the target agreement.
+void verify_mapping(uint8_t *mem, uint64_t len, pfn_index_t *pfn, int16_t *master_sequence, uint64_t seq_len, int xor_map[ADDR_BITS],
+	uint64_t max_samples, double target, verify_result_t *r)
+{
+	memset(r, 0, sizeof(verify_result_t));
+	r->seq_len = seq_len;
+	r->target = target;
+	r->id_samples = calloc(seq_len, sizeof(uint64_t));
+	r->id_errors = calloc(seq_len, sizeof(uint64_t));
+	int num_cbos = uncore_get_num_cbo(topology_measure_cpu());
+	int first_bit = find_set_bit(L3_CACHELINE);
+	int reachable[ADDR_BITS];
+	for (int b = 0; b < ADDR_BITS; ++b)
+		reachable[b] = b >= first_bit;
+	//Every stratum gets a sample before stopping early
+	uint64_t min_samples = 2 * (seq_len > ADDR_BITS ? seq_len : ADDR_BITS);
+
+	slice_session_t *session = slice_session_init(mem, len);
+	uint64_t next_bit = first_bit, next_id = 0;
+	for (uint64_t i = 0; i < max_samples; ++i)
+	{
+		int64_t offset = -1;
+		if(i % 2 == 0)
+		{
+			for (int b = 0; b < ADDR_BITS && offset < 0; ++b)
+			{
+				int bit = next_bit;
+				next_bit = next_bit + 1 < ADDR_BITS ? next_bit + 1 : first_bit;
+				if(!reachable[bit])
+					continue;
+				offset = verify_pick_bit(pfn, bit);
+				//Bits above the memory in this machine never come up
+				if(offset < 0)
+					reachable[bit] = 0;
+			}
+		}
+		else
+		{
+			offset = verify_pick_id(pfn, next_id, seq_len, xor_map);
+			next_id = (next_id + 1) % seq_len;
+		}
+		if(offset < 0)
+			offset = (rand64() % len) & ~(uint64_t)(L3_CACHELINE - 1);
+
+		uint64_t paddr = pfn_index_vtop(pfn, offset);
+		int16_t measured = slice_session_measure(session, offset);
+		if(paddr == (uint64_t)-1 || measured < 0 || measured >= num_cbos)
+		{
+			r->unmeasured++;
+			continue;
+		}
+		int calc = calculate_address_slice(paddr, master_sequence, seq_len, xor_map);
+		int error = calc != measured;
+		uint64_t v = (((paddr / L3_CACHELINE) % seq_len) ^ calculate_xor_reduction(paddr, xor_map)) & (seq_len - 1);
+		r->samples++;
+		r->agree += !error;
+		r->id_samples[v]++;
+		r->id_errors[v] += error;
+		for (int b = first_bit; b < ADDR_BITS; ++b)
+		{
+			if(is_bit_k_set(paddr, b))
+			{
+				r->bit_samples[b]++;
+				r->bit_errors[b] += error;
+			}
+		}
+
+		if(r->samples >= min_samples && r->samples % VERIFY_BATCH == 0)
+		{
+			verify_wilson(r->agree, r->samples, &r->lower, &r->upper);
+			if(r->lower >= target || r->upper < target)
+			{
+				r->stopped_early = 1;
+				break;
+			}
+		}
+	}
+	slice_session_destroy(session);
+
+	verify_wilson(r->agree, r->samples, &r->lower, &r->upper);
+	r->agreement = r->samples ? (double)r->agree / r->samples : 0.0;
+	r->verdict = r->lower >= target ? "pass" : r->upper < target ? "fail" : "inconclusive";
+}
+
+void verify_result_destroy(verify_result_t *r)
+{
+	free(r->id_samples);
+	free(r->id_errors);
+}
+
+//A bit is suspect when lines with it set disagree clearly more often than lines with it clear (the
+//intervals do not overlap), which is what a wrong xor_map entry for that bit looks like
+static int verify_bit_suspect(verify_result_t *r, int b)
+{
+	if(r->bit_errors[b] < 2)
+		return 0;
+	uint64_t errors = r->samples - r->agree;
+	double set_lower, set_upper, clear_lower, clear_upper;
+	verify_wilson(r->bit_errors[b], r->bit_samples[b], &set_lower, &set_upper);
+	verify_wilson(errors - r->bit_errors[b], r->samples - r->bit_samples[b], &clear_lower, &clear_upper);
+	return set_lower > clear_upper;
+}
+
+void verify_result_print(FILE *f, verify_result_t *r)
+{
+	fprintf(f, "Verification: %lu/%lu agree (%.4f, 95%% CI %.4f-%.4f) | Target: %.4f | %s%s | Unmeasured: %lu\n",
+		r->agree, r->samples, r->agreement, r->lower, r->upper, r->target, r->verdict,
+		r->stopped_early ? " (stopped early)" : "", r->unmeasured);
+	if(r->agree == r->samples)
+		return;
+	fprintf(f, "Errors by address bit (lines with the bit set):\n");
+	for (int b = 0; b < ADDR_BITS; ++b)
+	{
+		if(r->bit_errors[b] > 0)
+			fprintf(f, "Bit: %02d | Errors: %lu/%lu%s\n", b, r->bit_errors[b], r->bit_samples[b], verify_bit_suspect(r, b) ? " | suspect" : "");
+	}
+	fprintf(f, "Errors by sequence ID:\n");
+	for (uint64_t v = 0; v < r->seq_len; ++v)
+	{
+		if(r->id_errors[v] > 0)
+			fprintf(f, "ID: %lu | Errors: %lu/%lu\n", v, r->id_errors[v], r->id_samples[v]);
+	}
+}
+
+void verify_result_json(FILE *f, verify_result_t *r)
+{
+	fprintf(f, "{\"samples\": %lu, \"agree\": %lu, \"unmeasured\": %lu, \"agreement\": %.6f, ", r->samples, r->agree, r->unmeasured, r->agreement);
+	fprintf(f, "\"ci_lower\": %.6f, \"ci_upper\": %.6f, \"confidence\": 0.95, \"target\": %.6f, ", r->lower, r->upper, r->target);
+	fprintf(f, "\"verdict\": \"%s\", \"stopped_early\": %s, \"seq_len\": %lu, ", r->verdict, r->stopped_early ? "true" : "false", r->seq_len);
+	fprintf(f, "\"bits\": [");
+	int first = 1;
+	for (int b = 0; b < ADDR_BITS; ++b)
+	{
+		if(r->bit_samples[b] == 0)
+			continue;
+		fprintf(f, "%s{\"bit\": %d, \"samples\": %lu, \"errors\": %lu, \"suspect\": %s}", first ? "" : ", ",
+			b, r->bit_samples[b], r->bit_errors[b], verify_bit_suspect(r, b) ? "true" : "false");
+		first = 0;
+	}
+	fprintf(f, "], \"id_errors\": [");
+	first = 1;
+	for (uint64_t v = 0; v < r->seq_len; ++v)
+	{
+		if(r->id_errors[v] == 0)
+			continue;
+		fprintf(f, "%s{\"id\": %lu, \"samples\": %lu, \"errors\": %lu}", first ? "" : ", ", v, r->id_samples[v], r->id_errors[v]);
+		first = 0;
+	}
+	fprintf(f, "]}\n");
+}
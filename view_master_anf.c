@@ -0,0 +1,58 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+// Prints the master sequence of saved results as Boolean functions (see master_anf.h), to
+// compare how the reduction is built across core counts. --c also prints the evaluator.
+// ./view_master_anf [--c] <result file | model>...
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#include "master_anf.h"
+#include "slicehash.h"
+
+#include <string.h>
+
+int main(int argc, char const *argv[])
+{
+	int print_c = 0, ret = 0;
+	if(argc < 2)
+	{
+		printf("Usage: %s [--c] <result file | model>...\n", argv[0]);
+		return 1;
+	}
+	for (int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "--c") == 0)
+		{
+			print_c = 1;
+			continue;
+		}
+		slicehash_t *h = slicehash_load(argv[i]);
+		if(h == NULL)
+			h = slicehash_load_db("output", argv[i]);
+		if(h == NULL)
+		{
+			printf("Could not load a slice hash from %s\n", argv[i]);
+			ret = 1;
+			continue;
+		}
+		const int16_t *master_sequence = slicehash_master_sequence(h);
+		printf("%s | %s | %d slices | Sequence length %lu\n", argv[i], slicehash_model(h), slicehash_num_slices(h), slicehash_seq_len(h));
+		master_anf_t *anf = master_anf_create(master_sequence, slicehash_seq_len(h));
+		if(master_sequence == NULL)
+			printf("No master sequence, the slice is the XOR reduction\n");
+		else if(anf == NULL)
+			printf("Master sequence too long to analyse\n");
+		else
+		{
+			uint64_t mismatches = master_anf_verify(anf, master_sequence, slicehash_seq_len(h));
+			master_anf_print(stdout, anf);
+			printf("Checked against all %lu entries: %lu mismatches\n", slicehash_seq_len(h), mismatches);
+			if(mismatches != 0)
+				ret = 1;
+			else if(print_c)
+				master_anf_print_c(stdout, anf, "master_sequence_anf");
+		}
+		putchar('\n');
+		master_anf_destroy(anf);
+		slicehash_destroy(h);
+	}
+	return ret;
+}
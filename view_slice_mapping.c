@@ -29,50 +29,31 @@ int main(int argc, char const *argv[])
 	}
 	putchar('\n');
 
-	//Get slice values from the perf counter library
-	printf("Getting slice mapping\n");
-	size_t max_seq_len = 0;
-	size_t power = 1;
-	//Search through varying sequence lengths up to 32768 (MAX_ID). This is an arbitrary limit.
-	for (size_t seq_len = 1; seq_len < MAX_ID; seq_len = seq_len << 1)
+	//Find the sequence length directly, then measure enough sequences of that length to show them
+	printf("Finding sequence length\n");
+	period_result_t period;
+	size_t power = find_sequence_length(mem, len, &period);
+	period_result_print(stdout, &period);
+	if(power == 0)
 	{
-		size_t n_addr = NUM_SEQUENCES*seq_len;
-		get_slice_values(mem, len, n_addr, (NUM_SEQUENCES*(seq_len >> 1)), slice_map);
-
-		//Fill the sequence data with info from the slice mapping
-		fill_seq_data(seq_data, mem, slice_map, seq_len);
-
-		//Finding max sequence length.
-		//Get the max ID
-		for (int s = 0; s < NUM_SEQUENCES; ++s)
-		{
-			//Ignore 0xBADBAD
-			if(seq_data[s].xor_op != 0xBADBAD && seq_data[s].xor_op > max_seq_len)
-			{
-				max_seq_len = seq_data[s].xor_op;
-			}
-		}
+		printf("No sequence length up to %d found\n", MAX_ID);
+		exit(1);
+	}
+	putchar('\n');
 
-		//Find the closest upper power of 2. This will be the sequence length.
-		//E.g. 3=>4, 25=>32, 127=>128
-		while(power < max_seq_len)
-		    power*=2;
+	printf("Getting slice mapping\n");
+	get_slice_values(mem, len, NUM_SEQUENCES*power, 0, slice_map);
+	fill_seq_data(seq_data, mem, slice_map, power);
 
-		printf("Tried Sequence Length: %ld | Max Sequence Length Found: %ld | Max ID: %ld\n\n", seq_len, max_seq_len, power);
-		
-		//Print each sequence
-		//print_slice_values(seq_data, seq_len);
-		if(seq_len > power)
-		{
-			break;
-		}
-	}
-	
 	//Print each sequence
 	print_slice_values(seq_data, power);
 
 	printf("Max Sequence Length: %lu\n\n", power);
 
+	//Save the timing calibration with the results if the timing fallback was used
+	if(access_get_calibration() != NULL)
+		timing_calibration_print(stdout, access_get_calibration());
+
 	//Release (the dragon)
 	munmap(mem, len * sizeof(uint8_t));
 	free(slice_map);